@@ -17,6 +17,27 @@
 #include <exception>
 #include <set>
 #include <string>
+#include <cstdint>
+#include <cmath>
+#include <climits>
+#include <bitset>
+#include <charconv>
+#include <cstring>
+#include <cstdlib>
+#include <array>
+#include <unordered_set>
+#if defined(__unix__) || defined(__APPLE__)
+#define MINILANG_HAS_MMAP 1
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MINILANG_X86_SIMD 1
+#define MINILANG_TARGET(isa) __attribute__((target(isa)))
+#include <immintrin.h>
+#endif
 template<class... Ts> struct overloaded : Ts... { using Ts::operator()...; };
 template<class... Ts> overloaded(Ts...) -> overloaded<Ts...>; 
 
@@ -54,6 +75,7 @@ struct FuncLiteralExpr;
 // Wrappers to break recursive dependency in std::variant
 struct ArrayValue;
 struct DictValue;
+class NativeObject;
 
 using ExprPtr = std::unique_ptr<Expr>;
 using StmtPtr = std::unique_ptr<Stmt>;
@@ -66,6 +88,9 @@ struct ParamInfo {
 
 TokenType get_value_type_token(const Value& val);
 bool check_type(TokenType expected, const Value& val);
+Value coerce_static_type(TokenType expected, Value val);
+// range 在需要真正数组的地方（下标赋值、append/pop、+ 和 ==）物化为数组；其他值原样返回
+Value array_operand(const Value& val);
 
 
 // ===================================================================
@@ -254,41 +279,232 @@ private:
 // ===================================================================
 
 class StringData {
-    using SharedString = std::shared_ptr<std::string>;
+    // 非 ASCII 字符串的码点索引：每 STEP 个码点记一次字节偏移，定位任一码点最多向前解码 STEP - 1 个字符
+    struct Utf8Index {
+        static constexpr size_t STEP = 64;
+        size_t length = 0;          // 码点总数
+        std::vector<size_t> marks;  // marks[k] 为第 k * STEP 个码点的字节偏移
+        size_t cursor_cp = 0;       // 上一次定位的码点及其字节偏移，顺序访问时从这里继续
+        size_t cursor_byte = 0;
+    };
+    enum class Encoding : unsigned char { UNKNOWN, ASCII, UTF8 };
+    // 字符串内容与其哈希值放在同一块共享存储中，哈希只在第一次用作字典键时计算；
+    // 是否纯 ASCII 与码点索引同样在第一次按字符访问时计算并缓存
+    struct Body {
+        std::string str;
+        mutable size_t hash = 0;
+        mutable bool hashed = false;
+        bool is_view = false; // 为真时实际类型是 ViewBody，内容尚未复制到 str
+        mutable Encoding encoding = Encoding::UNKNOWN;
+        mutable std::unique_ptr<Utf8Index> utf8;
+        Body() = default;
+        explicit Body(std::string s) : str(std::move(s)) {}
+    };
+    // 子串视图：与父串（或映射文件等其他拥有者）共享缓冲区，第一次需要 std::string 时才复制出来
+    struct ViewBody : Body {
+        std::shared_ptr<const void> base;
+        const char* ptr;
+        size_t len;
+        ViewBody(std::shared_ptr<const void> b, const char* p, size_t n) : base(std::move(b)), ptr(p), len(n) { is_view = true; }
+    };
+    using SharedString = std::shared_ptr<Body>;
     SharedString data;
 
     static std::unordered_map<std::string, SharedString> intern_pool;
+    // 短于此长度的子串直接复制，避免小串拖住大块父缓冲区
+    static constexpr size_t MIN_VIEW_LENGTH = 64;
 
     explicit StringData(SharedString s) : data(std::move(s)) {}
 
+    static bool all_ascii(std::string_view s) {
+        const char* p = s.data();
+        size_t n = s.size(), i = 0;
+        uint64_t bits = 0;
+        for (; i + 8 <= n; i += 8) {
+            uint64_t word;
+            std::memcpy(&word, p + i, 8);
+            bits |= word;
+        }
+        for (; i < n; ++i) bits |= static_cast<unsigned char>(p[i]);
+        return (bits & 0x8080808080808080ULL) == 0;
+    }
+
+    const Utf8Index& utf8_index() const {
+        if (!data->utf8) {
+            auto index = std::make_unique<Utf8Index>();
+            std::string_view s = view();
+            size_t pos = 0, cp = 0;
+            index->marks.reserve(s.size() / Utf8Index::STEP + 1);
+            while (pos < s.size()) {
+                if (cp % Utf8Index::STEP == 0) index->marks.push_back(pos);
+                pos += char_length(s, pos);
+                ++cp;
+            }
+            index->length = cp;
+            data->utf8 = std::move(index);
+        }
+        return *data->utf8;
+    }
+
+    static std::vector<StringData> make_char_table() {
+        std::vector<StringData> table;
+        table.reserve(256);
+        for (int c = 0; c < 256; ++c) {
+            table.push_back(StringData(std::string(1, static_cast<char>(c))));
+            table.back().hash();
+            table.back().is_ascii();
+        }
+        return table;
+    }
+
 public:
-    explicit StringData(const std::string& s) : data(std::make_shared<std::string>(s)) {}
-    explicit StringData(const char* s) : data(std::make_shared<std::string>(s)) {}
+    explicit StringData(const std::string& s) : data(std::make_shared<Body>(s)) {}
+    explicit StringData(std::string&& s) : data(std::make_shared<Body>(std::move(s))) {}
+    explicit StringData(const char* s) : data(std::make_shared<Body>(s)) {}
 
     static StringData from_literal(const std::string& literal) {
         if (auto it = intern_pool.find(literal); it != intern_pool.end()) {
             return StringData(it->second);
         }
-        auto new_shared_str = std::make_shared<std::string>(literal);
+        auto new_shared_str = std::make_shared<Body>(literal);
         intern_pool[literal] = new_shared_str;
         return StringData(new_shared_str);
     }
-    
-    const std::string& get() const { return *data; }
+
+    // 256 个单字节字符串预先分配好，按字符扫描时不再逐个分配
+    static const StringData& of_char(unsigned char c) {
+        static const std::vector<StringData> table = make_char_table();
+        return table[c];
+    }
+
+    // 内容直接引用 owner 持有的只读内存（如映射文件），owner 随字符串存活；短串仍然复制
+    static StringData view_of(std::shared_ptr<const void> owner, const char* ptr, size_t n) {
+        if (n < MIN_VIEW_LENGTH) return StringData(std::string(ptr, n));
+        return StringData(std::make_shared<ViewBody>(std::move(owner), ptr, n));
+    }
+
+    // 取 [pos, pos + n) 子串（调用方保证范围合法）：单字节走预分配表，较长的子串共享父缓冲区
+    StringData substr(size_t pos, size_t n) const {
+        std::string_view v = view();
+        if (n == 1) return of_char(static_cast<unsigned char>(v[pos]));
+        // 视图总是挂在拥有缓冲区的对象上，不会形成视图链
+        std::shared_ptr<const void> owner = data->is_view ? static_cast<const ViewBody*>(data.get())->base : data;
+        StringData result = view_of(std::move(owner), v.data() + pos, n);
+        if (data->encoding == Encoding::ASCII) result.data->encoding = Encoding::ASCII;
+        return result;
+    }
+
+    std::string_view view() const {
+        if (data->is_view) {
+            auto* v = static_cast<const ViewBody*>(data.get());
+            return std::string_view(v->ptr, v->len);
+        }
+        return data->str;
+    }
+    size_t size() const { return view().size(); }
+
+    // pos 处 UTF-8 字符的字节数；不合法的字节单独算作一个字符
+    static size_t char_length(std::string_view s, size_t pos) {
+        unsigned char c = static_cast<unsigned char>(s[pos]);
+        size_t n = c < 0x80 ? 1 : c >= 0xC2 && c <= 0xDF ? 2 : c >= 0xE0 && c <= 0xEF ? 3 : c >= 0xF0 && c <= 0xF4 ? 4 : 1;
+        if (n == 1 || pos + n > s.size()) return 1;
+        for (size_t i = 1; i < n; ++i) {
+            if ((static_cast<unsigned char>(s[pos + i]) & 0xC0) != 0x80) return 1;
+        }
+        return n;
+    }
+
+    bool is_ascii() const {
+        if (data->encoding == Encoding::UNKNOWN) {
+            data->encoding = all_ascii(view()) ? Encoding::ASCII : Encoding::UTF8;
+        }
+        return data->encoding == Encoding::ASCII;
+    }
+
+    // 按码点计的长度；纯 ASCII 字符串就是字节数
+    size_t length() const { return is_ascii() ? size() : utf8_index().length; }
+
+    // 第 cp 个码点的字节偏移（cp == length() 时为字节总数），借助索引与游标均摊 O(1)
+    size_t byte_offset(size_t cp) const {
+        if (is_ascii()) return cp;
+        const Utf8Index& index = utf8_index();
+        std::string_view s = view();
+        if (cp >= index.length) return s.size();
+        size_t at_cp = cp / Utf8Index::STEP * Utf8Index::STEP;
+        size_t pos = index.marks[cp / Utf8Index::STEP];
+        if (index.cursor_cp <= cp && index.cursor_cp > at_cp) {
+            at_cp = index.cursor_cp;
+            pos = index.cursor_byte;
+        }
+        for (; at_cp < cp; ++at_cp) pos += char_length(s, pos);
+        data->utf8->cursor_cp = cp;
+        data->utf8->cursor_byte = pos;
+        return pos;
+    }
+
+    // 字节偏移 pos 之前的码点个数
+    size_t code_point_offset(size_t pos) const {
+        if (is_ascii()) return pos;
+        std::string_view s = view();
+        size_t cp = 0;
+        for (size_t i = 0; i < pos; i += char_length(s, i)) ++cp;
+        return cp;
+    }
+
+    // 第 cp 个码点组成的字符串与码点区间 [b, e) 的子串
+    StringData char_at(size_t cp) const {
+        if (is_ascii()) return of_char(static_cast<unsigned char>(view()[cp]));
+        size_t pos = byte_offset(cp);
+        return substr(pos, char_length(view(), pos));
+    }
+    StringData slice(size_t b, size_t e) const {
+        size_t from = byte_offset(b);
+        return substr(from, byte_offset(e) - from);
+    }
+
+    const std::string& get() const {
+        if (data->is_view) {
+            // 需要以 NUL 结尾的 std::string 时才把视图内容复制出来，并释放父缓冲区
+            auto* v = static_cast<ViewBody*>(data.get());
+            v->str.assign(v->ptr, v->len);
+            v->is_view = false;
+            v->base.reset();
+        }
+        return data->str;
+    }
+    // 共享同一份存储的字符串返回相同的地址，供序列化识别共享引用
+    const void* identity() const { return data.get(); }
+    long use_count() const { return data.use_count(); }
+
+    size_t hash() const {
+        if (!data->hashed) {
+            data->hash = std::hash<std::string_view>{}(view());
+            data->hashed = true;
+        }
+        return data->hash;
+    }
 
     std::string& writeable() {
-        if (data.use_count() > 1) {
-            data = std::make_shared<std::string>(*data);
+        if (data.use_count() > 1 || data->is_view) {
+            data = std::make_shared<Body>(std::string(view()));
+        } else {
+            // 调用方即将原地修改内容
+            data->hashed = false;
+            data->encoding = Encoding::UNKNOWN;
+            data->utf8.reset();
         }
-        return *data;
+        return data->str;
     }
 
     bool operator==(const StringData& other) const {
-        return data == other.data || (data && other.data && *data == *other.data);
+        if (data == other.data) return true;
+        if (!data || !other.data) return false;
+        if (data->hashed && other.data->hashed && data->hash != other.data->hash) return false;
+        return view() == other.view();
     }
     bool operator!=(const StringData& other) const { return !(*this == other); }
 };
-std::unordered_map<std::string, std::shared_ptr<std::string>> StringData::intern_pool;
+std::unordered_map<std::string, std::shared_ptr<StringData::Body>> StringData::intern_pool;
 
 
 class Callable {
@@ -299,13 +515,48 @@ public:
     virtual std::string toString() const = 0;
 };
 
+// 迭代器协议：ForEachStmt 在循环开始时取得一次迭代器，之后每一步只调用 next()
+class Iterator {
+public:
+    virtual ~Iterator() = default;
+    // 将下一个元素写入 out；序列耗尽时返回 false
+    virtual bool next(Value& out) = 0;
+};
+
+// 由 C++ 实现的值类型（惰性序列、视图等）的公共基类
+class NativeObject : public std::enable_shared_from_this<NativeObject> {
+public:
+    virtual ~NativeObject() = default;
+    virtual std::string typeName() const = 0;
+    virtual std::string toString() const { return "<" + typeName() + ">"; }
+    virtual bool toBool() const { return true; }
+    // 不可迭代的类型返回 nullptr
+    virtual std::unique_ptr<Iterator> iter() { return nullptr; }
+    virtual int length() const { throw std::runtime_error("Value of type '" + typeName() + "' has no length."); }
+    virtual Value getIndex(const Value& index);
+    virtual void setIndex(const Value& index, const Value& value);
+    virtual Value slice(int start, int end);
+    // 方法调用：返回绑定到本对象的原生函数
+    virtual Value getMember(const std::string& name);
+    // 在确实需要数组的地方按需物化；默认实现逐个取出 iter() 的元素
+    virtual std::shared_ptr<ArrayValue> toArray();
+    // deepcopy 使用：可变类型返回自身的独立副本，不可变类型返回 nullptr 表示直接共享
+    virtual std::shared_ptr<NativeObject> clone() const { return nullptr; }
+    // deepcopy 使用：clone() 得到的副本通过它交出自己持有的元素，由 deepcopy 逐个替换为深拷贝
+    virtual void forEachValue(const std::function<void(Value&)>&) {}
+    // 可以作为字典键的不可变类型（如 tuple）重写这两个方法；默认不可哈希，按身份比较
+    virtual size_t hash() const { throw std::runtime_error("Unhashable type '" + typeName() + "'."); }
+    virtual bool equals(const NativeObject& other) const { return this == &other; }
+};
+
 class Value {
 public:
     using FuncType = std::shared_ptr<Callable>;
     using MutableObjectType = std::shared_ptr<MutableObject>;
     using ArrayType = std::shared_ptr<ArrayValue>;
     using DictType = std::shared_ptr<DictValue>;
-    using VariantType = std::variant<std::monostate, int, double, bool, StringData, FuncType, ArrayType, DictType, MutableObjectType>;
+    using NativeType = std::shared_ptr<NativeObject>;
+    using VariantType = std::variant<std::monostate, int, double, bool, StringData, FuncType, ArrayType, DictType, MutableObjectType, NativeType>;
 private:
     VariantType data;
 public:
@@ -314,12 +565,14 @@ public:
     Value(double v) : data(v) {}
     Value(bool v) : data(v) {}
     Value(const std::string& v) : data(StringData(v)) {}
+    Value(std::string&& v) : data(StringData(std::move(v))) {}
     Value(const char* v) : data(StringData(v)) {}
     Value(StringData v) : data(std::move(v)) {}
     Value(FuncType v) : data(std::move(v)) {}
     Value(ArrayType v) : data(std::move(v)) {}
     Value(DictType v) : data(std::move(v)) {}
     Value(MutableObjectType v) : data(std::move(v)) {}
+    Value(NativeType v) : data(std::move(v)) {}
 
     template <typename T> bool is() const { return std::holds_alternative<T>(data); }
     template <typename T> const T& as() const {
@@ -333,13 +586,19 @@ public:
 
     bool toBool() const;
     std::string toString() const;
+    // 把字符串表示直接追加到 out 末尾；嵌套的数组/字典共用同一个缓冲区，不产生中间字符串
+    void format(std::string& out) const;
     const VariantType& getVariant() const { return data; }
 
     bool operator==(const Value& other) const {
+        if (auto* l = std::get_if<NativeType>(&data)) {
+            auto* r = std::get_if<NativeType>(&other.data);
+            return r && (*l == *r || (*l && *r && (*l)->equals(**r)));
+        }
         return data == other.data;
     }
     bool operator!=(const Value& other) const {
-        return data != other.data;
+        return !(*this == other);
     }
 };
 
@@ -352,17 +611,357 @@ public:
     explicit ThrowSignal(Value val) : thrown_value(std::move(val)) {}
 };
 
+// ---- 写时复制的数组缓冲区 (CowVector) ----
+// 多个数组可以共享同一块缓冲区，各自只记录 [off, off + len) 这一段：slice() 与 a + b 都不复制元素。
+// 只读访问永远不复制；修改时若缓冲区被共享，先复制出自己那一段（写时复制）。
+// 例外是尾部追加：本数组恰好结束在缓冲区末尾时，追加的新槽位不属于任何其他共享者，可以原地写入，
+// 因此 `a = a + [x]` 这样的循环是均摊 O(1) 的。
+// 没有提供可写的 operator[]/begin()，所有修改都必须经过下面的方法，避免误触发复制或漏掉复制。
+class CowVector {
+    using Buffer = std::vector<Value>;
+    std::shared_ptr<Buffer> buf;
+    size_t off = 0;
+    size_t len = 0;
+
+    bool unique() const { return buf.use_count() == 1; }
+
+    void detach(size_t extra = 0) {
+        auto fresh = std::make_shared<Buffer>();
+        fresh->reserve(len + extra);
+        fresh->assign(begin(), end());
+        buf = std::move(fresh);
+        off = 0;
+    }
+
+    // 保证可以在 buf 末尾追加 n 个元素而不影响其他共享者
+    void prepareAppend(size_t n) {
+        if (!buf) {
+            buf = std::make_shared<Buffer>();
+            off = 0;
+        } else if (off + len != buf->size()) {
+            if (unique()) buf->resize(off + len);
+            else detach(n);
+        }
+    }
+
+    bool aliases(const Value* p) const {
+        if (!buf || buf->empty()) return false;
+        std::less_equal<const Value*> le;
+        return le(buf->data(), p) && !le(buf->data() + buf->size(), p);
+    }
+
+public:
+    CowVector() = default;
+    CowVector(std::vector<Value> values)
+        : buf(std::make_shared<Buffer>(std::move(values))), len(buf->size()) {}
+    CowVector(std::initializer_list<Value> values) : CowVector(std::vector<Value>(values)) {}
+
+    size_t size() const { return len; }
+    bool empty() const { return len == 0; }
+    const Value* begin() const { return buf ? buf->data() + off : nullptr; }
+    const Value* end() const { return begin() + len; }
+    const Value& operator[](size_t i) const { return (*buf)[off + i]; }
+    const Value& front() const { return (*buf)[off]; }
+    const Value& back() const { return (*buf)[off + len - 1]; }
+
+    // 与本数组共享缓冲区的 [b, e) 视图，O(1)
+    CowVector slice(size_t b, size_t e) const {
+        CowVector part;
+        if (e > b) {
+            part.buf = buf;
+            part.off = off + b;
+            part.len = e - b;
+        }
+        return part;
+    }
+
+    void reserve(size_t n) {
+        if (n <= len) return;
+        prepareAppend(n - len);
+        buf->reserve(off + n);
+    }
+    void push_back(Value v) {
+        prepareAppend(1);
+        buf->push_back(std::move(v));
+        ++len;
+    }
+    template <typename... Args>
+    void emplace_back(Args&&... args) { push_back(Value(std::forward<Args>(args)...)); }
+    template <typename It>
+    void append(It first, It last) {
+        if constexpr (std::is_same_v<std::decay_t<It>, const Value*>) {
+            if (first != last && aliases(first)) { // a + a：源区间就在将要扩容的缓冲区里
+                Buffer copy(first, last);
+                append(copy.cbegin(), copy.cend());
+                return;
+            }
+        }
+        size_t n = static_cast<size_t>(std::distance(first, last));
+        prepareAppend(n);
+        buf->insert(buf->end(), first, last);
+        len += n;
+    }
+    void append(const CowVector& other) { append(other.begin(), other.end()); }
+    template <typename It>
+    void assign(It first, It last) {
+        buf = std::make_shared<Buffer>(first, last);
+        off = 0;
+        len = buf->size();
+    }
+    void pop_back() {
+        if (unique()) buf->resize(off + len - 1);
+        --len;
+    }
+    void set(size_t i, Value v) {
+        if (!unique()) detach();
+        (*buf)[off + i] = std::move(v);
+    }
+    void clear() {
+        buf.reset();
+        off = len = 0;
+    }
+    // 独占、恰好覆盖本数组的底层 vector，供原地排序、删除等操作使用
+    Buffer& mut() {
+        if (!buf) {
+            buf = std::make_shared<Buffer>();
+        } else if (!unique()) {
+            detach();
+        } else if (off != 0 || off + len != buf->size()) {
+            buf->resize(off + len);
+            buf->erase(buf->begin(), buf->begin() + off);
+            off = 0;
+        }
+        return *buf;
+    }
+    // 缓冲区是否被别的数组共享（切片、a + b 的结果等）
+    bool shared() const { return buf && !unique(); }
+    void erase(size_t i) {
+        Buffer& v = mut();
+        v.erase(v.begin() + i);
+        --len;
+    }
+
+    bool operator==(const CowVector& other) const {
+        return len == other.len && std::equal(begin(), end(), other.begin());
+    }
+};
+
 struct ArrayValue {
-    std::vector<Value> elements;
+    CowVector elements;
     bool operator==(const ArrayValue& other) const {
         return elements == other.elements;
     }
 };
 
-struct DictValue {
-    std::unordered_map<std::string, Value> pairs;
+static std::string value_type_name(const Value& val);
+
+// 字典键的哈希与相等协议：int 以自身为哈希，不经过任何字符串运算；数值相等的 float 与 int 是同一个键；
+// 字符串使用缓存在 StringData 中的哈希；原生类型交给 NativeObject::hash()/equals()（如 tuple）。
+// 数组、字典、对象是可变的，函数没有值语义，都不能作为键。
+inline size_t hash_key(const Value& key) {
+    if (key.is<int>()) return static_cast<size_t>(static_cast<long long>(key.as<int>()));
+    if (key.is<StringData>()) return key.as<StringData>().hash();
+    if (key.is<double>()) {
+        double d = key.as<double>();
+        if (d >= INT_MIN && d <= INT_MAX && d == std::floor(d)) return static_cast<size_t>(static_cast<long long>(d));
+        return std::hash<double>{}(d);
+    }
+    if (key.is<bool>()) return key.as<bool>() ? 1 : 0;
+    if (key.is<Value::NativeType>()) return key.as<Value::NativeType>()->hash();
+    throw std::runtime_error("Unhashable type '" + value_type_name(key) + "'. Use freeze() to get an immutable key.");
+}
+
+inline bool keys_equal(const Value& a, const Value& b) {
+    if (a.is<int>() && b.is<int>()) return a.as<int>() == b.as<int>();
+    if ((a.is<int>() || a.is<double>()) && (b.is<int>() || b.is<double>())) {
+        double l = a.is<int>() ? a.as<int>() : a.as<double>();
+        double r = b.is<int>() ? b.as<int>() : b.as<double>();
+        return l == r;
+    }
+    return a == b;
+}
+
+// 开放寻址哈希表：entries 按插入顺序紧密存放，slots 只保存指向 entries 的下标。字典与 Set 共用。
+// Entry 需提供 key / hash / deleted 成员、以 (key, hash, ...) 构造，以及释放内容的 drop()。
+// 字符串键直接保存 StringData（与源字符串共享存储），哈希值缓存在字符串里，不再复制成 std::string。
+template <typename Entry>
+class FlatHashTable {
+public:
+    size_t size() const { return live; }
+    bool empty() const { return live == 0; }
+
+    // K 为 StringData（成员访问的驻留键）或 Value；不可哈希的 Value 键抛出 std::runtime_error
+    template <typename K> const Entry* findEntry(const K& key) const {
+        int32_t idx = lookup(key, hash_of(key));
+        return idx < 0 ? nullptr : &entries[idx];
+    }
+    template <typename K> Entry* findEntry(const K& key) {
+        int32_t idx = lookup(key, hash_of(key));
+        return idx < 0 ? nullptr : &entries[idx];
+    }
+    template <typename K> bool contains(const K& key) const { return lookup(key, hash_of(key)) >= 0; }
+
+    // 键已存在时返回原有项，否则以 args 构造新项追加到末尾；返回的指针在下一次插入前有效
+    template <typename K, typename... Args>
+    std::pair<Entry*, bool> emplace(const K& key, Args&&... args) {
+        size_t h = hash_of(key);
+        if (int32_t idx = lookup(key, h); idx >= 0) return { &entries[idx], false };
+        if ((entries.size() + 1) * 3 > slots.size() * 2) rebuild(live * 2 + 1);
+        int32_t idx = static_cast<int32_t>(entries.size());
+        entries.emplace_back(Value(key), h, std::forward<Args>(args)...);
+        ++live;
+        probe(h, slots.size() - 1, [&](size_t i) {
+            int32_t cur = slots[i];
+            if (cur == EMPTY || entries[cur].deleted) {
+                slots[i] = idx;
+                return true;
+            }
+            return false;
+        });
+        return { &entries.back(), true };
+    }
+
+    template <typename K> bool erase(const K& key) {
+        int32_t idx = lookup(key, hash_of(key));
+        if (idx < 0) return false;
+        // 槽位仍指向被删除的项以保持探测链，真正的回收在下一次重建时完成
+        entries[idx].drop();
+        --live;
+        return true;
+    }
+
+    void reserve(size_t n) {
+        if ((n + 1) * 3 > slots.size() * 2) rebuild(n);
+    }
+
+    // 按插入顺序遍历：从 pos 开始跳过已删除项，返回下一项并前移 pos；遍历结束时返回 nullptr
+    const Entry* next(size_t& pos) const {
+        while (pos < entries.size()) {
+            const Entry& e = entries[pos++];
+            if (!e.deleted) return &e;
+        }
+        return nullptr;
+    }
+    // 可写版本：调用方只能修改值，不能修改键
+    Entry* next(size_t& pos) { return const_cast<Entry*>(std::as_const(*this).next(pos)); }
+
+    class const_iterator {
+        const FlatHashTable* table;
+        size_t pos;
+        const Entry* current;
+    public:
+        const_iterator(const FlatHashTable* t, size_t p) : table(t), pos(p), current(t->next(pos)) {}
+        const Entry& operator*() const { return *current; }
+        const Entry* operator->() const { return current; }
+        const_iterator& operator++() { current = table->next(pos); return *this; }
+        bool operator!=(const const_iterator& other) const { return current != other.current; }
+    };
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, entries.size()); }
+
+private:
+    static constexpr int32_t EMPTY = -1;
+    std::vector<Entry> entries;
+    std::vector<int32_t> slots; // 容量总是 2 的幂，装载率不超过 2/3
+    size_t live = 0;
+
+    // 与 CPython 相同的扰动探测序列，保证最终访问到所有槽位
+    template <typename F>
+    static void probe(size_t h, size_t mask, F&& visit) {
+        size_t i = h & mask;
+        for (size_t perturb = h; !visit(i); perturb >>= 5) {
+            i = (i * 5 + 1 + perturb) & mask;
+        }
+    }
+
+    static size_t hash_of(const StringData& key) { return key.hash(); }
+    static size_t hash_of(const Value& key) { return hash_key(key); }
+
+    template <typename Match>
+    int32_t lookup(size_t h, Match&& match) const {
+        if (live == 0) return -1;
+        int32_t found = -1;
+        probe(h, slots.size() - 1, [&](size_t i) {
+            int32_t idx = slots[i];
+            if (idx == EMPTY) return true;
+            const Entry& e = entries[idx];
+            if (!e.deleted && e.hash == h && match(e.key)) {
+                found = idx;
+                return true;
+            }
+            return false;
+        });
+        return found;
+    }
+    int32_t lookup(const StringData& key, size_t h) const {
+        return lookup(h, [&](const Value& k) { return k.is<StringData>() && k.as<StringData>() == key; });
+    }
+    int32_t lookup(const Value& key, size_t h) const {
+        if (key.is<int>()) {
+            // 整数键快速路径：哈希即整数本身，比较也不经过通用的 keys_equal
+            const int v = key.as<int>();
+            return lookup(h, [v](const Value& k) { return k.is<int>() ? k.as<int>() == v : k.is<double>() && k.as<double>() == v; });
+        }
+        if (key.is<StringData>()) return lookup(key.as<StringData>(), h);
+        return lookup(h, [&](const Value& k) { return keys_equal(k, key); });
+    }
+
+    // 丢弃已删除项并按至少容纳 n 个键的容量重新分配槽位
+    void rebuild(size_t n) {
+        if (live != entries.size()) {
+            std::vector<Entry> compacted;
+            compacted.reserve(std::max(live, n));
+            for (auto& e : entries) {
+                if (!e.deleted) compacted.push_back(std::move(e));
+            }
+            entries = std::move(compacted);
+        } else {
+            entries.reserve(n);
+        }
+        size_t capacity = 8;
+        while (capacity * 2 < (n + 1) * 3) capacity <<= 1;
+        slots.assign(capacity, EMPTY);
+        for (size_t idx = 0; idx < entries.size(); ++idx) {
+            probe(entries[idx].hash, capacity - 1, [&](size_t i) {
+                if (slots[i] != EMPTY) return false;
+                slots[i] = static_cast<int32_t>(idx);
+                return true;
+            });
+        }
+    }
+};
+
+struct DictEntry {
+    Value key;
+    size_t hash;
+    Value value;
+    bool deleted = false;
+    DictEntry(Value k, size_t h, Value v = Value()) : key(std::move(k)), hash(h), value(std::move(v)) {}
+    void drop() { key = Value(); value = Value(); deleted = true; }
+};
+
+struct DictValue : FlatHashTable<DictEntry> {
+    using Entry = DictEntry;
+
+    template <typename K> const Value* find(const K& key) const {
+        const Entry* e = findEntry(key);
+        return e ? &e->value : nullptr;
+    }
+    template <typename K> Value* find(const K& key) {
+        Entry* e = findEntry(key);
+        return e ? &e->value : nullptr;
+    }
+    // 键不存在时插入 nil 并返回其引用；引用在下一次插入前有效
+    template <typename K> Value& operator[](const K& key) { return emplace(key).first->value; }
+    template <typename K> void set(const K& key, Value value) { (*this)[key] = std::move(value); }
+
     bool operator==(const DictValue& other) const {
-        return pairs == other.pairs;
+        if (size() != other.size()) return false;
+        for (const auto& entry : *this) {
+            const Value* v = other.find(entry.key);
+            if (!v || !(*v == entry.value)) return false;
+        }
+        return true;
     }
 };
 
@@ -480,6 +1079,7 @@ public:
 
     void define(const std::string& name, Value value, std::optional<TokenType> type) {
         if (type.has_value()) {
+            value = coerce_static_type(*type, std::move(value));
             if (!check_type(*type, value)) {
                 throw std::runtime_error("Initializer type mismatch for variable '" + name + "'.");
             }
@@ -518,9 +1118,12 @@ public:
         auto it = variables.find(name);
         if (it != variables.end()) {
             if (it->second.static_type.has_value()) {
-                if (!check_type(*(it->second.static_type), value)) {
+                Value coerced = coerce_static_type(*(it->second.static_type), value);
+                if (!check_type(*(it->second.static_type), coerced)) {
                     throw std::runtime_error("Type mismatch on assignment to static variable '" + name + "'.");
                 }
+                it->second.value = std::move(coerced);
+                return true;
             }
             it->second.value = value;
             return true;
@@ -598,8 +1201,8 @@ struct ArrayLiteralExpr final : Expr {
     Value eval(Environment& env) const override;
 };
 struct DictLiteralExpr final : Expr {
-    std::vector<std::pair<std::string, ExprPtr>> pairs;
-    DictLiteralExpr(std::vector<std::pair<std::string, ExprPtr>> p, int ln)
+    std::vector<std::pair<Value, ExprPtr>> pairs;
+    DictLiteralExpr(std::vector<std::pair<Value, ExprPtr>> p, int ln)
         : Expr(ln), pairs(std::move(p)) {}
     Value eval(Environment& env) const override;
 };
@@ -612,8 +1215,9 @@ struct IndexExpr final : Expr {
 struct MemberAccessExpr final : Expr {
     ExprPtr object;
     Token member;
+    StringData key; // 驻留后的成员名，字典查找时复用其缓存的哈希
     MemberAccessExpr(ExprPtr obj, Token mem, int ln)
-        : Expr(ln), object(std::move(obj)), member(std::move(mem)) {}
+        : Expr(ln), object(std::move(obj)), member(std::move(mem)), key(StringData::from_literal(member.lexeme)) {}
     Value eval(Environment& env) const override;
 };
 struct FuncLiteralExpr final : Expr {
@@ -759,49 +1363,115 @@ bool Value::toBool() const {
         [](const StringData& v) { return !v.get().empty(); },
         [](const FuncType& v) { return v != nullptr; },
         [](const ArrayType& v) { return v && !v->elements.empty(); },
-        [](const DictType& v) { return v && !v->pairs.empty(); },
-        [](const MutableObjectType& v) { return v && (!v->fields.empty() || v->parent); }
+        [](const DictType& v) { return v && !v->empty(); },
+        [](const MutableObjectType& v) { return v && (!v->fields.empty() || v->parent); },
+        [](const NativeType& v) { return v && v->toBool(); }
     }, data);
 }
 
+// ---- 数字与字符串的互相转换 ----
+// 全部基于 <charconv>，与 locale 无关，不构造流对象，也不分配内存
+
+static void format_int(std::string& out, int v) {
+    char buf[16];
+    auto res = std::to_chars(buf, buf + sizeof(buf), v);
+    out.append(buf, static_cast<size_t>(res.ptr - buf));
+}
+
+// 输出能精确还原该 double 的最短十进制表示；何时用科学计数法沿用 %g 的规则（指数 < -4 或 >= 有效位数，
+// 有效位数至少按 6 位计），所以 0.1、2.5e+11、100000 等常见值的写法与以前相同，只是不再截断到 6 位
+static void format_double(std::string& out, double v) {
+    char buf[64];
+    auto sci = std::to_chars(buf, buf + sizeof(buf), v, std::chars_format::scientific);
+    int digits = 0;
+    for (const char* p = buf; p != sci.ptr && *p != 'e'; ++p) {
+        if (*p >= '0' && *p <= '9') ++digits;
+    }
+    auto res = std::to_chars(buf, buf + sizeof(buf), v, std::chars_format::general, std::max(digits, 6));
+    out.append(buf, static_cast<size_t>(res.ptr - buf));
+}
+
+// 0..1023 的字符串形式预先生成并共享，str(i) 这类最常见的调用不分配内存
+static StringData int_to_string_data(int v) {
+    static const std::vector<StringData> small = [] {
+        std::vector<StringData> table;
+        table.reserve(1024);
+        for (int i = 0; i < 1024; ++i) table.emplace_back(std::to_string(i));
+        return table;
+    }();
+    if (v >= 0 && v < static_cast<int>(small.size())) return small[v];
+    std::string text;
+    format_int(text, v);
+    return StringData(text);
+}
+
+// 与 std::stoi/std::stod 的宽松规则一致：跳过前导空白，允许 '+'，只解析最长的合法前缀；
+// 没有任何数字或超出范围时返回 false
+static const char* number_start(std::string_view text) {
+    size_t i = 0;
+    while (i < text.size() && std::isspace(static_cast<unsigned char>(text[i]))) ++i;
+    // from_chars 不接受 '+'，但 "+-1" 仍应失败
+    if (i + 1 < text.size() && text[i] == '+' && text[i + 1] != '-') ++i;
+    return text.data() + i;
+}
+
+static bool parse_int(std::string_view text, int& out) {
+    auto res = std::from_chars(number_start(text), text.data() + text.size(), out);
+    return res.ec == std::errc();
+}
+
+static bool parse_double(std::string_view text, double& out) {
+    auto res = std::from_chars(number_start(text), text.data() + text.size(), out);
+    return res.ec == std::errc();
+}
+
 std::string Value::toString() const {
-    return std::visit(overloaded{
-        [](std::monostate) -> std::string { return "nil"; },
-        [](int v) -> std::string { return std::to_string(v); },
-        [](double v) -> std::string {
-            std::ostringstream oss;
-            oss << v;
-            return oss.str();
-        },
-        [](bool v) -> std::string { return v ? "true" : "false"; },
-        [](const StringData& v) -> std::string { return v.get(); },
-        [](const FuncType& v) -> std::string { return v ? v->toString() : "<null function>"; },
-        [](const ArrayType& v) -> std::string {
-            std::string result = "[";
+    if (auto* str = std::get_if<StringData>(&data)) return str->get();
+    std::string result;
+    format(result);
+    return result;
+}
+
+void Value::format(std::string& out) const {
+    std::visit(overloaded{
+        [&](std::monostate) { out += "nil"; },
+        [&](int v) { format_int(out, v); },
+        [&](double v) { format_double(out, v); },
+        [&](bool v) { out += v ? "true" : "false"; },
+        [&](const StringData& v) { out += v.view(); },
+        [&](const FuncType& v) { out += v ? v->toString() : "<null function>"; },
+        [&](const ArrayType& v) {
+            out += '[';
             if (v) {
                 for (size_t i = 0; i < v->elements.size(); ++i) {
-                    if (i > 0) result += ", ";
-                    result += v->elements[i].toString();
+                    if (i > 0) out += ", ";
+                    v->elements[i].format(out);
                 }
             }
-            return result + "]";
+            out += ']';
         },
-        [](const DictType& v) -> std::string {
-            std::string result = "{";
+        [&](const DictType& v) {
+            out += '{';
             if (v) {
                 bool first = true;
-                for (const auto& pair : v->pairs) {
-                    if (!first) result += ", ";
-                    result += "\"" + pair.first + "\": ";
-                    result += pair.second.toString();
+                for (const auto& entry : *v) {
+                    if (!first) out += ", ";
+                    if (entry.key.is<StringData>()) {
+                        out += '"';
+                        out += entry.key.as<StringData>().get();
+                        out += "\": ";
+                    } else {
+                        entry.key.format(out);
+                        out += ": ";
+                    }
+                    entry.value.format(out);
                     first = false;
                 }
             }
-            return result + "}";
+            out += '}';
         },
-        [](const MutableObjectType& v) -> std::string {
-             return v ? v->toString() : "<null object>";
-        }
+        [&](const MutableObjectType& v) { out += v ? v->toString() : "<null object>"; },
+        [&](const NativeType& v) { out += v ? v->toString() : "<null object>"; }
     }, data);
 }
 
@@ -824,8 +1494,10 @@ std::string MutableObject::toString() const {
     bool first = true;
     for (const auto& pair : fields) {
         if (!first) result += ", ";
-        result += "\"" + pair.first + "\": ";
-        result += pair.second.toString();
+        result += '"';
+        result += pair.first;
+        result += "\": ";
+        pair.second.format(result);
         first = false;
     }
     return result + "}";
@@ -845,7 +1517,8 @@ TokenType get_value_type_token(const Value& val) {
         [](const Value::MutableObjectType& obj) {
             if (obj && obj->klass) return TokenType::ID;
             return TokenType::OBJECT;
-        }
+        },
+        [](const Value::NativeType&) { return TokenType::OBJECT; }
     }, val.getVariant());
 }
 
@@ -862,6 +1535,14 @@ bool check_type(TokenType expected, const Value& val) {
     return false;
 }
 
+// 惰性序列赋给 array 类型的变量或参数时才物化为数组
+Value coerce_static_type(TokenType expected, Value val) {
+    if (expected == TokenType::ARRAY && val.is<Value::NativeType>()) {
+        if (auto arr = val.as<Value::NativeType>()->toArray()) return Value(arr);
+    }
+    return val;
+}
+
 Value AssignExpr::eval(Environment& env) const {
     Value valToAssign = value->eval(env);
 
@@ -880,8 +1561,8 @@ Value AssignExpr::eval(Environment& env) const {
             return valToAssign;
         }
         if (objVal.is<Value::DictType>()) {
-            auto& dict = objVal.as<Value::DictType>()->pairs;
-            dict[memberAccessExpr->member.lexeme] = valToAssign;
+            auto& dict = *objVal.as<Value::DictType>();
+            dict[memberAccessExpr->key] = valToAssign;
             return valToAssign;
         }
         throw RuntimeError(memberAccessExpr->line, "Can only set properties on objects or dicts.");
@@ -890,31 +1571,54 @@ Value AssignExpr::eval(Environment& env) const {
     if (auto* indexExpr = dynamic_cast<IndexExpr*>(target.get())) {
         Value indexVal = indexExpr->index->eval(env);
 
-        auto perform_set_on_ref = [&](Value& containerRef) {
+        auto perform_set_on_ref = [&](Value& slot) {
+            // 写入 range 时先就地物化，所有引用它的变量都能看到修改
+            Value rangeArray = slot.is<Value::NativeType>() ? array_operand(slot) : Value();
+            Value& containerRef = rangeArray.is<Value::ArrayType>() ? rangeArray : slot;
             if (containerRef.is<Value::ArrayType>()) {
                 if (!indexVal.is<int>()) throw RuntimeError(indexExpr->index->line, "Array index must be an integer.");
                 auto& arrVec = containerRef.as<Value::ArrayType>()->elements;
                 int idx = indexVal.as<int>();
                 if (idx < 0 || idx >= static_cast<int>(arrVec.size())) throw RuntimeError(indexExpr->line, "Array index out of bounds for assignment.");
-                arrVec[idx] = valToAssign;
+                arrVec.set(idx, valToAssign);
                 return;
             }
             if (containerRef.is<StringData>()) {
                 if (!indexVal.is<int>()) throw RuntimeError(indexExpr->index->line, "String index must be an integer.");
-                if (!valToAssign.is<StringData>() || valToAssign.as<StringData>().get().length() != 1) {
+                if (!valToAssign.is<StringData>() || valToAssign.as<StringData>().length() != 1) {
                     throw RuntimeError(this->line, "Can only assign a single-character string to a string index.");
                 }
-                std::string& str = containerRef.as<StringData>().writeable();
+                StringData& target = containerRef.as<StringData>();
+                const StringData& ch = valToAssign.as<StringData>();
                 int idx = indexVal.as<int>();
-                if (idx < 0 || idx >= static_cast<int>(str.length())) throw RuntimeError(indexExpr->line, "String index out of bounds for assignment.");
-                str[idx] = valToAssign.as<StringData>().get()[0];
+                if (idx < 0 || static_cast<size_t>(idx) >= target.length()) throw RuntimeError(indexExpr->line, "String index out of bounds for assignment.");
+                if (target.is_ascii() && ch.is_ascii()) {
+                    target.writeable()[idx] = ch.view()[0];
+                } else {
+                    // 新旧字符的 UTF-8 字节数可能不同，按字节区间替换
+                    size_t from = target.byte_offset(idx);
+                    size_t to = target.byte_offset(idx + 1);
+                    target.writeable().replace(from, to - from, ch.view());
+                }
                 return;
             }
             if (containerRef.is<Value::DictType>()) {
-                if (!indexVal.is<StringData>()) throw RuntimeError(indexExpr->index->line, "Dict index must be a string.");
-                auto& dict = containerRef.as<Value::DictType>()->pairs;
-                const std::string& key = indexVal.as<StringData>().get();
-                dict[key] = valToAssign;
+                auto& dict = *containerRef.as<Value::DictType>();
+                try {
+                    dict[indexVal] = valToAssign;
+                } catch (const std::runtime_error& e) {
+                    throw RuntimeError(indexExpr->index->line, e.what());
+                }
+                return;
+            }
+            if (containerRef.is<Value::NativeType>()) {
+                try {
+                    containerRef.as<Value::NativeType>()->setIndex(indexVal, valToAssign);
+                } catch (const RuntimeError&) {
+                    throw;
+                } catch (const std::runtime_error& e) {
+                    throw RuntimeError(indexExpr->line, e.what());
+                }
                 return;
             }
             if (containerRef.is<Value::MutableObjectType>()) {
@@ -938,11 +1642,9 @@ Value AssignExpr::eval(Environment& env) const {
                 Value& containerRef = obj->fields.at(containerMember->member.lexeme);
                 perform_set_on_ref(containerRef);
             } else if (objVal.is<Value::DictType>()) {
-                auto& dict = objVal.as<Value::DictType>()->pairs;
-                const std::string& key = containerMember->member.lexeme;
-                if (dict.find(key) == dict.end()) throw RuntimeError(containerMember->line, "Key '" + key + "' does not exist.");
-                Value& containerRef = dict.at(key);
-                perform_set_on_ref(containerRef);
+                Value* containerRef = objVal.as<Value::DictType>()->find(containerMember->key);
+                if (!containerRef) throw RuntimeError(containerMember->line, "Key '" + containerMember->member.lexeme + "' does not exist.");
+                perform_set_on_ref(*containerRef);
             } else {
                 throw RuntimeError(containerMember->line, "Base of indexed assignment must be an object or a dictionary.");
             }
@@ -1027,6 +1729,19 @@ Value BinaryExpr::eval(Environment& env) const {
     }
     Value lval = left->eval(env);
     Value rval = right->eval(env);
+    if (lval.is<Value::NativeType>() || rval.is<Value::NativeType>()) {
+        // range 按数组参与运算；与数组比较时逐元素比较，range(3) == [0, 1, 2] 为真
+        Value l = array_operand(lval), r = array_operand(rval);
+        bool has_range = (l.is<Value::ArrayType>() && !lval.is<Value::ArrayType>()) ||
+                         (r.is<Value::ArrayType>() && !rval.is<Value::ArrayType>());
+        if (has_range && (op.type == TokenType::EQ || op.type == TokenType::NE) &&
+            l.is<Value::ArrayType>() && r.is<Value::ArrayType>()) {
+            bool equal = l.as<Value::ArrayType>()->elements == r.as<Value::ArrayType>()->elements;
+            return op.type == TokenType::EQ ? equal : !equal;
+        }
+        lval = std::move(l);
+        rval = std::move(r);
+    }
     if (lval.is<int>() && rval.is<int>()) {
         const int l = lval.as<int>();
         const int r = rval.as<int>();
@@ -1084,12 +1799,12 @@ Value BinaryExpr::eval(Environment& env) const {
         [&](double l, double r) -> Value { return apply_double_op(l, r); },
         [&](double l, int r) -> Value { return apply_double_op(l, static_cast<double>(r)); },
         [&](int l, double r) -> Value { return apply_double_op(static_cast<double>(l), r); },
-        [&](StringData l, StringData r) -> Value {
-            const std::string& l_str = l.get();
-            const std::string& r_str = r.get();
+        [&](const StringData& l, const StringData& r) -> Value {
+            std::string_view l_str = l.view();
+            std::string_view r_str = r.view();
             if (op.type == TokenType::PLUS) {
                 StringData new_str_data = l;
-                new_str_data.writeable() += r_str;
+                new_str_data.writeable() += r.view();
                 return Value(new_str_data);
             }
              switch (op.type) {
@@ -1105,8 +1820,9 @@ Value BinaryExpr::eval(Environment& env) const {
         [&](const Value::ArrayType& l, const Value::ArrayType& r) -> Value {
             if (op.type == TokenType::PLUS) {
                 auto newArr = std::make_shared<ArrayValue>();
+                // 共享左侧缓冲区；左侧正好在缓冲区末尾时右侧直接接在后面，否则才复制
                 newArr->elements = l->elements;
-                newArr->elements.insert(newArr->elements.end(), r->elements.begin(), r->elements.end());
+                newArr->elements.append(r->elements);
                 return Value(newArr);
             }
             switch (op.type) {
@@ -1158,8 +1874,9 @@ Value ArrayLiteralExpr::eval(Environment& env) const {
 }
 Value DictLiteralExpr::eval(Environment& env) const {
     auto newDict = std::make_shared<DictValue>();
+    newDict->reserve(pairs.size());
     for (const auto& pair : pairs) {
-        newDict->pairs[pair.first] = pair.second->eval(env);
+        (*newDict)[pair.first] = pair.second->eval(env);
     }
     return Value(newDict);
 }
@@ -1182,23 +1899,23 @@ Value IndexExpr::eval(Environment& env) const {
             throw RuntimeError(this->index->line, "String index must be an integer.");
         }
         int idx = indexVal.as<int>();
-        const auto& str = containerVal.as<StringData>().get();
-        if (idx < 0 || idx >= static_cast<int>(str.length())) {
+        const StringData& str = containerVal.as<StringData>();
+        if (idx < 0 || static_cast<size_t>(idx) >= str.length()) {
             throw RuntimeError(this->line, "String index out of bounds");
         }
-        return Value(std::string(1, str[idx]));
+        return Value(str.char_at(idx));
     }
     if (containerVal.is<Value::DictType>()) {
-        if (!indexVal.is<StringData>()) {
-            throw RuntimeError(this->index->line, "Dict index must be a string.");
+        const Value* found;
+        try {
+            found = containerVal.as<Value::DictType>()->find(indexVal);
+        } catch (const std::runtime_error& e) {
+            throw RuntimeError(this->index->line, e.what());
         }
-        const std::string& key = indexVal.as<StringData>().get();
-        const auto& dict = containerVal.as<Value::DictType>()->pairs;
-        auto it = dict.find(key);
-        if (it != dict.end()) {
-            return it->second;
+        if (found) {
+            return *found;
         }
-        throw RuntimeError(this->line, "Undefined property '" + key + "'.");
+        throw RuntimeError(this->line, "Undefined property '" + indexVal.toString() + "'.");
     }
     if (containerVal.is<Value::MutableObjectType>()) {
         if (!indexVal.is<StringData>()) {
@@ -1212,6 +1929,15 @@ Value IndexExpr::eval(Environment& env) const {
             throw RuntimeError(this->line, e.what());
         }
     }
+    if (containerVal.is<Value::NativeType>()) {
+        try {
+            return containerVal.as<Value::NativeType>()->getIndex(indexVal);
+        } catch (const RuntimeError&) {
+            throw;
+        } catch (const std::runtime_error& e) {
+            throw RuntimeError(this->line, e.what());
+        }
+    }
     throw RuntimeError(this->line, "Index operation on a non-indexable value (must be array, string, dict, or object).");
 }
 Value MemberAccessExpr::eval(Environment& env) const {
@@ -1236,13 +1962,19 @@ Value MemberAccessExpr::eval(Environment& env) const {
         }
     }
     if (objVal.is<Value::DictType>()) {
-        auto& dict = objVal.as<Value::DictType>()->pairs;
-        const std::string& key = member.lexeme;
-        auto it = dict.find(key);
-        if (it != dict.end()) {
-            return it->second;
+        if (const Value* found = objVal.as<Value::DictType>()->find(key)) {
+            return *found;
+        }
+        throw RuntimeError(line, "Undefined property '" + member.lexeme + "'.");
+    }
+    if (objVal.is<Value::NativeType>()) {
+        try {
+            return objVal.as<Value::NativeType>()->getMember(member.lexeme);
+        } catch (const RuntimeError&) {
+            throw;
+        } catch (const std::runtime_error& e) {
+            throw RuntimeError(line, e.what());
         }
-        throw RuntimeError(line, "Undefined property '" + key + "'.");
     }
     throw RuntimeError(line, "Can only access properties on objects or dicts.");
 }
@@ -1352,9 +2084,12 @@ Value FunctionValue::call(const std::vector<Value>& args) {
     auto executionEnv = std::make_shared<Environment>(closure);
     for (size_t i = 0; i < params.size(); ++i) {
         if (params[i].type.has_value()) {
-            if (!check_type(*(params[i].type), args[i])) {
+            Value arg = coerce_static_type(*(params[i].type), args[i]);
+            if (!check_type(*(params[i].type), arg)) {
                 throw std::runtime_error("Argument type mismatch for parameter '" + params[i].name + "'.");
             }
+            executionEnv->define(params[i].name, std::move(arg), std::nullopt);
+            continue;
         }
         executionEnv->define(params[i].name, args[i], std::nullopt);
     }
@@ -1385,72 +2120,859 @@ Value ClassValue::call(const std::vector<Value>& args) {
     return Value(instance);
 }
 
-std::optional<Value> ForEachStmt::exec(Environment& env) const {
-    auto loopEnv = std::make_shared<Environment>(env.shared_from_this());
-    Value iterableVal = iterable->eval(env);
+// ---- 迭代器协议的内置实现 ----
+// 数组与字符串按下标迭代，循环体中追加元素不会使迭代器失效
+class ArrayIterator final : public Iterator {
+    Value::ArrayType arr;
+    size_t pos = 0;
+public:
+    explicit ArrayIterator(Value::ArrayType a) : arr(std::move(a)) {}
+    bool next(Value& out) override {
+        if (pos >= arr->elements.size()) return false;
+        out = arr->elements[pos++];
+        return true;
+    }
+};
 
-    auto iter_body = [&](const Value& element) -> std::optional<Value> {
-        loopEnv->define(variableName, element, std::nullopt);
-        try {
-            if (auto retVal = body->exec(*loopEnv); retVal.has_value()) {
-                return retVal;
-            }
-        } catch (const ContinueSignal&) {
-        }
-        return std::nullopt;
-    };
-    try {
-        if (iterableVal.is<Value::ArrayType>()) {
-            const auto& arr = iterableVal.as<Value::ArrayType>()->elements;
-            for (const auto& element : arr) {
-                if (auto retVal = iter_body(element); retVal.has_value()) return retVal;
-            }
-        } else if (iterableVal.is<StringData>()) {
-            const auto& str = iterableVal.as<StringData>().get();
-            for (char c : str) {
-                if (auto retVal = iter_body(Value(std::string(1, c))); retVal.has_value()) return retVal;
-            }
+class StringIterator final : public Iterator {
+    StringData str;
+    size_t pos = 0;
+    bool ascii;
+public:
+    explicit StringIterator(StringData s) : str(std::move(s)), ascii(str.is_ascii()) {}
+    bool next(Value& out) override {
+        std::string_view s = str.view();
+        if (pos >= s.size()) return false;
+        // 按 UTF-8 字符逐个产出；纯 ASCII 字符串每次正好一个字节
+        size_t n = ascii ? 1 : StringData::char_length(s, pos);
+        out = Value(str.substr(pos, n));
+        pos += n;
+        return true;
+    }
+};
+
+// 遍历对象字段：开始时记下字段名，循环体删除再添加字段也不会留下悬空的哈希表迭代器
+class FieldIterator final : public Iterator {
+    Value::MutableObjectType obj; // 保证对象在循环期间存活
+    std::vector<std::string> names;
+    size_t pos = 0;
+    bool with_values;
+public:
+    FieldIterator(Value::MutableObjectType o, bool values) : obj(std::move(o)), with_values(values) {
+        names.reserve(obj->fields.size());
+        for (const auto& field : obj->fields) names.push_back(field.first);
+    }
+    bool next(Value& out) override {
+        if (obj->fields.size() != names.size()) throw std::runtime_error("Container changed size during iteration.");
+        if (pos >= names.size()) return false;
+        const std::string& name = names[pos++];
+        auto it = obj->fields.find(name);
+        if (it == obj->fields.end()) throw std::runtime_error("Container changed during iteration.");
+        if (with_values) {
+            auto pair = std::make_shared<ArrayValue>();
+            pair->elements = { Value(name), it->second };
+            out = Value(pair);
         } else {
-            throw RuntimeError(this->line, "Value is not iterable. Can only iterate over arrays and strings.");
+            out = Value(name);
         }
-    } catch (const BreakSignal&) {}
-    return std::nullopt;
-}
-std::optional<Value> ForStmt::exec(Environment& env) const {
-    auto loopEnv = std::make_shared<Environment>(env.shared_from_this());
-    if (initializer) {
-        initializer->exec(*loopEnv);
+        return true;
     }
-    while(true) {
-        if (condition && !condition->eval(*loopEnv).toBool()) {
-            break;
+};
+
+// 按插入顺序遍历字典；下标式遍历不受 entries 扩容影响
+class DictIterator final : public Iterator {
+    std::shared_ptr<DictValue> dict;
+    size_t pos = 0;
+    size_t expected_size;
+    bool with_values;
+public:
+    DictIterator(std::shared_ptr<DictValue> d, bool values)
+        : dict(std::move(d)), expected_size(dict->size()), with_values(values) {}
+    bool next(Value& out) override {
+        if (dict->size() != expected_size) throw std::runtime_error("Container changed size during iteration.");
+        const DictValue::Entry* entry = dict->next(pos);
+        if (!entry) return false;
+        if (with_values) {
+            auto pair = std::make_shared<ArrayValue>();
+            pair->elements = { Value(entry->key), entry->value };
+            out = Value(pair);
+        } else {
+            out = Value(entry->key);
         }
-        try {
-            if (auto retVal = body->exec(*loopEnv); retVal.has_value()) {
-                return retVal;
-            }
-        } catch (const BreakSignal&) {
-            break;
-        } catch (const ContinueSignal&) {}
-        if (increment) {
-            increment->eval(*loopEnv);
+        return true;
+    }
+};
+
+// 用户类迭代协议：每次调用 next()，返回 nil 表示结束
+class ProtocolIterator final : public Iterator {
+    Value::FuncType next_fn; // 循环开始时绑定一次
+public:
+    explicit ProtocolIterator(Value::FuncType fn) : next_fn(std::move(fn)) {
+        if (next_fn->arity() != 0) throw std::runtime_error("Method 'next' used for iteration must take no arguments.");
+    }
+    bool next(Value& out) override {
+        out = next_fn->call({});
+        return !out.is<std::monostate>();
+    }
+};
+
+// entries(d) 返回的惰性视图，迭代时产出 [key, value]
+class EntriesView final : public NativeObject {
+    Value source;
+public:
+    explicit EntriesView(Value src) : source(std::move(src)) {}
+    std::string typeName() const override { return "entries"; }
+    std::unique_ptr<Iterator> iter() override {
+        if (source.is<Value::DictType>()) {
+            const auto& dict = source.as<Value::DictType>();
+            return std::make_unique<DictIterator>(dict, true);
         }
+        const auto& obj = source.as<Value::MutableObjectType>();
+        return std::make_unique<FieldIterator>(obj, true);
     }
-    return std::nullopt;
-}
+};
 
-std::optional<Value> ThrowStmt::exec(Environment& env) const {
-    throw ThrowSignal(expr->eval(env));
-    return std::nullopt; // Unreachable
-}
+// range() 返回的惰性整数序列，只保存 start/stop/step，占用 O(1) 内存。
+// 第一次被当作数组修改或比较时就地物化为数组，之后所有访问都走这个数组，
+// 因此共享同一个 range 的变量看到的效果与共享数组完全一致。
+class RangeValue final : public NativeObject {
+    int count;
+    std::shared_ptr<ArrayValue> materialized;
+public:
+    const int start, stop, step;
+    RangeValue(int b, int e, int st) : start(b), stop(e), step(st) {
+        long long span = step > 0 ? static_cast<long long>(stop) - start : static_cast<long long>(start) - stop;
+        long long abs_step = step > 0 ? step : -static_cast<long long>(step);
+        long long n = span <= 0 ? 0 : (span + abs_step - 1) / abs_step;
+        if (n > INT_MAX) throw std::runtime_error("range() would produce more than " + std::to_string(INT_MAX) + " elements.");
+        count = static_cast<int>(n);
+    }
 
-std::optional<Value> TryStmt::exec(Environment& env) const {
-    try {
-        if (auto retVal = try_block->exec(env); retVal.has_value()) {
-            return retVal;
+    // 仍是未物化的纯计数序列时才能走计数器快速路径
+    bool lazy() const { return !materialized; }
+
+    std::string typeName() const override { return "range"; }
+    std::string toString() const override {
+        if (materialized) return Value(materialized).toString();
+        std::string result = "[";
+        for (int i = 0; i < count; ++i) {
+            if (i > 0) result += ", ";
+            result += std::to_string(at(i));
         }
-    } catch (const ThrowSignal& signal) {
-        // 这个块处理来自脚本 'throw' 关键字的异常
+        return result + "]";
+    }
+    bool toBool() const override { return length() > 0; }
+    int length() const override { return materialized ? static_cast<int>(materialized->elements.size()) : count; }
+    int at(int idx) const { return static_cast<int>(start + static_cast<long long>(idx) * step); }
+
+    Value getIndex(const Value& index) override {
+        if (!index.is<int>()) throw std::runtime_error("Range index must be an integer.");
+        int idx = index.as<int>();
+        if (idx < 0 || idx >= length()) throw std::runtime_error("Range index out of bounds");
+        return materialized ? materialized->elements[idx] : Value(at(idx));
+    }
+    Value slice(int b, int e) override {
+        if (materialized) {
+            auto arr = std::make_shared<ArrayValue>();
+            arr->elements = materialized->elements.slice(b, e);
+            return Value(arr);
+        }
+        int new_stop = e == count ? stop : at(e);
+        return Value(std::static_pointer_cast<NativeObject>(std::make_shared<RangeValue>(at(b), new_stop, step)));
+    }
+    std::unique_ptr<Iterator> iter() override;
+    // 物化后的 range 是可变的，deepcopy 时必须得到独立的副本
+    std::shared_ptr<NativeObject> clone() const override {
+        auto copy = std::make_shared<RangeValue>(start, stop, step);
+        if (materialized) copy->materialized = std::make_shared<ArrayValue>(*materialized);
+        return copy;
+    }
+    void forEachValue(const std::function<void(Value&)>& fn) override {
+        if (materialized) {
+            for (auto& v : materialized->elements.mut()) fn(v);
+        }
+    }
+    std::shared_ptr<ArrayValue> toArray() override {
+        if (!materialized) {
+            materialized = std::make_shared<ArrayValue>();
+            materialized->elements.reserve(count);
+            for (int i = 0; i < count; ++i) materialized->elements.emplace_back(at(i));
+        }
+        return materialized;
+    }
+};
+
+class RangeIterator final : public Iterator {
+    long long current;
+    const long long stop, step;
+public:
+    explicit RangeIterator(const RangeValue& r) : current(r.start), stop(r.stop), step(r.step) {}
+    bool next(Value& out) override {
+        if (step > 0 ? current >= stop : current <= stop) return false;
+        out = Value(static_cast<int>(current));
+        current += step;
+        return true;
+    }
+};
+
+std::unique_ptr<Iterator> RangeValue::iter() {
+    if (materialized) return std::make_unique<ArrayIterator>(materialized);
+    return std::make_unique<RangeIterator>(*this);
+}
+
+Value array_operand(const Value& val) {
+    if (val.is<Value::NativeType>()) {
+        if (auto* range = dynamic_cast<RangeValue*>(val.as<Value::NativeType>().get())) return Value(range->toArray());
+    }
+    return val;
+}
+
+// freeze() 得到的不可变序列：元素在创建时全部冻结并检查可哈希，因此 tuple 本身可以作为字典键
+class TupleValue final : public NativeObject {
+    Value::ArrayType items; // 创建后不再修改
+    size_t cached_hash = 0x345678;
+public:
+    explicit TupleValue(Value::ArrayType elems) : items(std::move(elems)) {
+        for (const auto& v : items->elements) {
+            cached_hash = (cached_hash ^ hash_key(v)) * 1000003;
+        }
+    }
+
+    std::string typeName() const override { return "tuple"; }
+    std::string toString() const override {
+        std::string result = "(";
+        for (size_t i = 0; i < items->elements.size(); ++i) {
+            if (i > 0) result += ", ";
+            result += items->elements[i].toString();
+        }
+        return result + ")";
+    }
+    bool toBool() const override { return !items->elements.empty(); }
+    int length() const override { return static_cast<int>(items->elements.size()); }
+    Value getIndex(const Value& index) override {
+        if (!index.is<int>()) throw std::runtime_error("Tuple index must be an integer.");
+        int idx = index.as<int>();
+        if (idx < 0 || idx >= length()) throw std::runtime_error("Tuple index out of bounds");
+        return items->elements[idx];
+    }
+    void setIndex(const Value&, const Value&) override {
+        throw std::runtime_error("Tuples are immutable.");
+    }
+    Value slice(int b, int e) override {
+        auto part = std::make_shared<ArrayValue>();
+        part->elements = items->elements.slice(b, e);
+        return Value(std::static_pointer_cast<NativeObject>(std::make_shared<TupleValue>(part)));
+    }
+    std::unique_ptr<Iterator> iter() override { return std::make_unique<ArrayIterator>(items); }
+    std::shared_ptr<ArrayValue> toArray() override { return std::make_shared<ArrayValue>(*items); }
+    size_t hash() const override { return cached_hash; }
+    bool equals(const NativeObject& other) const override {
+        auto* t = dynamic_cast<const TupleValue*>(&other);
+        if (!t || t->cached_hash != cached_hash || t->items->elements.size() != items->elements.size()) return false;
+        for (size_t i = 0; i < items->elements.size(); ++i) {
+            if (!keys_equal(items->elements[i], t->items->elements[i])) return false;
+        }
+        return true;
+    }
+};
+
+// 数组及其他可迭代的原生序列递归转换为 tuple；标量与字符串原样返回；字典、对象等无法冻结
+static Value freeze_value(const Value& v) {
+    std::unique_ptr<Iterator> it;
+    if (v.is<Value::ArrayType>()) {
+        it = std::make_unique<ArrayIterator>(v.as<Value::ArrayType>());
+    } else if (v.is<Value::NativeType>() && !dynamic_cast<TupleValue*>(v.as<Value::NativeType>().get())) {
+        it = v.as<Value::NativeType>()->iter();
+    }
+    if (!it) {
+        hash_key(v); // 不可哈希时抛出
+        return v;
+    }
+    auto items = std::make_shared<ArrayValue>();
+    Value element;
+    while (it->next(element)) items->elements.push_back(freeze_value(element));
+    return Value(std::static_pointer_cast<NativeObject>(std::make_shared<TupleValue>(items)));
+}
+
+// Int32Array / Float64Array：元素以原始类型连续存放，不再是一个个 Value
+template <typename T> struct TypedArrayTraits;
+template <> struct TypedArrayTraits<std::int32_t> {
+    static constexpr const char* name = "Int32Array";
+    static std::int32_t fromValue(const Value& v) {
+        if (v.is<int>()) return v.as<int>();
+        if (v.is<double>()) {
+            // 与 int() 一样向零取整；NaN 和超出 int32 范围的值无法表示
+            double d = std::trunc(v.as<double>());
+            if (!(d >= INT32_MIN && d <= INT32_MAX)) throw std::runtime_error("Value " + v.toString() + " does not fit in Int32Array.");
+            return static_cast<std::int32_t>(d);
+        }
+        throw std::runtime_error("Int32Array elements must be numbers.");
+    }
+};
+template <> struct TypedArrayTraits<double> {
+    static constexpr const char* name = "Float64Array";
+    static double fromValue(const Value& v) {
+        if (v.is<double>()) return v.as<double>();
+        if (v.is<int>()) return v.as<int>();
+        throw std::runtime_error("Float64Array elements must be numbers.");
+    }
+};
+
+template <typename T>
+class TypedArrayValue final : public NativeObject {
+    using Traits = TypedArrayTraits<T>;
+public:
+    std::vector<T> data;
+
+    TypedArrayValue() = default;
+    explicit TypedArrayValue(std::vector<T> d) : data(std::move(d)) {}
+
+    std::string typeName() const override { return Traits::name; }
+    std::string toString() const override {
+        std::string result = std::string(Traits::name) + "([";
+        for (size_t i = 0; i < data.size(); ++i) {
+            if (i > 0) result += ", ";
+            result += Value(data[i]).toString();
+        }
+        return result + "])";
+    }
+    bool toBool() const override { return !data.empty(); }
+    int length() const override { return static_cast<int>(data.size()); }
+
+    size_t checkedIndex(const Value& index) const {
+        if (!index.is<int>()) throw std::runtime_error(std::string(Traits::name) + " index must be an integer.");
+        int idx = index.as<int>();
+        if (idx < 0 || idx >= static_cast<int>(data.size())) throw std::runtime_error(std::string(Traits::name) + " index out of bounds");
+        return static_cast<size_t>(idx);
+    }
+    Value getIndex(const Value& index) override { return Value(data[checkedIndex(index)]); }
+    void setIndex(const Value& index, const Value& value) override { data[checkedIndex(index)] = Traits::fromValue(value); }
+    Value slice(int start, int end) override {
+        return Value(std::static_pointer_cast<NativeObject>(
+            std::make_shared<TypedArrayValue<T>>(std::vector<T>(data.begin() + start, data.begin() + end))));
+    }
+
+    std::unique_ptr<Iterator> iter() override;
+    std::shared_ptr<ArrayValue> toArray() override {
+        auto arr = std::make_shared<ArrayValue>();
+        arr->elements.reserve(data.size());
+        for (T v : data) arr->elements.emplace_back(v);
+        return arr;
+    }
+    std::shared_ptr<NativeObject> clone() const override { return std::make_shared<TypedArrayValue<T>>(data); }
+};
+using Int32ArrayValue = TypedArrayValue<std::int32_t>;
+using Float64ArrayValue = TypedArrayValue<double>;
+
+template <typename T>
+class TypedArrayIterator final : public Iterator {
+    std::shared_ptr<TypedArrayValue<T>> arr;
+    size_t pos = 0;
+public:
+    explicit TypedArrayIterator(std::shared_ptr<TypedArrayValue<T>> a) : arr(std::move(a)) {}
+    bool next(Value& out) override {
+        if (pos >= arr->data.size()) return false;
+        out = Value(arr->data[pos++]);
+        return true;
+    }
+};
+
+template <typename T>
+std::unique_ptr<Iterator> TypedArrayValue<T>::iter() {
+    return std::make_unique<TypedArrayIterator<T>>(std::static_pointer_cast<TypedArrayValue<T>>(shared_from_this()));
+}
+
+Value NativeObject::getIndex(const Value&) {
+    throw std::runtime_error("Index operation on a non-indexable value of type '" + typeName() + "'.");
+}
+
+void NativeObject::setIndex(const Value&, const Value&) {
+    throw std::runtime_error("Value of type '" + typeName() + "' does not support indexed assignment.");
+}
+
+Value NativeObject::getMember(const std::string& name) {
+    throw std::runtime_error("Undefined property '" + name + "' on value of type '" + typeName() + "'.");
+}
+
+static Value native_method(const std::string& name, int arity, NativeFunction::NativeFn fn) {
+    return Value(std::static_pointer_cast<Callable>(std::make_shared<NativeFunction>(std::move(fn), arity, name)));
+}
+
+Value NativeObject::slice(int, int) {
+    throw std::runtime_error("Value of type '" + typeName() + "' does not support slicing.");
+}
+
+std::shared_ptr<ArrayValue> NativeObject::toArray() {
+    auto it = iter();
+    if (!it) return nullptr;
+    auto arr = std::make_shared<ArrayValue>();
+    Value element;
+    while (it->next(element)) arr->elements.push_back(element);
+    return arr;
+}
+
+// 供内置函数使用：接受数组或任何可迭代的原生序列
+static std::unique_ptr<Iterator> sequence_iterator(const Value& val, const std::string& what) {
+    if (val.is<Value::ArrayType>()) return std::make_unique<ArrayIterator>(val.as<Value::ArrayType>());
+    if (val.is<Value::NativeType>()) {
+        if (auto it = val.as<Value::NativeType>()->iter()) return it;
+    }
+    throw std::runtime_error(what + " must be an array or an iterable sequence.");
+}
+
+// 整数结果超出 int 范围时改用浮点数表示，而不是截断
+static Value integral_result(long long v) {
+    return v >= INT_MIN && v <= INT_MAX ? Value(static_cast<int>(v)) : Value(static_cast<double>(v));
+}
+
+// 数值序列求和：全是 int 时结果为 int，出现 float 后转为 float 累加
+static Value sum_sequence(Iterator& it) {
+    long long int_sum = 0;
+    double double_sum = 0.0;
+    bool is_double = false;
+    Value element;
+    while (it.next(element)) {
+        if (element.is<int>()) {
+            if (is_double) double_sum += element.as<int>();
+            else int_sum += element.as<int>();
+        } else if (element.is<double>()) {
+            if (!is_double) {
+                is_double = true;
+                double_sum = static_cast<double>(int_sum);
+            }
+            double_sum += element.as<double>();
+        } else {
+            throw std::runtime_error("sum() requires numeric elements.");
+        }
+    }
+    return is_double ? Value(double_sum) : integral_result(int_sum);
+}
+
+// Int32Array(n) 创建 n 个 0；Int32Array(seq) 从数组或任何数值序列转换
+template <typename T>
+static std::shared_ptr<TypedArrayValue<T>> make_typed_array(const Value& arg) {
+    auto result = std::make_shared<TypedArrayValue<T>>();
+    if (arg.is<int>()) {
+        if (arg.as<int>() < 0) throw std::runtime_error(std::string(TypedArrayTraits<T>::name) + " length cannot be negative.");
+        result->data.assign(static_cast<size_t>(arg.as<int>()), T{});
+        return result;
+    }
+    if (arg.is<Value::ArrayType>()) {
+        const auto& vec = arg.as<Value::ArrayType>()->elements;
+        result->data.reserve(vec.size());
+        for (const auto& v : vec) result->data.push_back(TypedArrayTraits<T>::fromValue(v));
+        return result;
+    }
+    auto it = sequence_iterator(arg, std::string("Argument to ") + TypedArrayTraits<T>::name);
+    Value element;
+    while (it->next(element)) result->data.push_back(TypedArrayTraits<T>::fromValue(element));
+    return result;
+}
+
+static Value::FuncType find_bound_method(const Value::MutableObjectType& obj, const std::string& name) {
+    if (!obj->has(name)) return nullptr;
+    Value method = obj->get(name);
+    if (!method.is<Value::FuncType>()) return nullptr;
+    if (auto func = std::dynamic_pointer_cast<FunctionValue>(method.as<Value::FuncType>())) {
+        return func->bind(obj);
+    }
+    return method.as<Value::FuncType>();
+}
+
+std::unique_ptr<Iterator> make_iterator(const Value& iterableVal) {
+    if (iterableVal.is<Value::ArrayType>()) {
+        return std::make_unique<ArrayIterator>(iterableVal.as<Value::ArrayType>());
+    }
+    if (iterableVal.is<StringData>()) {
+        return std::make_unique<StringIterator>(iterableVal.as<StringData>());
+    }
+    if (iterableVal.is<Value::DictType>()) {
+        const auto& dict = iterableVal.as<Value::DictType>();
+        return std::make_unique<DictIterator>(dict, false);
+    }
+    if (iterableVal.is<Value::NativeType>()) {
+        if (auto it = iterableVal.as<Value::NativeType>()->iter()) return it;
+        throw std::runtime_error("Value of type '" + iterableVal.as<Value::NativeType>()->typeName() + "' is not iterable.");
+    }
+    if (iterableVal.is<Value::MutableObjectType>()) {
+        const auto& obj = iterableVal.as<Value::MutableObjectType>();
+        if (auto iter_fn = find_bound_method(obj, "iter")) {
+            if (iter_fn->arity() != 0) throw std::runtime_error("Method 'iter' used for iteration must take no arguments.");
+            Value iterVal = iter_fn->call({});
+            if (iterVal.is<Value::MutableObjectType>() && iterVal.as<Value::MutableObjectType>() == obj) {
+                if (auto next_fn = find_bound_method(obj, "next")) return std::make_unique<ProtocolIterator>(next_fn);
+                throw std::runtime_error("Object returned by iter() has no 'next' method.");
+            }
+            return make_iterator(iterVal);
+        }
+        if (auto next_fn = find_bound_method(obj, "next")) {
+            return std::make_unique<ProtocolIterator>(next_fn);
+        }
+        return std::make_unique<FieldIterator>(obj, false);
+    }
+    throw std::runtime_error("Value is not iterable. Can only iterate over arrays, strings, dicts, objects and iterators.");
+}
+
+// stream(src).map(f).filter(g).take(n) 只记录流水线的各个阶段；
+// 终止操作（reduce/sum/count/to_array/for-each）时对数据源做一次融合遍历，不产生中间数组
+class StreamValue final : public NativeObject {
+public:
+    enum class StageKind { MAP, FILTER, TAKE };
+    struct Stage {
+        StageKind kind;
+        Value::FuncType func;
+        int count = 0;
+    };
+    Value source;
+    std::vector<Stage> stages;
+
+    explicit StreamValue(Value src, std::vector<Stage> st = {}) : source(std::move(src)), stages(std::move(st)) {}
+
+    std::string typeName() const override { return "stream"; }
+    std::unique_ptr<Iterator> iter() override;
+    Value getMember(const std::string& name) override;
+
+private:
+    Value withStage(Stage stage) const {
+        auto next_stages = stages;
+        next_stages.push_back(std::move(stage));
+        return Value(std::static_pointer_cast<NativeObject>(std::make_shared<StreamValue>(source, std::move(next_stages))));
+    }
+};
+
+class StreamIterator final : public Iterator {
+    std::shared_ptr<const NativeObject> owner; // stages 引用的是 owner 的成员
+    std::unique_ptr<Iterator> source;
+    const std::vector<StreamValue::Stage>& stages;
+    std::vector<int> taken;
+    bool done = false;
+public:
+    StreamIterator(std::unique_ptr<Iterator> src, const StreamValue& stream)
+        : owner(stream.shared_from_this()), source(std::move(src)), stages(stream.stages),
+          taken(stream.stages.size(), 0) {
+        for (const auto& stage : stages) {
+            if (stage.kind == StreamValue::StageKind::TAKE && stage.count <= 0) done = true;
+        }
+    }
+    bool next(Value& out) override {
+        while (!done && source->next(out)) {
+            bool keep = true;
+            for (size_t i = 0; i < stages.size() && keep; ++i) {
+                const auto& stage = stages[i];
+                switch (stage.kind) {
+                    case StreamValue::StageKind::MAP:
+                        out = stage.func->call({out});
+                        break;
+                    case StreamValue::StageKind::FILTER:
+                        keep = stage.func->call({out}).toBool();
+                        break;
+                    case StreamValue::StageKind::TAKE:
+                        // 达到上限后不再从数据源拉取，但当前元素仍要走完后续阶段
+                        if (++taken[i] >= stage.count) done = true;
+                        break;
+                }
+            }
+            if (keep) return true;
+        }
+        return false;
+    }
+};
+
+std::unique_ptr<Iterator> StreamValue::iter() {
+    std::unique_ptr<Iterator> src;
+    if (source.is<Value::FuncType>()) {
+        src = std::make_unique<ProtocolIterator>(source.as<Value::FuncType>());
+    } else {
+        src = make_iterator(source);
+    }
+    return std::make_unique<StreamIterator>(std::move(src), *this);
+}
+
+Value StreamValue::getMember(const std::string& name) {
+    auto self = std::static_pointer_cast<StreamValue>(shared_from_this());
+    auto require_func = [name](const Value& v, int arity) {
+        if (!v.is<Value::FuncType>()) throw std::runtime_error("Argument to stream." + name + "() must be a function.");
+        const auto& func = v.as<Value::FuncType>();
+        if (func->arity() != arity) {
+            throw std::runtime_error("Function for stream." + name + "() must take exactly " + (arity == 1 ? "one argument." : "two arguments."));
+        }
+        return func;
+    };
+    if (name == "map" || name == "filter") {
+        StageKind kind = name == "map" ? StageKind::MAP : StageKind::FILTER;
+        return native_method(name, 1, [self, kind, require_func](const std::vector<Value>& args) -> Value {
+            return self->withStage({kind, require_func(args[0], 1), 0});
+        });
+    }
+    if (name == "take") {
+        return native_method(name, 1, [self](const std::vector<Value>& args) -> Value {
+            if (!args[0].is<int>()) throw std::runtime_error("Argument to stream.take() must be an integer.");
+            return self->withStage({StageKind::TAKE, nullptr, args[0].as<int>()});
+        });
+    }
+    if (name == "reduce") {
+        return native_method(name, -1, [self, require_func](const std::vector<Value>& args) -> Value {
+            if (args.size() != 1 && args.size() != 2) throw std::runtime_error("stream.reduce() takes 1 or 2 arguments.");
+            auto func = require_func(args[0], 2);
+            auto it = self->iter();
+            Value acc;
+            if (args.size() == 2) {
+                acc = args[1];
+            } else if (!it->next(acc)) {
+                throw std::runtime_error("stream.reduce() of empty stream with no initial value.");
+            }
+            Value element;
+            while (it->next(element)) acc = func->call({acc, element});
+            return acc;
+        });
+    }
+    if (name == "sum") {
+        return native_method(name, 0, [self](const std::vector<Value>&) -> Value {
+            return sum_sequence(*self->iter());
+        });
+    }
+    if (name == "count") {
+        return native_method(name, 0, [self](const std::vector<Value>&) -> Value {
+            auto it = self->iter();
+            int n = 0;
+            Value element;
+            while (it->next(element)) ++n;
+            return Value(n);
+        });
+    }
+    if (name == "to_array") {
+        return native_method(name, 0, [self](const std::vector<Value>&) -> Value {
+            return Value(self->toArray());
+        });
+    }
+    return NativeObject::getMember(name);
+}
+
+// Set：与字典共用 FlatHashTable，只保存键；元素需可哈希，迭代按插入顺序
+struct SetEntry {
+    Value key;
+    size_t hash;
+    bool deleted = false;
+    SetEntry(Value k, size_t h) : key(std::move(k)), hash(h) {}
+    void drop() { key = Value(); deleted = true; }
+};
+
+class SetValue final : public NativeObject {
+public:
+    FlatHashTable<SetEntry> table;
+
+    std::string typeName() const override { return "Set"; }
+    std::string toString() const override {
+        std::string result = "Set{";
+        bool first = true;
+        for (const auto& entry : table) {
+            if (!first) result += ", ";
+            result += entry.key.toString();
+            first = false;
+        }
+        return result + "}";
+    }
+    bool toBool() const override { return !table.empty(); }
+    int length() const override { return static_cast<int>(table.size()); }
+    std::unique_ptr<Iterator> iter() override;
+    Value getMember(const std::string& name) override;
+    std::shared_ptr<ArrayValue> toArray() override {
+        auto arr = std::make_shared<ArrayValue>();
+        arr->elements.reserve(table.size());
+        for (const auto& entry : table) arr->elements.push_back(entry.key);
+        return arr;
+    }
+    std::shared_ptr<NativeObject> clone() const override { return std::make_shared<SetValue>(*this); }
+    bool equals(const NativeObject& other) const override {
+        auto* o = dynamic_cast<const SetValue*>(&other);
+        if (!o || o->table.size() != table.size()) return false;
+        for (const auto& entry : table) {
+            if (!o->table.contains(entry.key)) return false;
+        }
+        return true;
+    }
+};
+
+class SetIterator final : public Iterator {
+    std::shared_ptr<SetValue> set;
+    size_t pos = 0;
+    size_t expected_size;
+public:
+    explicit SetIterator(std::shared_ptr<SetValue> s) : set(std::move(s)), expected_size(set->table.size()) {}
+    bool next(Value& out) override {
+        if (set->table.size() != expected_size) throw std::runtime_error("Container changed size during iteration.");
+        const SetEntry* entry = set->table.next(pos);
+        if (!entry) return false;
+        out = entry->key;
+        return true;
+    }
+};
+
+std::unique_ptr<Iterator> SetValue::iter() {
+    return std::make_unique<SetIterator>(std::static_pointer_cast<SetValue>(shared_from_this()));
+}
+
+static std::shared_ptr<SetValue> make_set(const Value& source) {
+    auto set = std::make_shared<SetValue>();
+    if (source.is<Value::ArrayType>()) set->table.reserve(source.as<Value::ArrayType>()->elements.size());
+    auto it = make_iterator(source);
+    Value element;
+    while (it->next(element)) set->table.emplace(element);
+    return set;
+}
+
+// 集合运算的参数可以是另一个 Set，也可以是任意可迭代值（先转换为临时 Set）
+static std::shared_ptr<SetValue> as_set(const Value& v) {
+    if (v.is<Value::NativeType>()) {
+        if (auto set = std::dynamic_pointer_cast<SetValue>(v.as<Value::NativeType>())) return set;
+    }
+    return make_set(v);
+}
+
+Value SetValue::getMember(const std::string& name) {
+    auto self = std::static_pointer_cast<SetValue>(shared_from_this());
+    auto wrap = [](std::shared_ptr<SetValue> set) {
+        return Value(std::static_pointer_cast<NativeObject>(std::move(set)));
+    };
+    if (name == "add") {
+        return native_method(name, 1, [self](const std::vector<Value>& args) -> Value {
+            return Value(self->table.emplace(args[0]).second);
+        });
+    }
+    if (name == "remove") {
+        return native_method(name, 1, [self](const std::vector<Value>& args) -> Value {
+            return Value(self->table.erase(args[0]));
+        });
+    }
+    if (name == "contains") {
+        return native_method(name, 1, [self](const std::vector<Value>& args) -> Value {
+            return Value(self->table.contains(args[0]));
+        });
+    }
+    if (name == "union") {
+        return native_method(name, 1, [self, wrap](const std::vector<Value>& args) -> Value {
+            auto result = std::make_shared<SetValue>(*self);
+            auto it = make_iterator(args[0]);
+            Value element;
+            while (it->next(element)) result->table.emplace(element);
+            return wrap(result);
+        });
+    }
+    if (name == "intersection") {
+        return native_method(name, 1, [self, wrap](const std::vector<Value>& args) -> Value {
+            auto other = as_set(args[0]);
+            // 遍历较小的一侧，在较大的一侧查找；结果按较小一侧的顺序排列
+            const bool self_smaller = self->table.size() <= other->table.size();
+            const auto& small = self_smaller ? self->table : other->table;
+            const auto& large = self_smaller ? other->table : self->table;
+            auto result = std::make_shared<SetValue>();
+            for (const auto& entry : small) {
+                if (large.contains(entry.key)) result->table.emplace(entry.key);
+            }
+            return wrap(result);
+        });
+    }
+    if (name == "difference") {
+        return native_method(name, 1, [self, wrap](const std::vector<Value>& args) -> Value {
+            auto other = as_set(args[0]);
+            auto result = std::make_shared<SetValue>();
+            for (const auto& entry : self->table) {
+                if (!other->table.contains(entry.key)) result->table.emplace(entry.key);
+            }
+            return wrap(result);
+        });
+    }
+    if (name == "to_array") {
+        return native_method(name, 0, [self](const std::vector<Value>&) -> Value {
+            return Value(self->toArray());
+        });
+    }
+    return NativeObject::getMember(name);
+}
+
+std::optional<Value> ForEachStmt::exec(Environment& env) const {
+    auto loopEnv = std::make_shared<Environment>(env.shared_from_this());
+    Value iterableVal = iterable->eval(env);
+
+    // 循环变量只定义一次，之后每一步直接写入
+    loopEnv->define(variableName, Value(), std::nullopt);
+    Value& element = loopEnv->get(variableName);
+    auto run_body = [&]() -> std::optional<Value> {
+        try {
+            return body->exec(*loopEnv);
+        } catch (const ContinueSignal&) {
+            return std::nullopt;
+        }
+    };
+
+    // range 走无装箱计数器的快速路径，不经过虚调用
+    if (iterableVal.is<Value::NativeType>()) {
+        auto* range = dynamic_cast<RangeValue*>(iterableVal.as<Value::NativeType>().get());
+        if (range && range->lazy()) {
+            const long long stop = range->stop, step = range->step;
+            try {
+                for (long long i = range->start; step > 0 ? i < stop : i > stop; i += step) {
+                    element = Value(static_cast<int>(i));
+                    if (auto retVal = run_body(); retVal.has_value()) return retVal;
+                }
+            } catch (const BreakSignal&) {}
+            return std::nullopt;
+        }
+    }
+
+    std::unique_ptr<Iterator> it;
+    auto advance = [&]() -> bool {
+        try {
+            if (!it) it = make_iterator(iterableVal);
+            return it->next(element);
+        } catch (const RuntimeError&) {
+            throw;
+        } catch (const std::runtime_error& e) {
+            throw RuntimeError(this->line, e.what());
+        }
+    };
+    try {
+        while (advance()) {
+            if (auto retVal = run_body(); retVal.has_value()) return retVal;
+        }
+    } catch (const BreakSignal&) {}
+    return std::nullopt;
+}
+std::optional<Value> ForStmt::exec(Environment& env) const {
+    auto loopEnv = std::make_shared<Environment>(env.shared_from_this());
+    if (initializer) {
+        initializer->exec(*loopEnv);
+    }
+    while(true) {
+        if (condition && !condition->eval(*loopEnv).toBool()) {
+            break;
+        }
+        try {
+            if (auto retVal = body->exec(*loopEnv); retVal.has_value()) {
+                return retVal;
+            }
+        } catch (const BreakSignal&) {
+            break;
+        } catch (const ContinueSignal&) {}
+        if (increment) {
+            increment->eval(*loopEnv);
+        }
+    }
+    return std::nullopt;
+}
+
+std::optional<Value> ThrowStmt::exec(Environment& env) const {
+    throw ThrowSignal(expr->eval(env));
+    return std::nullopt; // Unreachable
+}
+
+std::optional<Value> TryStmt::exec(Environment& env) const {
+    try {
+        if (auto retVal = try_block->exec(env); retVal.has_value()) {
+            return retVal;
+        }
+    } catch (const ThrowSignal& signal) {
+        // 这个块处理来自脚本 'throw' 关键字的异常
         auto catch_env = std::make_shared<Environment>(env.shared_from_this());
         catch_env->define(catch_variable.lexeme, signal.thrown_value, std::nullopt);
         return catch_block->exec(*catch_env);
@@ -1469,6 +2991,33 @@ std::optional<Value> TryStmt::exec(Environment& env) const {
     return std::nullopt;
 }
 
+// ---- 标准输出缓冲 (StdoutBuffer) ----
+// print 的输出先积累在一块可复用的大缓冲区里，满 64KB 才写一次 stdout，而不是每行 std::endl 刷新一次。
+// 以下情况会立即刷新：程序结束（包括析构时）、input() 等待输入前、输出错误信息前、调用 flush()；
+// 交互使用时可以用 line_buffered(true) 改为每次 print 后刷新。
+class StdoutBuffer {
+    static constexpr size_t CAPACITY = 64 * 1024;
+    std::string buf;
+public:
+    bool line_buffered = false;
+
+    StdoutBuffer() { buf.reserve(CAPACITY); }
+    ~StdoutBuffer() { flush(); }
+
+    void write(const std::string& text) {
+        buf += text;
+        if (line_buffered || buf.size() >= CAPACITY) flush();
+    }
+    void flush() {
+        if (buf.empty()) return;
+        std::cout.write(buf.data(), static_cast<std::streamsize>(buf.size()));
+        std::cout.flush();
+        buf.clear();
+    }
+};
+
+static StdoutBuffer stdout_buffer;
+
 // ===================================================================
 // 7. 语法分析器 (Parser)
 // ===================================================================
@@ -1495,15 +3044,35 @@ private:
         }
         return false;
     }
+    // 语法错误统一带上行号抛出，由 parseDeclaration 报告并同步到下一条语句
+    [[noreturn]] static void syntaxError(std::string_view message, int line) {
+        throw std::runtime_error(std::string(message) + " at line " + std::to_string(line));
+    }
     Token& consume(TokenType type, std::string_view message) {
         if (check(type)) return advance();
-        throw std::runtime_error(std::string(message) + " at line " + std::to_string(peek().line));
+        syntaxError(message, peek().line);
     }
     Token& advance() { if (!isAtEnd()) current++; return previous(); }
     bool isAtEnd() const { return peek().type == TokenType::END; }
     const Token& peek() const { return tokens[current]; }
     Token& previous() { return tokens[current - 1]; }
     bool check(TokenType type) const { return !isAtEnd() && peek().type == type; }
+    // 数字字面量用 from_chars 解析；超出 int 范围的整数字面量报语法错误，而不是让 stoi 抛出未捕获的异常
+    Value numberLiteral(const Token& tok) const {
+        const std::string& text = tok.lexeme;
+        if (tok.type == TokenType::FLOAT_LITERAL) {
+            double d = 0.0;
+            if (std::from_chars(text.data(), text.data() + text.size(), d).ec != std::errc()) {
+                syntaxError("Float literal '" + text + "' is out of range", tok.line);
+            }
+            return Value(d);
+        }
+        int i = 0;
+        if (std::from_chars(text.data(), text.data() + text.size(), i).ec != std::errc()) {
+            syntaxError("Integer literal '" + text + "' is out of range", tok.line);
+        }
+        return Value(i);
+    }
     bool checkAhead(std::initializer_list<TokenType> types) const {
         size_t lookahead = current;
         for (TokenType type : types) {
@@ -1549,6 +3118,7 @@ private:
             }
             return parseStatement();
         } catch (const std::runtime_error& e) {
+            stdout_buffer.flush(); // include/import 在运行期解析，之前的输出要先于错误信息出现
             std::cerr << "Parse Error: " << e.what() << std::endl;
             synchronize();
             return nullptr;
@@ -1772,7 +3342,7 @@ ExprPtr Parser::parseAssignment() {
         if (dynamic_cast<VarExpr*>(expr.get()) || dynamic_cast<IndexExpr*>(expr.get()) || dynamic_cast<MemberAccessExpr*>(expr.get())) {
             return std::make_unique<AssignExpr>(std::move(expr), std::move(value), equals.line);
         }
-        throw std::runtime_error("Invalid assignment target at line " + std::to_string(equals.line));
+        syntaxError("Invalid assignment target", equals.line);
     }
     return expr;
 }
@@ -1866,8 +3436,7 @@ ExprPtr Parser::parseCall() {
     return expr;
 }
 ExprPtr Parser::parsePrimary() {
-    if (match({TokenType::INT_LITERAL})) return std::make_unique<LiteralExpr>(Value(std::stoi(previous().lexeme)), previous().line);
-    if (match({TokenType::FLOAT_LITERAL})) return std::make_unique<LiteralExpr>(Value(std::stod(previous().lexeme)), previous().line);
+    if (match({TokenType::INT_LITERAL, TokenType::FLOAT_LITERAL})) return std::make_unique<LiteralExpr>(numberLiteral(previous()), previous().line);
     if (match({TokenType::STR})) return std::make_unique<LiteralExpr>(Value(StringData::from_literal(previous().lexeme)), previous().line);
     if (match({TokenType::TRUE})) return std::make_unique<LiteralExpr>(Value(true), previous().line);
     if (match({TokenType::FALSE})) return std::make_unique<LiteralExpr>(Value(false), previous().line);
@@ -1895,7 +3464,7 @@ ExprPtr Parser::parsePrimary() {
     if (match({TokenType::LBRACKET})) {
         return parseArrayLiteral();
     }
-    throw std::runtime_error("Expect expression at line " + std::to_string(peek().line));
+    syntaxError("Expect expression", peek().line);
 }
 ExprPtr Parser::parseArrayLiteral() {
     int ln = previous().line;
@@ -1910,14 +3479,17 @@ ExprPtr Parser::parseArrayLiteral() {
 }
 ExprPtr Parser::parseDictLiteral() {
     int ln = previous().line;
-    std::vector<std::pair<std::string, ExprPtr>> pairs;
+    std::vector<std::pair<Value, ExprPtr>> pairs;
 
     if (!check(TokenType::RBRACE)) {
         do {
-            Token key = consume(TokenType::STR, "Expect string literal as dictionary key.");
+            Value key;
+            if (match({TokenType::INT_LITERAL, TokenType::FLOAT_LITERAL})) key = numberLiteral(previous());
+            else if (match({TokenType::TRUE, TokenType::FALSE})) key = Value(previous().type == TokenType::TRUE);
+            else key = Value(StringData::from_literal(consume(TokenType::STR, "Expect string, number or boolean literal as dictionary key.").lexeme));
             consume(TokenType::COLON, "Expect ':' after dictionary key.");
             ExprPtr value = parseExpression();
-            pairs.emplace_back(key.lexeme, std::move(value));
+            pairs.emplace_back(std::move(key), std::move(value));
         } while (match({TokenType::COMMA}));
     }
 
@@ -1969,6 +3541,41 @@ StmtPtr Parser::parseForStatement() {
     StmtPtr body = parseStatement();
     return std::make_unique<ForStmt>(std::move(initializer), std::move(condition), std::move(increment), std::move(body), for_line);
 }
+// 读入整个文件（read_file / read_file_bytes 共用）：普通文件按大小一次分配、一次读入；
+// /proc 等报告不出大小的文件逐块读取。目录等不可读的路径报告为运行时错误
+template <typename Buffer>
+static Buffer read_whole_file(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) throw std::runtime_error("Could not open file: " + path);
+    file.seekg(0, std::ios::end);
+    std::streamoff size = file ? static_cast<std::streamoff>(file.tellg()) : -1;
+    file.clear();
+    file.seekg(0);
+    file.clear();
+    file.peek();
+    if (file.bad()) throw std::runtime_error("Could not read file: " + path);
+    file.clear();
+    Buffer content;
+    try {
+        if (size > 0) {
+            content.resize(static_cast<size_t>(size));
+            file.read(reinterpret_cast<char*>(content.data()), static_cast<std::streamsize>(size));
+            content.resize(static_cast<size_t>(file.gcount()));
+        } else {
+            char chunk[65536];
+            while (file.read(chunk, sizeof(chunk)), file.gcount() > 0) {
+                content.insert(content.end(), chunk, chunk + file.gcount());
+            }
+        }
+    } catch (const std::length_error&) {
+        throw std::runtime_error("File is too large to read: " + path);
+    } catch (const std::bad_alloc&) {
+        throw std::runtime_error("File is too large to read: " + path);
+    }
+    if (file.bad()) throw std::runtime_error("Could not read file: " + path);
+    return content;
+}
+
 // 辅助函数，读取文件内容
 // 辅助函数，读取文件内容
 static std::string readFile(const std::string& path) {
@@ -2097,79 +3704,4771 @@ std::optional<Value> ImportStmt::exec(Environment& env) const {
 // ===================================================================
 // 8. 解释器 (Interpreter)
 // ===================================================================
-Value deepcopy_recursive(const Value& val, std::unordered_map<const void*, Value>& memo) {
-    return std::visit(overloaded{
-        [](std::monostate) { return Value(); },
-        [](int v) { return Value(v); },
-        [](double v) { return Value(v); },
-        [](bool v) { return Value(v); },
-        [](const StringData& v) { return Value(v.get()); },
-        [](const Value::FuncType& v) { return Value(v); },
+// ---- 深拷贝 (deepcopy) ----
+// deepcopy 的备忘表：以原容器地址为键的开放寻址表，键值连续存放，没有逐节点分配
+class PointerMemo {
+    std::vector<std::pair<const void*, Value>> slots; // 容量总是 2 的幂，装载率不超过 1/2
+    size_t used = 0;
+    int bits = 0;
+
+    size_t slotOf(const void* p) const {
+        // Fibonacci 哈希：取乘积的高位，地址低位的对齐零不会造成聚集
+        return static_cast<size_t>((reinterpret_cast<uint64_t>(p) * 0x9E3779B97F4A7C15ull) >> (64 - bits));
+    }
+    void grow() {
+        std::vector<std::pair<const void*, Value>> old(size_t(1) << (bits + 1));
+        old.swap(slots);
+        ++bits;
+        for (auto& slot : old) {
+            if (!slot.first) continue;
+            size_t i = slotOf(slot.first);
+            while (slots[i].first) i = (i + 1) & (slots.size() - 1);
+            slots[i] = std::move(slot);
+        }
+    }
+public:
+    PointerMemo() { grow(); grow(); grow(); grow(); }
 
-        [&](const Value::ArrayType& arr) -> Value {
-            const void* ptr = arr.get();
-            if (memo.count(ptr)) {
-                return memo.at(ptr);
-            }
+    const Value* find(const void* p) const {
+        for (size_t i = slotOf(p);; i = (i + 1) & (slots.size() - 1)) {
+            if (slots[i].first == p) return &slots[i].second;
+            if (!slots[i].first) return nullptr;
+        }
+    }
+    void insert(const void* p, Value v) {
+        if ((used + 1) * 2 > slots.size()) grow();
+        size_t i = slotOf(p);
+        while (slots[i].first) i = (i + 1) & (slots.size() - 1);
+        slots[i] = { p, std::move(v) };
+        ++used;
+    }
+};
+
+// 迭代式深拷贝，不占用 C++ 调用栈，任意深度的嵌套都不会栈溢出。
+// 每个容器先整体浅拷贝（数组只共享 CowVector 缓冲区，字典复制连续的条目数组），登记到备忘表后压入工作栈；
+// 出栈时再把其中仍指向原容器的槽位替换为副本。字符串本身是写时复制的，直接共享。
+// 因此只含标量的数组在被修改之前完全不复制元素，含嵌套容器的数组也只在第一次替换时复制一次缓冲区。
+class DeepCopier {
+    PointerMemo memo;
+    std::vector<Value> pending;
+
+    static bool isContainer(const Value& v) {
+        return v.is<Value::ArrayType>() || v.is<Value::DictType>() || v.is<Value::MutableObjectType>() || v.is<Value::NativeType>();
+    }
+
+    // 返回 v 的副本（若已拷贝过则返回同一个副本），新建的容器留待 fill() 处理其内容
+    Value shell(const Value& v) {
+        const void* key = nullptr;
+        Value copy;
+        if (v.is<Value::ArrayType>()) {
+            const auto& arr = v.as<Value::ArrayType>();
+            if (const Value* hit = memo.find(key = arr.get())) return *hit;
+            copy = Value(std::make_shared<ArrayValue>(*arr));
+        } else if (v.is<Value::DictType>()) {
+            const auto& dict = v.as<Value::DictType>();
+            if (const Value* hit = memo.find(key = dict.get())) return *hit;
+            copy = Value(std::make_shared<DictValue>(*dict));
+        } else if (v.is<Value::MutableObjectType>()) {
+            const auto& obj = v.as<Value::MutableObjectType>();
+            if (const Value* hit = memo.find(key = obj.get())) return *hit;
+            auto newObj = std::make_shared<MutableObject>(obj->parent);
+            newObj->klass = obj->klass;
+            newObj->fields = obj->fields;
+            copy = Value(newObj);
+        } else if (v.is<Value::NativeType>()) {
+            const auto& native = v.as<Value::NativeType>();
+            if (const Value* hit = memo.find(native.get())) return *hit;
+            auto cloned = native->clone();
+            if (!cloned) {
+                memo.insert(native.get(), v);
+                return v; // 不可变的原生对象直接共享
+            }
+            key = native.get();
+            copy = Value(cloned); // 其中持有的元素由 fill() 通过 forEachValue 逐个复制
+        } else {
+            return v; // 标量、字符串、函数都是不可变的，直接共享
+        }
+        memo.insert(key, copy);
+        pending.push_back(copy);
+        return copy;
+    }
+
+    void fill(const Value& copy) {
+        if (copy.is<Value::ArrayType>()) {
+            auto& elems = copy.as<Value::ArrayType>()->elements;
+            for (size_t i = 0; i < elems.size(); ++i) {
+                if (isContainer(elems[i])) elems.set(i, shell(Value(elems[i])));
+            }
+        } else if (copy.is<Value::DictType>()) {
+            auto& dict = *copy.as<Value::DictType>();
+            size_t pos = 0;
+            while (DictEntry* entry = dict.next(pos)) {
+                if (isContainer(entry->value)) entry->value = shell(entry->value);
+            }
+        } else if (copy.is<Value::NativeType>()) {
+            copy.as<Value::NativeType>()->forEachValue([this](Value& v) {
+                if (isContainer(v)) v = shell(v);
+            });
+        } else {
+            auto& obj = *copy.as<Value::MutableObjectType>();
+            if (obj.parent) obj.parent = shell(Value(obj.parent)).as<Value::MutableObjectType>();
+            for (auto& pair : obj.fields) {
+                if (isContainer(pair.second)) pair.second = shell(pair.second);
+            }
+        }
+    }
+
+public:
+    Value copy(const Value& root) {
+        Value result = shell(root);
+        while (!pending.empty()) {
+            Value next = std::move(pending.back());
+            pending.pop_back();
+            fill(next);
+        }
+        return result;
+    }
+};
+
+
+// ---- 数组批量内核 (sort/sum/min/max/join/...) ----
+static std::string value_type_name(const Value& val) {
+    return std::visit(overloaded{
+        [](std::monostate) -> std::string { return "nil"; },
+        [](int) -> std::string { return "int"; },
+        [](double) -> std::string { return "float"; },
+        [](bool) -> std::string { return "bool"; },
+        [](const StringData&) -> std::string { return "string"; },
+        [](const Value::FuncType&) -> std::string { return "function"; },
+        [](const Value::ArrayType&) -> std::string { return "array"; },
+        [](const Value::DictType&) -> std::string { return "dict"; },
+        [](const Value::MutableObjectType&) -> std::string { return "object"; },
+        [](const Value::NativeType& n) -> std::string { return n->typeName(); }
+    }, val.getVariant());
+}
+
+// 与 BinaryExpr 的比较语义一致：数字之间按数值比较，字符串按字典序，其余组合不可比较
+static int compare_values(const Value& a, const Value& b) {
+    if (a.is<int>() && b.is<int>()) {
+        int l = a.as<int>(), r = b.as<int>();
+        return (l > r) - (l < r);
+    }
+    if ((a.is<int>() || a.is<double>()) && (b.is<int>() || b.is<double>())) {
+        double l = a.is<int>() ? a.as<int>() : a.as<double>();
+        double r = b.is<int>() ? b.as<int>() : b.as<double>();
+        return (l > r) - (l < r);
+    }
+    if (a.is<StringData>() && b.is<StringData>()) {
+        return a.as<StringData>().view().compare(b.as<StringData>().view());
+    }
+    throw std::runtime_error("Cannot compare values of type '" + value_type_name(a) + "' and '" + value_type_name(b) + "'.");
+}
+
+// 与 == 运算符一致：int 与 float 按数值比较，字符串按内容比较
+static bool values_equal(const Value& a, const Value& b) {
+    if ((a.is<int>() || a.is<double>()) && (b.is<int>() || b.is<double>())) {
+        return compare_values(a, b) == 0;
+    }
+    return a == b;
+}
+
+enum class ElementKind { EMPTY, INT, DOUBLE, STRING, MIXED };
+
+static ElementKind classify_elements(const Value* first, const Value* last) {
+    if (first == last) return ElementKind::EMPTY;
+    const size_t index = first->getVariant().index();
+    for (const Value* v = first; v != last; ++v) {
+        if (v->getVariant().index() != index) return ElementKind::MIXED;
+    }
+    if (first->is<int>()) return ElementKind::INT;
+    if (first->is<double>()) return ElementKind::DOUBLE;
+    if (first->is<StringData>()) return ElementKind::STRING;
+    return ElementKind::MIXED;
+}
+
+// 同类型数组先拆箱到连续的原始数组再排序（libstdc++ 的 std::sort 即 introsort），
+// 比较时没有类型分派；NaN 统一排在末尾以保证严格弱序
+static void sort_values(std::vector<Value>& elems) {
+    switch (classify_elements(elems.data(), elems.data() + elems.size())) {
+        case ElementKind::EMPTY:
+            return;
+        case ElementKind::INT: {
+            std::vector<int> keys;
+            keys.reserve(elems.size());
+            for (const auto& v : elems) keys.push_back(*std::get_if<int>(&v.getVariant()));
+            std::sort(keys.begin(), keys.end());
+            for (size_t i = 0; i < keys.size(); ++i) elems[i] = Value(keys[i]);
+            return;
+        }
+        case ElementKind::DOUBLE: {
+            std::vector<double> keys;
+            keys.reserve(elems.size());
+            for (const auto& v : elems) keys.push_back(*std::get_if<double>(&v.getVariant()));
+            auto nan_begin = std::partition(keys.begin(), keys.end(), [](double d) { return d == d; });
+            std::sort(keys.begin(), nan_begin);
+            for (size_t i = 0; i < keys.size(); ++i) elems[i] = Value(keys[i]);
+            return;
+        }
+        case ElementKind::STRING:
+            std::sort(elems.begin(), elems.end(), [](const Value& a, const Value& b) {
+                return std::get_if<StringData>(&a.getVariant())->get() < std::get_if<StringData>(&b.getVariant())->get();
+            });
+            return;
+        case ElementKind::MIXED: {
+            // 可能抛出“不可比较”的异常，因此在副本上排序，成功后再替换
+            std::vector<Value> sorted = elems;
+            std::stable_sort(sorted.begin(), sorted.end(), [](const Value& a, const Value& b) {
+                return compare_values(a, b) < 0;
+            });
+            elems.swap(sorted);
+            return;
+        }
+    }
+}
+
+// 比较函数和 key 函数可能修改正在排序的数组，所以排序总是在副本上进行，
+// 用户代码全部执行完后再写回；期间数组长度变了就报错，而不是丢掉新元素
+static void store_sorted(ArrayValue& arr, std::vector<Value>&& sorted) {
+    if (arr.elements.size() != sorted.size()) throw std::runtime_error("Array was modified during sort.");
+    arr.elements = CowVector(std::move(sorted));
+}
+
+// 用户比较函数：返回布尔值表示 a 是否排在 b 前面，返回数字时按负数/零/正数解释。
+// 参数向量在所有比较间复用，arity 只检查一次
+static void sort_values_with(ArrayValue& arr, const Value::FuncType& cmp) {
+    if (cmp->arity() != 2 && cmp->arity() != -1) throw std::runtime_error("Comparator for sort must take exactly two arguments.");
+    std::vector<Value> args(2);
+    std::vector<Value> sorted(arr.elements.begin(), arr.elements.end());
+    std::stable_sort(sorted.begin(), sorted.end(), [&](const Value& a, const Value& b) {
+        args[0] = a;
+        args[1] = b;
+        Value result = cmp->call(args);
+        if (result.is<int>()) return result.as<int>() < 0;
+        if (result.is<double>()) return result.as<double>() < 0.0;
+        return result.toBool();
+    });
+    store_sorted(arr, std::move(sorted));
+}
+
+// 每个元素只调用一次 key 函数，然后按键的类型选择拆箱排序；结果是稳定的
+static void sort_values_by(ArrayValue& arr, const Value::FuncType& key_fn) {
+    if (key_fn->arity() != 1 && key_fn->arity() != -1) throw std::runtime_error("Key function for sort_by must take exactly one argument.");
+    std::vector<Value> elems(arr.elements.begin(), arr.elements.end());
+    std::vector<Value> keys;
+    keys.reserve(elems.size());
+    std::vector<Value> args(1);
+    for (const auto& v : elems) {
+        args[0] = v;
+        keys.push_back(key_fn->call(args));
+    }
+    std::vector<size_t> order(elems.size());
+    for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+
+    switch (classify_elements(keys.data(), keys.data() + keys.size())) {
+        case ElementKind::EMPTY:
+            return;
+        case ElementKind::INT: {
+            std::vector<int> k(keys.size());
+            for (size_t i = 0; i < keys.size(); ++i) k[i] = *std::get_if<int>(&keys[i].getVariant());
+            std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return k[a] < k[b]; });
+            break;
+        }
+        case ElementKind::DOUBLE: {
+            std::vector<double> k(keys.size());
+            for (size_t i = 0; i < keys.size(); ++i) k[i] = *std::get_if<double>(&keys[i].getVariant());
+            auto nan_begin = std::stable_partition(order.begin(), order.end(), [&](size_t i) { return k[i] == k[i]; });
+            std::stable_sort(order.begin(), nan_begin, [&](size_t a, size_t b) { return k[a] < k[b]; });
+            break;
+        }
+        case ElementKind::STRING: {
+            std::vector<const std::string*> k(keys.size());
+            for (size_t i = 0; i < keys.size(); ++i) k[i] = &std::get_if<StringData>(&keys[i].getVariant())->get();
+            std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return *k[a] < *k[b]; });
+            break;
+        }
+        case ElementKind::MIXED:
+            std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return compare_values(keys[a], keys[b]) < 0; });
+            break;
+    }
+    std::vector<Value> sorted;
+    sorted.reserve(elems.size());
+    for (size_t i : order) sorted.push_back(std::move(elems[i]));
+    store_sorted(arr, std::move(sorted));
+}
+
+// min/max 的公共实现：want 为 -1 取最小值，为 1 取最大值
+static Value extreme_of(const std::vector<Value>& args, int want, const std::string& name) {
+    std::unique_ptr<Iterator> it;
+    if (args.size() == 1) {
+        it = sequence_iterator(args[0], "Argument to " + name + "()");
+    } else {
+        auto arr = std::make_shared<ArrayValue>();
+        arr->elements = args;
+        it = std::make_unique<ArrayIterator>(arr);
+    }
+    Value best;
+    if (!it->next(best)) throw std::runtime_error(name + "() of an empty sequence.");
+    Value element;
+    while (it->next(element)) {
+        if (compare_values(element, best) * want > 0) best = element;
+    }
+    return best;
+}
+
+// ---- 数值向量内核 (vec 模块) ----
+// Float64 数据走 SSE2/AVX2 内核，运行时按 CPU 能力选择，其他平台使用标量实现；
+// Int32 数据使用普通循环（结果保持整数语义）
+enum class SimdLevel { SCALAR, SSE2, AVX2 };
+
+static SimdLevel detect_simd_level() {
+#ifdef MINILANG_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return SimdLevel::AVX2;
+    if (__builtin_cpu_supports("sse2")) return SimdLevel::SSE2;
+#endif
+    return SimdLevel::SCALAR;
+}
+static const SimdLevel simd_level = detect_simd_level();
+
+enum class VecOp { ADD, SUB, MUL, DIV };
+enum class VecCmp { LT, LE, GT, GE, EQ, NE };
+
+template <VecOp op>
+static inline double vec_apply(double a, double b) {
+    if constexpr (op == VecOp::ADD) return a + b;
+    if constexpr (op == VecOp::SUB) return a - b;
+    if constexpr (op == VecOp::MUL) return a * b;
+    return a / b;
+}
+
+template <VecCmp cmp>
+static inline bool vec_compare(double a, double b) {
+    if constexpr (cmp == VecCmp::LT) return a < b;
+    if constexpr (cmp == VecCmp::LE) return a <= b;
+    if constexpr (cmp == VecCmp::GT) return a > b;
+    if constexpr (cmp == VecCmp::GE) return a >= b;
+    if constexpr (cmp == VecCmp::EQ) return a == b;
+    return a != b;
+}
+
+// 标量实现：既是非 x86 平台的后备，也用于处理 SIMD 循环剩下的尾部元素
+namespace vec_scalar {
+    template <VecOp op>
+    static void binary(const double* a, bool a_scalar, const double* b, bool b_scalar, double* out, size_t from, size_t n) {
+        for (size_t i = from; i < n; ++i) out[i] = vec_apply<op>(a[a_scalar ? 0 : i], b[b_scalar ? 0 : i]);
+    }
+    template <VecCmp cmp>
+    static void compare(const double* a, bool a_scalar, const double* b, bool b_scalar, std::int32_t* out, size_t from, size_t n) {
+        for (size_t i = from; i < n; ++i) out[i] = vec_compare<cmp>(a[a_scalar ? 0 : i], b[b_scalar ? 0 : i]);
+    }
+    static double sum(const double* a, size_t from, size_t n) {
+        double s = 0.0;
+        for (size_t i = from; i < n; ++i) s += a[i];
+        return s;
+    }
+    static double dot(const double* a, const double* b, size_t from, size_t n) {
+        double s = 0.0;
+        for (size_t i = from; i < n; ++i) s += a[i] * b[i];
+        return s;
+    }
+    static double extreme(const double* a, size_t from, size_t n, bool want_max, double best) {
+        for (size_t i = from; i < n; ++i) best = want_max ? (a[i] > best ? a[i] : best) : (a[i] < best ? a[i] : best);
+        return best;
+    }
+    static void abs(const double* a, double* out, size_t from, size_t n) {
+        for (size_t i = from; i < n; ++i) out[i] = std::fabs(a[i]);
+    }
+    static void sqrt(const double* a, double* out, size_t from, size_t n) {
+        for (size_t i = from; i < n; ++i) out[i] = std::sqrt(a[i]);
+    }
+    // out += alpha * x，矩阵乘法的内层循环
+    static void axpy(double* out, const double* x, double alpha, size_t from, size_t n) {
+        for (size_t i = from; i < n; ++i) out[i] += alpha * x[i];
+    }
+}
+
+#ifdef MINILANG_X86_SIMD
+namespace vec_sse2 {
+    template <VecOp op>
+    MINILANG_TARGET("sse2") static inline __m128d apply(__m128d a, __m128d b) {
+        if constexpr (op == VecOp::ADD) return _mm_add_pd(a, b);
+        if constexpr (op == VecOp::SUB) return _mm_sub_pd(a, b);
+        if constexpr (op == VecOp::MUL) return _mm_mul_pd(a, b);
+        return _mm_div_pd(a, b);
+    }
+    template <VecCmp cmp>
+    MINILANG_TARGET("sse2") static inline __m128d compare_reg(__m128d a, __m128d b) {
+        if constexpr (cmp == VecCmp::LT) return _mm_cmplt_pd(a, b);
+        if constexpr (cmp == VecCmp::LE) return _mm_cmple_pd(a, b);
+        if constexpr (cmp == VecCmp::GT) return _mm_cmpgt_pd(a, b);
+        if constexpr (cmp == VecCmp::GE) return _mm_cmpge_pd(a, b);
+        if constexpr (cmp == VecCmp::EQ) return _mm_cmpeq_pd(a, b);
+        return _mm_cmpneq_pd(a, b);
+    }
+    template <VecOp op>
+    MINILANG_TARGET("sse2") static void binary(const double* a, bool a_scalar, const double* b, bool b_scalar, double* out, size_t n) {
+        const __m128d sa = _mm_set1_pd(a[0]), sb = _mm_set1_pd(b[0]);
+        size_t i = 0;
+        for (; i + 2 <= n; i += 2) {
+            __m128d va = a_scalar ? sa : _mm_loadu_pd(a + i);
+            __m128d vb = b_scalar ? sb : _mm_loadu_pd(b + i);
+            _mm_storeu_pd(out + i, apply<op>(va, vb));
+        }
+        vec_scalar::binary<op>(a, a_scalar, b, b_scalar, out, i, n);
+    }
+    template <VecCmp cmp>
+    MINILANG_TARGET("sse2") static void compare(const double* a, bool a_scalar, const double* b, bool b_scalar, std::int32_t* out, size_t n) {
+        const __m128d sa = _mm_set1_pd(a[0]), sb = _mm_set1_pd(b[0]);
+        size_t i = 0;
+        for (; i + 2 <= n; i += 2) {
+            __m128d va = a_scalar ? sa : _mm_loadu_pd(a + i);
+            __m128d vb = b_scalar ? sb : _mm_loadu_pd(b + i);
+            int bits = _mm_movemask_pd(compare_reg<cmp>(va, vb));
+            out[i] = bits & 1;
+            out[i + 1] = (bits >> 1) & 1;
+        }
+        vec_scalar::compare<cmp>(a, a_scalar, b, b_scalar, out, i, n);
+    }
+    MINILANG_TARGET("sse2") static double sum(const double* a, size_t n) {
+        __m128d acc0 = _mm_setzero_pd(), acc1 = _mm_setzero_pd();
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            acc0 = _mm_add_pd(acc0, _mm_loadu_pd(a + i));
+            acc1 = _mm_add_pd(acc1, _mm_loadu_pd(a + i + 2));
+        }
+        double lanes[2];
+        _mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+        return lanes[0] + lanes[1] + vec_scalar::sum(a, i, n);
+    }
+    MINILANG_TARGET("sse2") static double dot(const double* a, const double* b, size_t n) {
+        __m128d acc0 = _mm_setzero_pd(), acc1 = _mm_setzero_pd();
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            acc0 = _mm_add_pd(acc0, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+            acc1 = _mm_add_pd(acc1, _mm_mul_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2)));
+        }
+        double lanes[2];
+        _mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+        return lanes[0] + lanes[1] + vec_scalar::dot(a, b, i, n);
+    }
+    MINILANG_TARGET("sse2") static double extreme(const double* a, size_t n, bool want_max) {
+        __m128d best = _mm_set1_pd(a[0]);
+        size_t i = 0;
+        for (; i + 2 <= n; i += 2) {
+            __m128d v = _mm_loadu_pd(a + i);
+            best = want_max ? _mm_max_pd(best, v) : _mm_min_pd(best, v);
+        }
+        double lanes[2];
+        _mm_storeu_pd(lanes, best);
+        double result = want_max ? std::max(lanes[0], lanes[1]) : std::min(lanes[0], lanes[1]);
+        return vec_scalar::extreme(a, i, n, want_max, result);
+    }
+    MINILANG_TARGET("sse2") static void abs(const double* a, double* out, size_t n) {
+        const __m128d sign = _mm_set1_pd(-0.0);
+        size_t i = 0;
+        for (; i + 2 <= n; i += 2) _mm_storeu_pd(out + i, _mm_andnot_pd(sign, _mm_loadu_pd(a + i)));
+        vec_scalar::abs(a, out, i, n);
+    }
+    MINILANG_TARGET("sse2") static void sqrt(const double* a, double* out, size_t n) {
+        size_t i = 0;
+        for (; i + 2 <= n; i += 2) _mm_storeu_pd(out + i, _mm_sqrt_pd(_mm_loadu_pd(a + i)));
+        vec_scalar::sqrt(a, out, i, n);
+    }
+    MINILANG_TARGET("sse2") static void axpy(double* out, const double* x, double alpha, size_t n) {
+        const __m128d va = _mm_set1_pd(alpha);
+        size_t i = 0;
+        for (; i + 2 <= n; i += 2) {
+            _mm_storeu_pd(out + i, _mm_add_pd(_mm_loadu_pd(out + i), _mm_mul_pd(va, _mm_loadu_pd(x + i))));
+        }
+        vec_scalar::axpy(out, x, alpha, i, n);
+    }
+}
+
+namespace vec_avx2 {
+    template <VecOp op>
+    MINILANG_TARGET("avx2") static inline __m256d apply(__m256d a, __m256d b) {
+        if constexpr (op == VecOp::ADD) return _mm256_add_pd(a, b);
+        if constexpr (op == VecOp::SUB) return _mm256_sub_pd(a, b);
+        if constexpr (op == VecOp::MUL) return _mm256_mul_pd(a, b);
+        return _mm256_div_pd(a, b);
+    }
+    template <VecCmp cmp>
+    MINILANG_TARGET("avx2") static inline __m256d compare_reg(__m256d a, __m256d b) {
+        if constexpr (cmp == VecCmp::LT) return _mm256_cmp_pd(a, b, _CMP_LT_OQ);
+        if constexpr (cmp == VecCmp::LE) return _mm256_cmp_pd(a, b, _CMP_LE_OQ);
+        if constexpr (cmp == VecCmp::GT) return _mm256_cmp_pd(a, b, _CMP_GT_OQ);
+        if constexpr (cmp == VecCmp::GE) return _mm256_cmp_pd(a, b, _CMP_GE_OQ);
+        if constexpr (cmp == VecCmp::EQ) return _mm256_cmp_pd(a, b, _CMP_EQ_OQ);
+        return _mm256_cmp_pd(a, b, _CMP_NEQ_UQ);
+    }
+    template <VecOp op>
+    MINILANG_TARGET("avx2") static void binary(const double* a, bool a_scalar, const double* b, bool b_scalar, double* out, size_t n) {
+        const __m256d sa = _mm256_set1_pd(a[0]), sb = _mm256_set1_pd(b[0]);
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            __m256d va = a_scalar ? sa : _mm256_loadu_pd(a + i);
+            __m256d vb = b_scalar ? sb : _mm256_loadu_pd(b + i);
+            _mm256_storeu_pd(out + i, apply<op>(va, vb));
+        }
+        vec_scalar::binary<op>(a, a_scalar, b, b_scalar, out, i, n);
+    }
+    template <VecCmp cmp>
+    MINILANG_TARGET("avx2") static void compare(const double* a, bool a_scalar, const double* b, bool b_scalar, std::int32_t* out, size_t n) {
+        const __m256d sa = _mm256_set1_pd(a[0]), sb = _mm256_set1_pd(b[0]);
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            __m256d va = a_scalar ? sa : _mm256_loadu_pd(a + i);
+            __m256d vb = b_scalar ? sb : _mm256_loadu_pd(b + i);
+            // 比较结果的 64 位全 1 掩码收窄成 32 位后右移得到 0/1
+            __m256i mask = _mm256_castpd_si256(compare_reg<cmp>(va, vb));
+            __m128i narrowed = _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(mask, _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7)));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_srli_epi32(narrowed, 31));
+        }
+        vec_scalar::compare<cmp>(a, a_scalar, b, b_scalar, out, i, n);
+    }
+    MINILANG_TARGET("avx2") static double horizontal_sum(__m256d v) {
+        __m128d pair = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+        return _mm_cvtsd_f64(_mm_add_sd(pair, _mm_unpackhi_pd(pair, pair)));
+    }
+    MINILANG_TARGET("avx2") static double sum(const double* a, size_t n) {
+        __m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            acc0 = _mm256_add_pd(acc0, _mm256_loadu_pd(a + i));
+            acc1 = _mm256_add_pd(acc1, _mm256_loadu_pd(a + i + 4));
+        }
+        return horizontal_sum(_mm256_add_pd(acc0, acc1)) + vec_scalar::sum(a, i, n);
+    }
+    MINILANG_TARGET("avx2") static double dot(const double* a, const double* b, size_t n) {
+        __m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+            acc1 = _mm256_add_pd(acc1, _mm256_mul_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4)));
+        }
+        return horizontal_sum(_mm256_add_pd(acc0, acc1)) + vec_scalar::dot(a, b, i, n);
+    }
+    MINILANG_TARGET("avx2") static double extreme(const double* a, size_t n, bool want_max) {
+        __m256d best = _mm256_set1_pd(a[0]);
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            __m256d v = _mm256_loadu_pd(a + i);
+            best = want_max ? _mm256_max_pd(best, v) : _mm256_min_pd(best, v);
+        }
+        double lanes[4];
+        _mm256_storeu_pd(lanes, best);
+        double result = lanes[0];
+        for (double lane : lanes) result = want_max ? std::max(result, lane) : std::min(result, lane);
+        return vec_scalar::extreme(a, i, n, want_max, result);
+    }
+    MINILANG_TARGET("avx2") static void abs(const double* a, double* out, size_t n) {
+        const __m256d sign = _mm256_set1_pd(-0.0);
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) _mm256_storeu_pd(out + i, _mm256_andnot_pd(sign, _mm256_loadu_pd(a + i)));
+        vec_scalar::abs(a, out, i, n);
+    }
+    MINILANG_TARGET("avx2") static void sqrt(const double* a, double* out, size_t n) {
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) _mm256_storeu_pd(out + i, _mm256_sqrt_pd(_mm256_loadu_pd(a + i)));
+        vec_scalar::sqrt(a, out, i, n);
+    }
+    MINILANG_TARGET("avx2") static void axpy(double* out, const double* x, double alpha, size_t n) {
+        const __m256d va = _mm256_set1_pd(alpha);
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            __m256d o0 = _mm256_add_pd(_mm256_loadu_pd(out + i), _mm256_mul_pd(va, _mm256_loadu_pd(x + i)));
+            __m256d o1 = _mm256_add_pd(_mm256_loadu_pd(out + i + 4), _mm256_mul_pd(va, _mm256_loadu_pd(x + i + 4)));
+            _mm256_storeu_pd(out + i, o0);
+            _mm256_storeu_pd(out + i + 4, o1);
+        }
+        vec_scalar::axpy(out, x, alpha, i, n);
+    }
+}
+#endif
+
+template <VecOp op>
+static void f64_binary(const double* a, bool a_scalar, const double* b, bool b_scalar, double* out, size_t n) {
+#ifdef MINILANG_X86_SIMD
+    if (simd_level == SimdLevel::AVX2) return vec_avx2::binary<op>(a, a_scalar, b, b_scalar, out, n);
+    if (simd_level == SimdLevel::SSE2) return vec_sse2::binary<op>(a, a_scalar, b, b_scalar, out, n);
+#endif
+    vec_scalar::binary<op>(a, a_scalar, b, b_scalar, out, 0, n);
+}
+
+template <VecCmp cmp>
+static void f64_compare(const double* a, bool a_scalar, const double* b, bool b_scalar, std::int32_t* out, size_t n) {
+#ifdef MINILANG_X86_SIMD
+    if (simd_level == SimdLevel::AVX2) return vec_avx2::compare<cmp>(a, a_scalar, b, b_scalar, out, n);
+    if (simd_level == SimdLevel::SSE2) return vec_sse2::compare<cmp>(a, a_scalar, b, b_scalar, out, n);
+#endif
+    vec_scalar::compare<cmp>(a, a_scalar, b, b_scalar, out, 0, n);
+}
+
+static double f64_sum(const double* a, size_t n) {
+#ifdef MINILANG_X86_SIMD
+    if (simd_level == SimdLevel::AVX2) return vec_avx2::sum(a, n);
+    if (simd_level == SimdLevel::SSE2) return vec_sse2::sum(a, n);
+#endif
+    return vec_scalar::sum(a, 0, n);
+}
+
+static double f64_dot(const double* a, const double* b, size_t n) {
+#ifdef MINILANG_X86_SIMD
+    if (simd_level == SimdLevel::AVX2) return vec_avx2::dot(a, b, n);
+    if (simd_level == SimdLevel::SSE2) return vec_sse2::dot(a, b, n);
+#endif
+    return vec_scalar::dot(a, b, 0, n);
+}
+
+static double f64_extreme(const double* a, size_t n, bool want_max) {
+#ifdef MINILANG_X86_SIMD
+    if (simd_level == SimdLevel::AVX2) return vec_avx2::extreme(a, n, want_max);
+    if (simd_level == SimdLevel::SSE2) return vec_sse2::extreme(a, n, want_max);
+#endif
+    return vec_scalar::extreme(a, 0, n, want_max, a[0]);
+}
+
+static void f64_abs(const double* a, double* out, size_t n) {
+#ifdef MINILANG_X86_SIMD
+    if (simd_level == SimdLevel::AVX2) return vec_avx2::abs(a, out, n);
+    if (simd_level == SimdLevel::SSE2) return vec_sse2::abs(a, out, n);
+#endif
+    vec_scalar::abs(a, out, 0, n);
+}
+
+static void f64_sqrt(const double* a, double* out, size_t n) {
+#ifdef MINILANG_X86_SIMD
+    if (simd_level == SimdLevel::AVX2) return vec_avx2::sqrt(a, out, n);
+    if (simd_level == SimdLevel::SSE2) return vec_sse2::sqrt(a, out, n);
+#endif
+    vec_scalar::sqrt(a, out, 0, n);
+}
+
+static void f64_axpy(double* out, const double* x, double alpha, size_t n) {
+#ifdef MINILANG_X86_SIMD
+    if (simd_level == SimdLevel::AVX2) return vec_avx2::axpy(out, x, alpha, n);
+    if (simd_level == SimdLevel::SSE2) return vec_sse2::axpy(out, x, alpha, n);
+#endif
+    vec_scalar::axpy(out, x, alpha, 0, n);
+}
+
+// vec 函数的一个操作数：标量、类型化数组（直接借用其存储）或同类数值数组（拷贝一次）
+struct NumericOperand {
+    bool is_scalar = false;
+    bool is_int = false;
+    size_t size = 1;
+    std::int32_t scalar_i32 = 0;
+    double scalar_f64 = 0.0;
+    const std::int32_t* borrowed_i32 = nullptr;
+    const double* borrowed_f64 = nullptr;
+    std::vector<std::int32_t> i32_storage;
+    std::vector<double> f64_storage;
+    Value keep_alive;
+
+    // 数据指针每次按当前对象计算，所以按值返回或复制之后仍然有效
+    const std::int32_t* i32() const {
+        if (is_scalar) return &scalar_i32;
+        return borrowed_i32 ? borrowed_i32 : i32_storage.data();
+    }
+    const double* f64() const {
+        if (is_scalar) return &scalar_f64;
+        return borrowed_f64 ? borrowed_f64 : f64_storage.data();
+    }
+
+    // 需要浮点运算时把整数数据转换一次
+    const double* asF64() {
+        if (is_int) {
+            if (is_scalar) scalar_f64 = scalar_i32;
+            else f64_storage.assign(i32(), i32() + size);
+        }
+        return f64();
+    }
+};
+
+static NumericOperand numeric_operand(const Value& v, const std::string& fn) {
+    NumericOperand op;
+    op.keep_alive = v;
+    if (v.is<int>()) {
+        op.is_scalar = op.is_int = true;
+        op.scalar_i32 = v.as<int>();
+        return op;
+    }
+    if (v.is<double>()) {
+        op.is_scalar = true;
+        op.scalar_f64 = v.as<double>();
+        return op;
+    }
+    if (v.is<Value::NativeType>()) {
+        if (auto* arr = dynamic_cast<Float64ArrayValue*>(v.as<Value::NativeType>().get())) {
+            op.borrowed_f64 = arr->data.data();
+            op.size = arr->data.size();
+            return op;
+        }
+        if (auto* arr = dynamic_cast<Int32ArrayValue*>(v.as<Value::NativeType>().get())) {
+            op.is_int = true;
+            op.borrowed_i32 = arr->data.data();
+            op.size = arr->data.size();
+            return op;
+        }
+        // 其他数值序列（range、矩阵视图等）拷贝成连续的 double
+        if (auto it = v.as<Value::NativeType>()->iter()) {
+            Value element;
+            while (it->next(element)) op.f64_storage.push_back(TypedArrayTraits<double>::fromValue(element));
+            op.size = op.f64_storage.size();
+            return op;
+        }
+    }
+    if (v.is<Value::ArrayType>()) {
+        const auto& vec = v.as<Value::ArrayType>()->elements;
+        op.size = vec.size();
+        ElementKind kind = classify_elements(vec.begin(), vec.end());
+        if (kind == ElementKind::INT || kind == ElementKind::EMPTY) {
+            op.is_int = true;
+            op.i32_storage.reserve(vec.size());
+            for (const auto& e : vec) op.i32_storage.push_back(*std::get_if<int>(&e.getVariant()));
+            return op;
+        }
+        op.f64_storage.reserve(vec.size());
+        for (const auto& e : vec) {
+            if (e.is<double>()) op.f64_storage.push_back(e.as<double>());
+            else if (e.is<int>()) op.f64_storage.push_back(e.as<int>());
+            else throw std::runtime_error("vec." + fn + "() requires arrays of numbers.");
+        }
+        return op;
+    }
+    throw std::runtime_error("vec." + fn + "() arguments must be numbers, numeric arrays, Int32Array or Float64Array.");
+}
+
+static size_t broadcast_size(const NumericOperand& a, const NumericOperand& b, const std::string& fn) {
+    if (a.is_scalar && b.is_scalar) throw std::runtime_error("vec." + fn + "() requires at least one array argument.");
+    if (!a.is_scalar && !b.is_scalar && a.size != b.size) {
+        throw std::runtime_error("vec." + fn + "() arrays must have the same length.");
+    }
+    return a.is_scalar ? b.size : a.size;
+}
+
+template <typename T>
+static Value typed_array_value(std::vector<T> data) {
+    return Value(std::static_pointer_cast<NativeObject>(std::make_shared<TypedArrayValue<T>>(std::move(data))));
+}
+
+template <VecOp op>
+static Value vec_binary(const std::vector<Value>& args, const std::string& fn) {
+    NumericOperand a = numeric_operand(args[0], fn), b = numeric_operand(args[1], fn);
+    size_t n = broadcast_size(a, b, fn);
+    if (a.is_int && b.is_int && op != VecOp::DIV) {
+        // 在 64 位中计算；任一结果超出 int32 时整体改为 Float64Array，而不是溢出回绕
+        const std::int32_t* ai = a.i32();
+        const std::int32_t* bi = b.i32();
+        std::vector<std::int32_t> out(n);
+        for (size_t i = 0; i < n; ++i) {
+            std::int64_t l = ai[a.is_scalar ? 0 : i], r = bi[b.is_scalar ? 0 : i];
+            std::int64_t x = op == VecOp::ADD ? l + r : op == VecOp::SUB ? l - r : l * r;
+            if (x < INT32_MIN || x > INT32_MAX) {
+                std::vector<double> wide(out.begin(), out.begin() + i);
+                wide.reserve(n);
+                for (; i < n; ++i) {
+                    l = ai[a.is_scalar ? 0 : i];
+                    r = bi[b.is_scalar ? 0 : i];
+                    wide.push_back(static_cast<double>(op == VecOp::ADD ? l + r : op == VecOp::SUB ? l - r : l * r));
+                }
+                return typed_array_value(std::move(wide));
+            }
+            out[i] = static_cast<std::int32_t>(x);
+        }
+        return typed_array_value(std::move(out));
+    }
+    std::vector<double> out(n);
+    if (n > 0) f64_binary<op>(a.asF64(), a.is_scalar, b.asF64(), b.is_scalar, out.data(), n);
+    return typed_array_value(std::move(out));
+}
+
+template <VecCmp cmp>
+static Value vec_comparison(const std::vector<Value>& args, const std::string& fn) {
+    NumericOperand a = numeric_operand(args[0], fn), b = numeric_operand(args[1], fn);
+    size_t n = broadcast_size(a, b, fn);
+    std::vector<std::int32_t> mask(n);
+    if (a.is_int && b.is_int) {
+        const std::int32_t* ai = a.i32();
+        const std::int32_t* bi = b.i32();
+        for (size_t i = 0; i < n; ++i) mask[i] = vec_compare<cmp>(ai[a.is_scalar ? 0 : i], bi[b.is_scalar ? 0 : i]);
+    } else if (n > 0) {
+        f64_compare<cmp>(a.asF64(), a.is_scalar, b.asF64(), b.is_scalar, mask.data(), n);
+    }
+    return typed_array_value(std::move(mask));
+}
+
+static NumericOperand vec_array_operand(const Value& v, const std::string& fn) {
+    NumericOperand op = numeric_operand(v, fn);
+    if (op.is_scalar) throw std::runtime_error("vec." + fn + "() requires an array argument.");
+    return op;
+}
+
+static Value vec_sum(const Value& v) {
+    NumericOperand a = vec_array_operand(v, "sum");
+    if (a.is_int) {
+        long long s = 0;
+        for (size_t i = 0; i < a.size; ++i) s += a.i32()[i];
+        return integral_result(s);
+    }
+    return Value(f64_sum(a.f64(), a.size));
+}
+
+// ---- 矩阵 (Matrix) ----
+// 行主序的稠密 double 矩阵；m[i] 与 m.row(i)/m.col(j) 返回共享存储的视图
+class MatrixValue final : public NativeObject {
+public:
+    size_t rows = 0, cols = 0;
+    std::vector<double> data;
+
+    MatrixValue(size_t r, size_t c) : rows(r), cols(c), data(r * c, 0.0) {}
+
+    std::string typeName() const override { return "Matrix"; }
+    std::string toString() const override {
+        std::string result = "Matrix([";
+        for (size_t i = 0; i < rows; ++i) {
+            if (i > 0) result += ", ";
+            result += "[";
+            for (size_t j = 0; j < cols; ++j) {
+                if (j > 0) result += ", ";
+                result += Value(data[i * cols + j]).toString();
+            }
+            result += "]";
+        }
+        return result + "])";
+    }
+    bool toBool() const override { return !data.empty(); }
+    int length() const override { return static_cast<int>(rows); }
+
+    size_t checkedRow(const Value& index) const {
+        if (!index.is<int>()) throw std::runtime_error("Matrix row index must be an integer.");
+        int i = index.as<int>();
+        if (i < 0 || i >= static_cast<int>(rows)) throw std::runtime_error("Matrix row index out of bounds");
+        return static_cast<size_t>(i);
+    }
+    size_t checkedCol(const Value& index) const {
+        if (!index.is<int>()) throw std::runtime_error("Matrix column index must be an integer.");
+        int j = index.as<int>();
+        if (j < 0 || j >= static_cast<int>(cols)) throw std::runtime_error("Matrix column index out of bounds");
+        return static_cast<size_t>(j);
+    }
+
+    Value rowView(size_t i);
+    Value colView(size_t j);
+    Value getIndex(const Value& index) override { return rowView(checkedRow(index)); }
+    std::unique_ptr<Iterator> iter() override;
+    Value getMember(const std::string& name) override;
+    std::shared_ptr<ArrayValue> toArray() override {
+        auto arr = std::make_shared<ArrayValue>();
+        arr->elements.reserve(rows);
+        for (size_t i = 0; i < rows; ++i) {
+            auto row = std::make_shared<ArrayValue>();
+            row->elements.assign(data.begin() + i * cols, data.begin() + (i + 1) * cols);
+            arr->elements.emplace_back(row);
+        }
+        return arr;
+    }
+    std::shared_ptr<NativeObject> clone() const override { return std::make_shared<MatrixValue>(*this); }
+};
+
+// 矩阵的一行或一列：offset/stride 描述元素位置，读写直接作用于原矩阵
+class MatrixVectorView final : public NativeObject {
+    std::shared_ptr<MatrixValue> matrix;
+    size_t offset, stride, count;
+public:
+    MatrixVectorView(std::shared_ptr<MatrixValue> m, size_t off, size_t st, size_t n)
+        : matrix(std::move(m)), offset(off), stride(st), count(n) {}
+
+    std::string typeName() const override { return "MatrixView"; }
+    std::string toString() const override { return "MatrixView(" + Value(copyElements()).toString() + ")"; }
+    bool toBool() const override { return count > 0; }
+    int length() const override { return static_cast<int>(count); }
+
+    double& at(size_t i) { return matrix->data[offset + i * stride]; }
+    size_t checkedIndex(const Value& index) const {
+        if (!index.is<int>()) throw std::runtime_error("MatrixView index must be an integer.");
+        int i = index.as<int>();
+        if (i < 0 || i >= static_cast<int>(count)) throw std::runtime_error("MatrixView index out of bounds");
+        return static_cast<size_t>(i);
+    }
+    Value getIndex(const Value& index) override { return Value(at(checkedIndex(index))); }
+    void setIndex(const Value& index, const Value& value) override {
+        at(checkedIndex(index)) = TypedArrayTraits<double>::fromValue(value);
+    }
+    std::unique_ptr<Iterator> iter() override;
+    std::shared_ptr<ArrayValue> toArray() override { return copyElements(); }
+
+private:
+    std::shared_ptr<ArrayValue> copyElements() const {
+        auto arr = std::make_shared<ArrayValue>();
+        arr->elements.reserve(count);
+        for (size_t i = 0; i < count; ++i) arr->elements.emplace_back(matrix->data[offset + i * stride]);
+        return arr;
+    }
+};
+
+class MatrixViewIterator final : public Iterator {
+    std::shared_ptr<MatrixVectorView> view;
+    size_t pos = 0;
+public:
+    explicit MatrixViewIterator(std::shared_ptr<MatrixVectorView> v) : view(std::move(v)) {}
+    bool next(Value& out) override {
+        if (pos >= static_cast<size_t>(view->length())) return false;
+        out = Value(view->at(pos++));
+        return true;
+    }
+};
+
+std::unique_ptr<Iterator> MatrixVectorView::iter() {
+    return std::make_unique<MatrixViewIterator>(std::static_pointer_cast<MatrixVectorView>(shared_from_this()));
+}
+
+Value MatrixValue::rowView(size_t i) {
+    auto self = std::static_pointer_cast<MatrixValue>(shared_from_this());
+    return Value(std::static_pointer_cast<NativeObject>(std::make_shared<MatrixVectorView>(self, i * cols, 1, cols)));
+}
+
+Value MatrixValue::colView(size_t j) {
+    auto self = std::static_pointer_cast<MatrixValue>(shared_from_this());
+    return Value(std::static_pointer_cast<NativeObject>(std::make_shared<MatrixVectorView>(self, j, cols, rows)));
+}
+
+class MatrixRowIterator final : public Iterator {
+    std::shared_ptr<MatrixValue> matrix;
+    size_t row = 0;
+public:
+    explicit MatrixRowIterator(std::shared_ptr<MatrixValue> m) : matrix(std::move(m)) {}
+    bool next(Value& out) override {
+        if (row >= matrix->rows) return false;
+        out = matrix->rowView(row++);
+        return true;
+    }
+};
+
+std::unique_ptr<Iterator> MatrixValue::iter() {
+    return std::make_unique<MatrixRowIterator>(std::static_pointer_cast<MatrixValue>(shared_from_this()));
+}
+
+// C = A * B。按块遍历 i/k/j，使 B 的一个块和 C 的一行片段留在缓存中；
+// 最内层是对 C 的一行做 axpy，由 SIMD 内核完成
+static std::shared_ptr<MatrixValue> matrix_multiply(const MatrixValue& a, const MatrixValue& b) {
+    if (a.cols != b.rows) {
+        throw std::runtime_error("Matrix dimensions do not match for multiplication: " + std::to_string(a.rows) + "x" +
+                                 std::to_string(a.cols) + " * " + std::to_string(b.rows) + "x" + std::to_string(b.cols) + ".");
+    }
+    constexpr size_t BLOCK_I = 64, BLOCK_K = 128, BLOCK_J = 256;
+    const size_t n = a.rows, k = a.cols, m = b.cols;
+    auto c = std::make_shared<MatrixValue>(n, m);
+    for (size_t i0 = 0; i0 < n; i0 += BLOCK_I) {
+        const size_t i1 = std::min(i0 + BLOCK_I, n);
+        for (size_t k0 = 0; k0 < k; k0 += BLOCK_K) {
+            const size_t k1 = std::min(k0 + BLOCK_K, k);
+            for (size_t j0 = 0; j0 < m; j0 += BLOCK_J) {
+                const size_t width = std::min(j0 + BLOCK_J, m) - j0;
+                for (size_t i = i0; i < i1; ++i) {
+                    double* c_row = c->data.data() + i * m + j0;
+                    for (size_t kk = k0; kk < k1; ++kk) {
+                        f64_axpy(c_row, b.data.data() + kk * m + j0, a.data[i * k + kk], width);
+                    }
+                }
+            }
+        }
+    }
+    return c;
+}
+
+// 分块转置，读写都保持在一个小方块内
+static std::shared_ptr<MatrixValue> matrix_transpose(const MatrixValue& a) {
+    constexpr size_t TILE = 32;
+    auto t = std::make_shared<MatrixValue>(a.cols, a.rows);
+    for (size_t i0 = 0; i0 < a.rows; i0 += TILE) {
+        for (size_t j0 = 0; j0 < a.cols; j0 += TILE) {
+            const size_t i1 = std::min(i0 + TILE, a.rows), j1 = std::min(j0 + TILE, a.cols);
+            for (size_t i = i0; i < i1; ++i) {
+                for (size_t j = j0; j < j1; ++j) t->data[j * a.rows + i] = a.data[i * a.cols + j];
+            }
+        }
+    }
+    return t;
+}
+
+static std::shared_ptr<MatrixValue> as_matrix(const Value& v, const std::string& what) {
+    if (v.is<Value::NativeType>()) {
+        if (auto m = std::dynamic_pointer_cast<MatrixValue>(v.as<Value::NativeType>())) return m;
+    }
+    throw std::runtime_error(what + " must be a Matrix.");
+}
+
+// Matrix(rows, cols) 创建全 0 矩阵；Matrix(arr) 从等长数值数组组成的数组构造
+static std::shared_ptr<MatrixValue> make_matrix(const std::vector<Value>& args) {
+    if (args.size() == 2) {
+        if (!args[0].is<int>() || !args[1].is<int>() || args[0].as<int>() < 0 || args[1].as<int>() < 0) {
+            throw std::runtime_error("Matrix dimensions must be non-negative integers.");
+        }
+        return std::make_shared<MatrixValue>(args[0].as<int>(), args[1].as<int>());
+    }
+    if (args.size() != 1 || !args[0].is<Value::ArrayType>()) {
+        throw std::runtime_error("Matrix() takes (rows, cols) or an array of rows.");
+    }
+    const auto& rows = args[0].as<Value::ArrayType>()->elements;
+    size_t cols = 0;
+    if (!rows.empty()) {
+        if (!rows[0].is<Value::ArrayType>()) throw std::runtime_error("Matrix rows must be arrays.");
+        cols = rows[0].as<Value::ArrayType>()->elements.size();
+    }
+    auto m = std::make_shared<MatrixValue>(rows.size(), cols);
+    for (size_t i = 0; i < rows.size(); ++i) {
+        if (!rows[i].is<Value::ArrayType>()) throw std::runtime_error("Matrix rows must be arrays.");
+        const auto& row = rows[i].as<Value::ArrayType>()->elements;
+        if (row.size() != cols) throw std::runtime_error("All Matrix rows must have the same length.");
+        for (size_t j = 0; j < cols; ++j) m->data[i * cols + j] = TypedArrayTraits<double>::fromValue(row[j]);
+    }
+    return m;
+}
+
+Value MatrixValue::getMember(const std::string& name) {
+    auto self = std::static_pointer_cast<MatrixValue>(shared_from_this());
+    if (name == "rows") return Value(static_cast<int>(rows));
+    if (name == "cols") return Value(static_cast<int>(cols));
+    if (name == "get") {
+        return native_method(name, 2, [self](const std::vector<Value>& args) -> Value {
+            return Value(self->data[self->checkedRow(args[0]) * self->cols + self->checkedCol(args[1])]);
+        });
+    }
+    if (name == "set") {
+        return native_method(name, 3, [self](const std::vector<Value>& args) -> Value {
+            self->data[self->checkedRow(args[0]) * self->cols + self->checkedCol(args[1])] = TypedArrayTraits<double>::fromValue(args[2]);
+            return Value();
+        });
+    }
+    if (name == "row") {
+        return native_method(name, 1, [self](const std::vector<Value>& args) { return self->rowView(self->checkedRow(args[0])); });
+    }
+    if (name == "col") {
+        return native_method(name, 1, [self](const std::vector<Value>& args) { return self->colView(self->checkedCol(args[0])); });
+    }
+    if (name == "transpose") {
+        return native_method(name, 0, [self](const std::vector<Value>&) {
+            return Value(std::static_pointer_cast<NativeObject>(matrix_transpose(*self)));
+        });
+    }
+    if (name == "matmul") {
+        return native_method(name, 1, [self](const std::vector<Value>& args) {
+            return Value(std::static_pointer_cast<NativeObject>(matrix_multiply(*self, *as_matrix(args[0], "Argument to matmul"))));
+        });
+    }
+    if (name == "to_array") {
+        return native_method(name, 0, [self](const std::vector<Value>&) { return Value(self->toArray()); });
+    }
+    return NativeObject::getMember(name);
+}
+
+// ---- 双端队列与优先队列 (Deque / PriorityQueue) ----
+
+// 环形缓冲区：容量为 2 的幂，两端的 push/pop 都是 O(1)，下标访问也是 O(1)
+class DequeValue final : public NativeObject {
+    std::vector<Value> buffer; // 未使用的槽位保持为 nil，不持有引用
+    size_t head = 0, count = 0;
+
+    size_t slot(size_t i) const { return (head + i) & (buffer.size() - 1); }
+    void grow() {
+        std::vector<Value> bigger(std::max<size_t>(8, buffer.size() * 2));
+        for (size_t i = 0; i < count; ++i) bigger[i] = std::move(buffer[slot(i)]);
+        buffer = std::move(bigger);
+        head = 0;
+    }
+    size_t checkedIndex(const Value& index) const {
+        if (!index.is<int>()) throw std::runtime_error("Deque index must be an integer.");
+        int i = index.as<int>();
+        if (i < 0 || i >= static_cast<int>(count)) throw std::runtime_error("Deque index out of bounds");
+        return static_cast<size_t>(i);
+    }
+    void requireNonEmpty(const std::string& op) const {
+        if (count == 0) throw std::runtime_error("Deque." + op + "() on an empty Deque.");
+    }
+
+public:
+    std::string typeName() const override { return "Deque"; }
+    std::string toString() const override {
+        std::string result = "Deque([";
+        for (size_t i = 0; i < count; ++i) {
+            if (i > 0) result += ", ";
+            result += at(i).toString();
+        }
+        return result + "])";
+    }
+    bool toBool() const override { return count > 0; }
+    int length() const override { return static_cast<int>(count); }
+    Value getIndex(const Value& index) override { return buffer[slot(checkedIndex(index))]; }
+    void setIndex(const Value& index, const Value& value) override { buffer[slot(checkedIndex(index))] = value; }
+    std::unique_ptr<Iterator> iter() override;
+    Value getMember(const std::string& name) override;
+    std::shared_ptr<ArrayValue> toArray() override {
+        auto arr = std::make_shared<ArrayValue>();
+        arr->elements.reserve(count);
+        for (size_t i = 0; i < count; ++i) arr->elements.push_back(buffer[slot(i)]);
+        return arr;
+    }
+    std::shared_ptr<NativeObject> clone() const override { return std::make_shared<DequeValue>(*this); }
+    void forEachValue(const std::function<void(Value&)>& fn) override {
+        for (size_t i = 0; i < count; ++i) fn(buffer[slot(i)]);
+    }
+
+    const Value& at(size_t i) const { return buffer[slot(i)]; }
+    void pushBack(Value v) {
+        if (count == buffer.size()) grow();
+        buffer[slot(count)] = std::move(v);
+        ++count;
+    }
+    void pushFront(Value v) {
+        if (count == buffer.size()) grow();
+        head = (head + buffer.size() - 1) & (buffer.size() - 1);
+        buffer[head] = std::move(v);
+        ++count;
+    }
+    Value popFront() {
+        requireNonEmpty("pop_front");
+        Value v = std::move(buffer[head]);
+        buffer[head] = Value();
+        head = (head + 1) & (buffer.size() - 1);
+        --count;
+        return v;
+    }
+    Value popBack() {
+        requireNonEmpty("pop_back");
+        size_t last = slot(count - 1);
+        Value v = std::move(buffer[last]);
+        buffer[last] = Value();
+        --count;
+        return v;
+    }
+    void clear() {
+        buffer.clear();
+        head = count = 0;
+    }
+};
+
+class DequeIterator final : public Iterator {
+    std::shared_ptr<DequeValue> deque;
+    size_t pos = 0;
+    const int expected_size;
+public:
+    explicit DequeIterator(std::shared_ptr<DequeValue> d) : deque(std::move(d)), expected_size(deque->length()) {}
+    bool next(Value& out) override {
+        if (deque->length() != expected_size) throw std::runtime_error("Container changed size during iteration.");
+        if (pos >= static_cast<size_t>(expected_size)) return false;
+        out = deque->at(pos++);
+        return true;
+    }
+};
+
+std::unique_ptr<Iterator> DequeValue::iter() {
+    return std::make_unique<DequeIterator>(std::static_pointer_cast<DequeValue>(shared_from_this()));
+}
+
+Value DequeValue::getMember(const std::string& name) {
+    auto self = std::static_pointer_cast<DequeValue>(shared_from_this());
+    if (name == "push_back" || name == "push_front") {
+        const bool back = name == "push_back";
+        return native_method(name, 1, [self, back](const std::vector<Value>& args) -> Value {
+            back ? self->pushBack(args[0]) : self->pushFront(args[0]);
+            return Value();
+        });
+    }
+    if (name == "pop_back") {
+        return native_method(name, 0, [self](const std::vector<Value>&) { return self->popBack(); });
+    }
+    if (name == "pop_front") {
+        return native_method(name, 0, [self](const std::vector<Value>&) { return self->popFront(); });
+    }
+    if (name == "front" || name == "back") {
+        const bool back = name == "back";
+        return native_method(name, 0, [self, back, name](const std::vector<Value>&) -> Value {
+            self->requireNonEmpty(name);
+            return self->at(back ? self->count - 1 : 0);
+        });
+    }
+    if (name == "clear") {
+        return native_method(name, 0, [self](const std::vector<Value>&) -> Value {
+            self->clear();
+            return Value();
+        });
+    }
+    if (name == "to_array") {
+        return native_method(name, 0, [self](const std::vector<Value>&) { return Value(self->toArray()); });
+    }
+    return NativeObject::getMember(name);
+}
+
+// 二叉小顶堆。每个元素的优先级在 push 时计算一次（有 key 函数时为 key(x)，否则为 x 本身）；
+// 优先级相同的元素按插入顺序出队
+class PriorityQueueValue final : public NativeObject {
+public:
+    struct Item {
+        Value key;
+        std::uint64_t seq;
+        Value value;
+    };
+    // 用于 std::push_heap/pop_heap：返回 true 表示 a 应排在 b 之后
+    static bool later(const Item& a, const Item& b) {
+        int c = compare_values(a.key, b.key);
+        return c != 0 ? c > 0 : a.seq > b.seq;
+    }
+
+    std::vector<Item> heap;
+    Value::FuncType key_fn;
+    std::uint64_t next_seq = 0;
+
+    explicit PriorityQueueValue(Value::FuncType fn) : key_fn(std::move(fn)) {}
+
+    std::string typeName() const override { return "PriorityQueue"; }
+    std::string toString() const override { return "PriorityQueue(" + std::to_string(heap.size()) + " items)"; }
+    bool toBool() const override { return !heap.empty(); }
+    int length() const override { return static_cast<int>(heap.size()); }
+    std::unique_ptr<Iterator> iter() override;
+    Value getMember(const std::string& name) override;
+    std::shared_ptr<NativeObject> clone() const override { return std::make_shared<PriorityQueueValue>(*this); }
+    // 只替换元素本身；优先级是数字或字符串，不需要复制
+    void forEachValue(const std::function<void(Value&)>& fn) override {
+        for (auto& item : heap) fn(item.value);
+    }
+
+    void push(Value v) {
+        Value key = key_fn ? key_fn->call({v}) : v;
+        // 堆中已有的优先级两两可比，只需与堆顶比较一次即可在修改堆之前发现不可比较的类型
+        if (!heap.empty()) compare_values(key, heap.front().key);
+        heap.push_back({std::move(key), next_seq++, std::move(v)});
+        std::push_heap(heap.begin(), heap.end(), later);
+    }
+    Value pop() {
+        if (heap.empty()) throw std::runtime_error("PriorityQueue.pop() on an empty PriorityQueue.");
+        std::pop_heap(heap.begin(), heap.end(), later);
+        Value top = std::move(heap.back().value);
+        heap.pop_back();
+        return top;
+    }
+};
+
+// 按优先级顺序遍历但不消耗队列：遍历开始时复制一份堆，之后每一步从副本中弹出一个元素
+class PriorityQueueIterator final : public Iterator {
+    std::vector<PriorityQueueValue::Item> heap;
+public:
+    explicit PriorityQueueIterator(const PriorityQueueValue& q) : heap(q.heap) {}
+    bool next(Value& out) override {
+        if (heap.empty()) return false;
+        std::pop_heap(heap.begin(), heap.end(), PriorityQueueValue::later);
+        out = std::move(heap.back().value);
+        heap.pop_back();
+        return true;
+    }
+};
+
+std::unique_ptr<Iterator> PriorityQueueValue::iter() {
+    return std::make_unique<PriorityQueueIterator>(*this);
+}
+
+Value PriorityQueueValue::getMember(const std::string& name) {
+    auto self = std::static_pointer_cast<PriorityQueueValue>(shared_from_this());
+    if (name == "push") {
+        return native_method(name, 1, [self](const std::vector<Value>& args) -> Value {
+            self->push(args[0]);
+            return Value();
+        });
+    }
+    if (name == "pop") {
+        return native_method(name, 0, [self](const std::vector<Value>&) { return self->pop(); });
+    }
+    if (name == "peek") {
+        return native_method(name, 0, [self](const std::vector<Value>&) -> Value {
+            if (self->heap.empty()) throw std::runtime_error("PriorityQueue.peek() on an empty PriorityQueue.");
+            return self->heap.front().value;
+        });
+    }
+    if (name == "clear") {
+        return native_method(name, 0, [self](const std::vector<Value>&) -> Value {
+            self->heap.clear();
+            return Value();
+        });
+    }
+    if (name == "to_array") {
+        return native_method(name, 0, [self](const std::vector<Value>&) { return Value(self->toArray()); });
+    }
+    return NativeObject::getMember(name);
+}
+
+// ---- 有序映射 (SortedMap) ----
+
+// B+ 树：键值只存放在叶子中，叶子之间双向链接，区间遍历和 floor/ceiling 不需要回溯。
+// 每个节点最多 64 个键，节点内的键连续存放并用二分查找。键必须是数字或字符串（按 compare_values 排序）
+class SortedMapValue final : public NativeObject {
+public:
+    static constexpr size_t MAX_KEYS = 64;
+    static constexpr size_t MIN_KEYS = MAX_KEYS / 2;
+
+    struct Node {
+        bool leaf;
+        std::vector<Value> keys;
+        std::vector<Value> values;                   // 仅叶子
+        std::vector<std::unique_ptr<Node>> children; // 仅内部节点，children.size() == keys.size() + 1
+        Node* prev = nullptr;                        // 叶子链表
+        Node* next = nullptr;
+        explicit Node(bool is_leaf) : leaf(is_leaf) {}
+    };
+
+    std::unique_ptr<Node> root = std::make_unique<Node>(true);
+    size_t count = 0;
+    std::uint64_t version = 0; // 插入新键或删除键时递增，用于检测遍历期间的修改
+
+    SortedMapValue() = default;
+    SortedMapValue(const SortedMapValue& other) : NativeObject(), count(other.count) {
+        Node* last_leaf = nullptr;
+        root = copyNode(*other.root, last_leaf);
+    }
+
+    std::string typeName() const override { return "SortedMap"; }
+    std::string toString() const override {
+        std::string result = "SortedMap{";
+        bool first = true;
+        for (const Node* leaf = firstLeaf(); leaf; leaf = leaf->next) {
+            for (size_t i = 0; i < leaf->keys.size(); ++i) {
+                if (!first) result += ", ";
+                result += leaf->keys[i].toString() + ": " + leaf->values[i].toString();
+                first = false;
+            }
+        }
+        return result + "}";
+    }
+    bool toBool() const override { return count > 0; }
+    int length() const override { return static_cast<int>(count); }
+    Value getIndex(const Value& key) override {
+        if (const Value* v = find(key)) return *v;
+        throw std::runtime_error("Key '" + key.toString() + "' not found in SortedMap.");
+    }
+    void setIndex(const Value& key, const Value& value) override { put(key, value); }
+    std::unique_ptr<Iterator> iter() override;
+    Value getMember(const std::string& name) override;
+    std::shared_ptr<NativeObject> clone() const override { return std::make_shared<SortedMapValue>(*this); }
+    void forEachValue(const std::function<void(Value&)>& fn) override {
+        Node* leaf = root.get();
+        while (!leaf->leaf) leaf = leaf->children.front().get();
+        for (; leaf; leaf = leaf->next) {
+            for (auto& v : leaf->values) fn(v);
+        }
+    }
+
+    static void checkKey(const Value& key) {
+        if (key.is<int>() || key.is<StringData>()) return;
+        if (key.is<double>() && !std::isnan(key.as<double>())) return;
+        throw std::runtime_error("SortedMap keys must be numbers or strings, got '" + value_type_name(key) + "'.");
+    }
+    static size_t lowerBound(const std::vector<Value>& keys, const Value& key) {
+        return std::lower_bound(keys.begin(), keys.end(), key,
+                                [](const Value& a, const Value& b) { return compare_values(a, b) < 0; }) - keys.begin();
+    }
+    static size_t upperBound(const std::vector<Value>& keys, const Value& key) {
+        return std::upper_bound(keys.begin(), keys.end(), key,
+                                [](const Value& a, const Value& b) { return compare_values(a, b) < 0; }) - keys.begin();
+    }
+
+    const Node* firstLeaf() const {
+        const Node* n = root.get();
+        while (!n->leaf) n = n->children.front().get();
+        return n;
+    }
+    const Node* lastLeaf() const {
+        const Node* n = root.get();
+        while (!n->leaf) n = n->children.back().get();
+        return n;
+    }
+    // 返回可能包含 key 的叶子
+    const Node* leafFor(const Value& key) const {
+        const Node* n = root.get();
+        while (!n->leaf) n = n->children[upperBound(n->keys, key)].get();
+        return n;
+    }
+
+    const Value* find(const Value& key) const {
+        checkKey(key);
+        const Node* leaf = leafFor(key);
+        size_t pos = lowerBound(leaf->keys, key);
+        if (pos < leaf->keys.size() && compare_values(leaf->keys[pos], key) == 0) return &leaf->values[pos];
+        return nullptr;
+    }
+
+    void put(const Value& key, const Value& value) {
+        checkKey(key);
+        bool inserted = false;
+        if (auto split = insert(root.get(), key, value, inserted)) {
+            auto new_root = std::make_unique<Node>(false);
+            new_root->keys.push_back(std::move(split->first));
+            new_root->children.push_back(std::move(root));
+            new_root->children.push_back(std::move(split->second));
+            root = std::move(new_root);
+        }
+        if (inserted) {
+            ++count;
+            ++version;
+        }
+    }
+
+    bool erase(const Value& key) {
+        checkKey(key);
+        if (!eraseFrom(root.get(), key)) return false;
+        if (!root->leaf && root->keys.empty()) root = std::move(root->children.front());
+        --count;
+        ++version;
+        return true;
+    }
+
+    // 最大的 <= key 的键；不存在时返回 nil
+    Value floorKey(const Value& key) const {
+        checkKey(key);
+        const Node* leaf = leafFor(key);
+        size_t pos = upperBound(leaf->keys, key);
+        if (pos > 0) return leaf->keys[pos - 1];
+        return leaf->prev ? leaf->prev->keys.back() : Value();
+    }
+    // 最小的 >= key 的键；不存在时返回 nil
+    Value ceilingKey(const Value& key) const {
+        checkKey(key);
+        const Node* leaf = leafFor(key);
+        size_t pos = lowerBound(leaf->keys, key);
+        if (pos < leaf->keys.size()) return leaf->keys[pos];
+        return leaf->next ? leaf->next->keys.front() : Value();
+    }
+
+private:
+    static std::unique_ptr<Node> copyNode(const Node& src, Node*& last_leaf) {
+        auto n = std::make_unique<Node>(src.leaf);
+        n->keys = src.keys;
+        if (src.leaf) {
+            n->values = src.values;
+            n->prev = last_leaf;
+            if (last_leaf) last_leaf->next = n.get();
+            last_leaf = n.get();
+        } else {
+            for (const auto& child : src.children) n->children.push_back(copyNode(*child, last_leaf));
+        }
+        return n;
+    }
+
+    using Split = std::pair<Value, std::unique_ptr<Node>>; // 分隔键与分裂出的右兄弟
+
+    static std::optional<Split> insert(Node* n, const Value& key, const Value& value, bool& inserted) {
+        if (n->leaf) {
+            size_t pos = lowerBound(n->keys, key);
+            if (pos < n->keys.size() && compare_values(n->keys[pos], key) == 0) {
+                n->values[pos] = value;
+                return std::nullopt;
+            }
+            n->keys.insert(n->keys.begin() + pos, key);
+            n->values.insert(n->values.begin() + pos, value);
+            inserted = true;
+            if (n->keys.size() <= MAX_KEYS) return std::nullopt;
+
+            const size_t mid = n->keys.size() / 2;
+            auto right = std::make_unique<Node>(true);
+            right->keys.assign(std::make_move_iterator(n->keys.begin() + mid), std::make_move_iterator(n->keys.end()));
+            right->values.assign(std::make_move_iterator(n->values.begin() + mid), std::make_move_iterator(n->values.end()));
+            n->keys.resize(mid);
+            n->values.resize(mid);
+            right->next = n->next;
+            if (n->next) n->next->prev = right.get();
+            n->next = right.get();
+            right->prev = n;
+            Value separator = right->keys.front();
+            return Split(std::move(separator), std::move(right));
+        }
+
+        const size_t i = upperBound(n->keys, key);
+        auto split = insert(n->children[i].get(), key, value, inserted);
+        if (!split) return std::nullopt;
+        n->keys.insert(n->keys.begin() + i, std::move(split->first));
+        n->children.insert(n->children.begin() + i + 1, std::move(split->second));
+        if (n->keys.size() <= MAX_KEYS) return std::nullopt;
+
+        // 中间的键上移到父节点，不保留在任何一侧
+        const size_t mid = n->keys.size() / 2;
+        auto right = std::make_unique<Node>(false);
+        Value separator = std::move(n->keys[mid]);
+        right->keys.assign(std::make_move_iterator(n->keys.begin() + mid + 1), std::make_move_iterator(n->keys.end()));
+        right->children.assign(std::make_move_iterator(n->children.begin() + mid + 1), std::make_move_iterator(n->children.end()));
+        n->keys.resize(mid);
+        n->children.resize(mid + 1);
+        return Split(std::move(separator), std::move(right));
+    }
+
+    static bool eraseFrom(Node* n, const Value& key) {
+        if (n->leaf) {
+            size_t pos = lowerBound(n->keys, key);
+            if (pos == n->keys.size() || compare_values(n->keys[pos], key) != 0) return false;
+            n->keys.erase(n->keys.begin() + pos);
+            n->values.erase(n->values.begin() + pos);
+            return true;
+        }
+        // 内部节点中残留的分隔键即使已被删除，仍然是合法的分界，不需要更新
+        const size_t i = upperBound(n->keys, key);
+        if (!eraseFrom(n->children[i].get(), key)) return false;
+        if (n->children[i]->keys.size() < MIN_KEYS) rebalance(n, i);
+        return true;
+    }
+
+    // 子节点 i 的键数低于下限：优先向相邻兄弟借一个键，兄弟也不富余时与之合并
+    static void rebalance(Node* parent, size_t i) {
+        Node* child = parent->children[i].get();
+        Node* left = i > 0 ? parent->children[i - 1].get() : nullptr;
+        Node* right = i + 1 < parent->children.size() ? parent->children[i + 1].get() : nullptr;
+
+        if (left && left->keys.size() > MIN_KEYS) {
+            if (child->leaf) {
+                child->keys.insert(child->keys.begin(), std::move(left->keys.back()));
+                child->values.insert(child->values.begin(), std::move(left->values.back()));
+                left->values.pop_back();
+                parent->keys[i - 1] = child->keys.front();
+            } else {
+                child->keys.insert(child->keys.begin(), std::move(parent->keys[i - 1]));
+                child->children.insert(child->children.begin(), std::move(left->children.back()));
+                left->children.pop_back();
+                parent->keys[i - 1] = std::move(left->keys.back());
+            }
+            left->keys.pop_back();
+        } else if (right && right->keys.size() > MIN_KEYS) {
+            if (child->leaf) {
+                child->keys.push_back(std::move(right->keys.front()));
+                child->values.push_back(std::move(right->values.front()));
+                right->values.erase(right->values.begin());
+                right->keys.erase(right->keys.begin());
+                parent->keys[i] = right->keys.front();
+            } else {
+                child->keys.push_back(std::move(parent->keys[i]));
+                child->children.push_back(std::move(right->children.front()));
+                right->children.erase(right->children.begin());
+                parent->keys[i] = std::move(right->keys.front());
+                right->keys.erase(right->keys.begin());
+            }
+        } else {
+            merge(parent, left ? i - 1 : i);
+        }
+    }
+
+    // 把 children[j + 1] 并入 children[j]
+    static void merge(Node* parent, size_t j) {
+        Node* a = parent->children[j].get();
+        Node* b = parent->children[j + 1].get();
+        if (a->leaf) {
+            a->keys.insert(a->keys.end(), std::make_move_iterator(b->keys.begin()), std::make_move_iterator(b->keys.end()));
+            a->values.insert(a->values.end(), std::make_move_iterator(b->values.begin()), std::make_move_iterator(b->values.end()));
+            a->next = b->next;
+            if (b->next) b->next->prev = a;
+        } else {
+            a->keys.push_back(std::move(parent->keys[j]));
+            a->keys.insert(a->keys.end(), std::make_move_iterator(b->keys.begin()), std::make_move_iterator(b->keys.end()));
+            a->children.insert(a->children.end(), std::make_move_iterator(b->children.begin()), std::make_move_iterator(b->children.end()));
+        }
+        parent->keys.erase(parent->keys.begin() + j);
+        parent->children.erase(parent->children.begin() + j + 1);
+    }
+};
+
+// 沿叶子链表顺序遍历，可选地在 hi（不含）处停止；产出键，或 [键, 值]
+class SortedMapIterator final : public Iterator {
+    std::shared_ptr<SortedMapValue> map;
+    const SortedMapValue::Node* leaf;
+    size_t pos;
+    std::optional<Value> hi;
+    bool with_values;
+    std::uint64_t expected_version;
+public:
+    SortedMapIterator(std::shared_ptr<SortedMapValue> m, const SortedMapValue::Node* start, size_t p,
+                      std::optional<Value> upper, bool values)
+        : map(std::move(m)), leaf(start), pos(p), hi(std::move(upper)), with_values(values), expected_version(map->version) {}
+    bool next(Value& out) override {
+        if (map->version != expected_version) throw std::runtime_error("SortedMap changed during iteration.");
+        while (leaf && pos >= leaf->keys.size()) {
+            leaf = leaf->next;
+            pos = 0;
+        }
+        if (!leaf) return false;
+        const Value& key = leaf->keys[pos];
+        if (hi && compare_values(key, *hi) >= 0) {
+            leaf = nullptr;
+            return false;
+        }
+        if (with_values) {
+            auto pair = std::make_shared<ArrayValue>();
+            pair->elements = { key, leaf->values[pos] };
+            out = Value(pair);
+        } else {
+            out = key;
+        }
+        ++pos;
+        return true;
+    }
+};
+
+// sm.range(lo, hi) / sm.entries() 返回的惰性视图，每次遍历都重新定位起点
+class SortedMapRange final : public NativeObject {
+    std::shared_ptr<SortedMapValue> map;
+    std::optional<Value> lo, hi;
+public:
+    SortedMapRange(std::shared_ptr<SortedMapValue> m, std::optional<Value> l, std::optional<Value> h)
+        : map(std::move(m)), lo(std::move(l)), hi(std::move(h)) {}
+    std::string typeName() const override { return "SortedMapRange"; }
+    std::unique_ptr<Iterator> iter() override {
+        if (!lo) return std::make_unique<SortedMapIterator>(map, map->firstLeaf(), 0, hi, true);
+        const SortedMapValue::Node* leaf = map->leafFor(*lo);
+        return std::make_unique<SortedMapIterator>(map, leaf, SortedMapValue::lowerBound(leaf->keys, *lo), hi, true);
+    }
+};
+
+std::unique_ptr<Iterator> SortedMapValue::iter() {
+    auto self = std::static_pointer_cast<SortedMapValue>(shared_from_this());
+    return std::make_unique<SortedMapIterator>(self, firstLeaf(), 0, std::nullopt, false);
+}
+
+Value SortedMapValue::getMember(const std::string& name) {
+    auto self = std::static_pointer_cast<SortedMapValue>(shared_from_this());
+    if (name == "get") {
+        return native_method(name, -1, [self](const std::vector<Value>& args) -> Value {
+            if (args.empty() || args.size() > 2) throw std::runtime_error("SortedMap.get() takes 1 or 2 arguments.");
+            const Value* v = self->find(args[0]);
+            return v ? *v : (args.size() == 2 ? args[1] : Value());
+        });
+    }
+    if (name == "put") {
+        return native_method(name, 2, [self](const std::vector<Value>& args) -> Value {
+            self->put(args[0], args[1]);
+            return Value();
+        });
+    }
+    if (name == "delete") {
+        return native_method(name, 1, [self](const std::vector<Value>& args) { return Value(self->erase(args[0])); });
+    }
+    if (name == "contains") {
+        return native_method(name, 1, [self](const std::vector<Value>& args) { return Value(self->find(args[0]) != nullptr); });
+    }
+    if (name == "floor") {
+        return native_method(name, 1, [self](const std::vector<Value>& args) { return self->floorKey(args[0]); });
+    }
+    if (name == "ceiling") {
+        return native_method(name, 1, [self](const std::vector<Value>& args) { return self->ceilingKey(args[0]); });
+    }
+    if (name == "first" || name == "last") {
+        const bool first = name == "first";
+        return native_method(name, 0, [self, first](const std::vector<Value>&) -> Value {
+            if (self->count == 0) return Value();
+            return first ? self->firstLeaf()->keys.front() : self->lastLeaf()->keys.back();
+        });
+    }
+    if (name == "range") {
+        return native_method(name, 2, [self](const std::vector<Value>& args) -> Value {
+            checkKey(args[0]);
+            checkKey(args[1]);
+            return Value(std::static_pointer_cast<NativeObject>(std::make_shared<SortedMapRange>(self, args[0], args[1])));
+        });
+    }
+    if (name == "entries") {
+        return native_method(name, 0, [self](const std::vector<Value>&) -> Value {
+            return Value(std::static_pointer_cast<NativeObject>(std::make_shared<SortedMapRange>(self, std::nullopt, std::nullopt)));
+        });
+    }
+    if (name == "to_array") {
+        return native_method(name, 0, [self](const std::vector<Value>&) { return Value(self->toArray()); });
+    }
+    return NativeObject::getMember(name);
+}
+
+// ---- 持久化映射与向量 (PersistentMap / PersistentVector) ----
+// 节点创建后不再修改；每次更新只复制从根到被修改位置的一条路径（O(log32 n) 个节点），其余子树在新旧版本间共享。
+
+static int popcount32(std::uint32_t x) { return static_cast<int>(std::bitset<32>(x).count()); }
+
+// HAMT：每层取哈希的 5 位选择 32 个槽位之一，bitmap 记录哪些槽位存在，slots 只存放存在的槽位。
+// 哈希的 64 位全部用完后仍冲突的键放进 collision 节点，线性查找
+struct HamtNode {
+    struct Slot {
+        size_t hash;
+        Value key;
+        Value value;
+        std::shared_ptr<const HamtNode> child; // 非空时本槽位是子节点，key/value 不使用
+    };
+    std::uint32_t bitmap = 0;
+    bool collision = false;
+    std::vector<Slot> slots;
+};
+using HamtNodePtr = std::shared_ptr<const HamtNode>;
+
+static constexpr unsigned HAMT_MAX_SHIFT = 64;
+
+static const Value* hamt_find(const HamtNode* node, const Value& key, size_t h, unsigned shift) {
+    while (node) {
+        if (node->collision) {
+            for (const auto& slot : node->slots) {
+                if (keys_equal(slot.key, key)) return &slot.value;
+            }
+            return nullptr;
+        }
+        const std::uint32_t bit = 1u << ((h >> shift) & 31);
+        if (!(node->bitmap & bit)) return nullptr;
+        const auto& slot = node->slots[popcount32(node->bitmap & (bit - 1))];
+        if (!slot.child) return slot.hash == h && keys_equal(slot.key, key) ? &slot.value : nullptr;
+        node = slot.child.get();
+        shift += 5;
+    }
+    return nullptr;
+}
+
+// 由两个哈希不同（或在 shift 处之后才分叉）的键值对构造子树
+static HamtNodePtr hamt_pair(HamtNode::Slot a, HamtNode::Slot b, unsigned shift) {
+    auto node = std::make_shared<HamtNode>();
+    if (shift >= HAMT_MAX_SHIFT) {
+        node->collision = true;
+        node->slots.push_back(std::move(a));
+        node->slots.push_back(std::move(b));
+        return node;
+    }
+    const unsigned ia = (a.hash >> shift) & 31, ib = (b.hash >> shift) & 31;
+    if (ia == ib) {
+        node->bitmap = 1u << ia;
+        node->slots.push_back({0, Value(), Value(), hamt_pair(std::move(a), std::move(b), shift + 5)});
+    } else {
+        node->bitmap = (1u << ia) | (1u << ib);
+        if (ia < ib) {
+            node->slots.push_back(std::move(a));
+            node->slots.push_back(std::move(b));
+        } else {
+            node->slots.push_back(std::move(b));
+            node->slots.push_back(std::move(a));
+        }
+    }
+    return node;
+}
+
+// 返回插入/替换后的新节点；键已存在且值相同时返回原节点
+static HamtNodePtr hamt_assoc(const HamtNodePtr& node, const Value& key, const Value& value, size_t h, unsigned shift, bool& added) {
+    if (!node) {
+        auto leaf = std::make_shared<HamtNode>();
+        leaf->bitmap = 1u << ((h >> shift) & 31);
+        leaf->slots.push_back({h, key, value, nullptr});
+        added = true;
+        return leaf;
+    }
+    if (node->collision) {
+        auto copy = std::make_shared<HamtNode>(*node);
+        for (auto& slot : copy->slots) {
+            if (keys_equal(slot.key, key)) {
+                if (slot.value == value) return node;
+                slot.value = value;
+                return copy;
+            }
+        }
+        copy->slots.push_back({h, key, value, nullptr});
+        added = true;
+        return copy;
+    }
+    const std::uint32_t bit = 1u << ((h >> shift) & 31);
+    const size_t pos = popcount32(node->bitmap & (bit - 1));
+    if (!(node->bitmap & bit)) {
+        auto copy = std::make_shared<HamtNode>(*node);
+        copy->bitmap |= bit;
+        copy->slots.insert(copy->slots.begin() + pos, {h, key, value, nullptr});
+        added = true;
+        return copy;
+    }
+    const auto& slot = node->slots[pos];
+    HamtNode::Slot replacement;
+    if (slot.child) {
+        auto child = hamt_assoc(slot.child, key, value, h, shift + 5, added);
+        if (child == slot.child) return node;
+        replacement = {0, Value(), Value(), std::move(child)};
+    } else if (slot.hash == h && keys_equal(slot.key, key)) {
+        if (slot.value == value) return node;
+        replacement = {h, slot.key, value, nullptr};
+    } else {
+        replacement = {0, Value(), Value(), hamt_pair(slot, {h, key, value, nullptr}, shift + 5)};
+        added = true;
+    }
+    auto copy = std::make_shared<HamtNode>(*node);
+    copy->slots[pos] = std::move(replacement);
+    return copy;
+}
+
+// 返回删除后的新节点（空节点返回 nullptr）；键不存在时返回原节点
+static HamtNodePtr hamt_dissoc(const HamtNodePtr& node, const Value& key, size_t h, unsigned shift, bool& removed) {
+    if (!node) return node;
+    if (node->collision) {
+        for (size_t i = 0; i < node->slots.size(); ++i) {
+            if (keys_equal(node->slots[i].key, key)) {
+                removed = true;
+                if (node->slots.size() == 1) return nullptr;
+                auto copy = std::make_shared<HamtNode>(*node);
+                copy->slots.erase(copy->slots.begin() + i);
+                return copy;
+            }
+        }
+        return node;
+    }
+    const std::uint32_t bit = 1u << ((h >> shift) & 31);
+    if (!(node->bitmap & bit)) return node;
+    const size_t pos = popcount32(node->bitmap & (bit - 1));
+    const auto& slot = node->slots[pos];
+    HamtNodePtr child;
+    if (slot.child) {
+        child = hamt_dissoc(slot.child, key, h, shift + 5, removed);
+        if (child == slot.child) return node;
+    } else {
+        if (slot.hash != h || !keys_equal(slot.key, key)) return node;
+        removed = true;
+    }
+    auto copy = std::make_shared<HamtNode>(*node);
+    if (!child) {
+        copy->bitmap &= ~bit;
+        copy->slots.erase(copy->slots.begin() + pos);
+        if (copy->slots.empty()) return nullptr;
+    } else if (!child->collision && child->slots.size() == 1 && !child->slots[0].child) {
+        copy->slots[pos] = child->slots[0]; // 只剩一个键值对的子节点直接上提，保持树的紧凑
+    } else {
+        copy->slots[pos].child = std::move(child);
+    }
+    return copy;
+}
+
+// 深度优先遍历所有键值对；栈中保存 (节点, 下一个槽位)
+class HamtIterator final : public Iterator {
+    HamtNodePtr root; // 保证遍历期间节点存活
+    std::vector<std::pair<const HamtNode*, size_t>> stack;
+    bool with_values;
+public:
+    HamtIterator(HamtNodePtr r, bool values) : root(std::move(r)), with_values(values) {
+        if (root) stack.emplace_back(root.get(), 0);
+    }
+    bool next(Value& out) override {
+        while (!stack.empty()) {
+            auto& [node, pos] = stack.back();
+            if (pos >= node->slots.size()) {
+                stack.pop_back();
+                continue;
+            }
+            const auto& slot = node->slots[pos++];
+            if (slot.child) {
+                stack.emplace_back(slot.child.get(), 0);
+                continue;
+            }
+            if (with_values) {
+                auto pair = std::make_shared<ArrayValue>();
+                pair->elements = { slot.key, slot.value };
+                out = Value(pair);
+            } else {
+                out = slot.key;
+            }
+            return true;
+        }
+        return false;
+    }
+};
+
+// 槽位中的键值对（或子树中的全部键值对）都能在 other 中找到且值相等
+static bool hamt_slot_in(const HamtNode::Slot& slot, const HamtNode* other) {
+    if (slot.child) {
+        for (const auto& sub : slot.child->slots) {
+            if (!hamt_slot_in(sub, other)) return false;
+        }
+        return true;
+    }
+    const Value* v = hamt_find(other, slot.key, slot.hash, 0);
+    return v && *v == slot.value;
+}
+
+// 两个版本同时向下比较：指针相同的子树（两版本共享的部分）直接跳过，结构不一致的部分退回逐键查找。
+// 调用方保证两边键的数量相同
+static bool hamt_equal(const HamtNode* a, const HamtNode* b, const HamtNode* b_root) {
+    if (a == b || !a) return true;
+    const bool parallel = b && !a->collision && !b->collision && a->bitmap == b->bitmap;
+    for (size_t i = 0; i < a->slots.size(); ++i) {
+        const auto& sa = a->slots[i];
+        if (parallel && sa.child && b->slots[i].child) {
+            if (!hamt_equal(sa.child.get(), b->slots[i].child.get(), b_root)) return false;
+        } else if (!hamt_slot_in(sa, b_root)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+class PersistentMapValue final : public NativeObject {
+public:
+    HamtNodePtr root;
+    size_t count = 0;
+
+    PersistentMapValue() = default;
+    PersistentMapValue(HamtNodePtr r, size_t n) : root(std::move(r)), count(n) {}
+
+    std::string typeName() const override { return "PersistentMap"; }
+    std::string toString() const override {
+        std::string result = "PersistentMap{";
+        HamtIterator it(root, true);
+        Value pair;
+        bool first = true;
+        while (it.next(pair)) {
+            const auto& kv = pair.as<Value::ArrayType>()->elements;
+            if (!first) result += ", ";
+            result += kv[0].toString() + ": " + kv[1].toString();
+            first = false;
+        }
+        return result + "}";
+    }
+    bool toBool() const override { return count > 0; }
+    int length() const override { return static_cast<int>(count); }
+    Value getIndex(const Value& key) override {
+        if (const Value* v = hamt_find(root.get(), key, hash_key(key), 0)) return *v;
+        throw std::runtime_error("Key '" + key.toString() + "' not found in PersistentMap.");
+    }
+    void setIndex(const Value&, const Value&) override {
+        throw std::runtime_error("PersistentMap is immutable; use set() to get an updated version.");
+    }
+    std::unique_ptr<Iterator> iter() override { return std::make_unique<HamtIterator>(root, false); }
+    Value getMember(const std::string& name) override;
+
+    // 同一个根说明两个版本完全相同；否则两棵树并行比较，共享的子树整体跳过
+    bool equals(const NativeObject& other) const override {
+        auto* o = dynamic_cast<const PersistentMapValue*>(&other);
+        if (!o || o->count != count) return false;
+        return hamt_equal(root.get(), o->root.get(), o->root.get());
+    }
+
+    Value with(HamtNodePtr new_root, size_t new_count) const {
+        if (new_root == root) return Value(std::const_pointer_cast<NativeObject>(shared_from_this()));
+        return Value(std::static_pointer_cast<NativeObject>(std::make_shared<PersistentMapValue>(std::move(new_root), new_count)));
+    }
+};
+
+Value PersistentMapValue::getMember(const std::string& name) {
+    auto self = std::static_pointer_cast<PersistentMapValue>(shared_from_this());
+    if (name == "get") {
+        return native_method(name, -1, [self](const std::vector<Value>& args) -> Value {
+            if (args.empty() || args.size() > 2) throw std::runtime_error("PersistentMap.get() takes 1 or 2 arguments.");
+            const Value* v = hamt_find(self->root.get(), args[0], hash_key(args[0]), 0);
+            return v ? *v : (args.size() == 2 ? args[1] : Value());
+        });
+    }
+    if (name == "contains") {
+        return native_method(name, 1, [self](const std::vector<Value>& args) {
+            return Value(hamt_find(self->root.get(), args[0], hash_key(args[0]), 0) != nullptr);
+        });
+    }
+    if (name == "set") {
+        return native_method(name, 2, [self](const std::vector<Value>& args) {
+            bool added = false;
+            auto new_root = hamt_assoc(self->root, args[0], args[1], hash_key(args[0]), 0, added);
+            return self->with(std::move(new_root), self->count + (added ? 1 : 0));
+        });
+    }
+    if (name == "remove") {
+        return native_method(name, 1, [self](const std::vector<Value>& args) {
+            bool removed = false;
+            auto new_root = hamt_dissoc(self->root, args[0], hash_key(args[0]), 0, removed);
+            return self->with(std::move(new_root), self->count - (removed ? 1 : 0));
+        });
+    }
+    if (name == "entries") {
+        return native_method(name, 0, [self](const std::vector<Value>&) -> Value {
+            auto arr = std::make_shared<ArrayValue>();
+            arr->elements.reserve(self->count);
+            HamtIterator it(self->root, true);
+            Value pair;
+            while (it.next(pair)) arr->elements.push_back(pair);
+            return Value(arr);
+        });
+    }
+    if (name == "to_dict") {
+        return native_method(name, 0, [self](const std::vector<Value>&) -> Value {
+            auto dict = std::make_shared<DictValue>();
+            dict->reserve(self->count);
+            HamtIterator it(self->root, true);
+            Value pair;
+            while (it.next(pair)) {
+                const auto& kv = pair.as<Value::ArrayType>()->elements;
+                (*dict)[kv[0]] = kv[1];
+            }
+            return Value(dict);
+        });
+    }
+    if (name == "to_array") {
+        return native_method(name, 0, [self](const std::vector<Value>&) { return Value(self->toArray()); });
+    }
+    return NativeObject::getMember(name);
+}
+
+// 32 叉前缀树：下标的每 5 位选择一层中的子节点，叶子层每个节点存放 32 个元素。
+// 除最后一个叶子外所有叶子都是满的，因此树的形状只由元素个数决定
+struct PVecNode {
+    std::vector<Value> values;                             // 叶子节点
+    std::vector<std::shared_ptr<const PVecNode>> children; // 内部节点
+};
+using PVecNodePtr = std::shared_ptr<const PVecNode>;
+
+class PersistentVectorValue final : public NativeObject {
+public:
+    PVecNodePtr root;   // 空向量时为 nullptr
+    unsigned shift = 0; // 根节点所在层的位移，根是叶子时为 0
+    size_t count = 0;
+
+    PersistentVectorValue() = default;
+    PersistentVectorValue(PVecNodePtr r, unsigned sh, size_t n) : root(std::move(r)), shift(sh), count(n) {}
+
+    std::string typeName() const override { return "PersistentVector"; }
+    std::string toString() const override {
+        std::string result = "PersistentVector([";
+        for (size_t i = 0; i < count; ++i) {
+            if (i > 0) result += ", ";
+            result += at(i).toString();
+        }
+        return result + "])";
+    }
+    bool toBool() const override { return count > 0; }
+    int length() const override { return static_cast<int>(count); }
+    Value getIndex(const Value& index) override { return at(checkedIndex(index)); }
+    void setIndex(const Value&, const Value&) override {
+        throw std::runtime_error("PersistentVector is immutable; use set() to get an updated version.");
+    }
+    std::unique_ptr<Iterator> iter() override;
+    Value getMember(const std::string& name) override;
+    std::shared_ptr<ArrayValue> toArray() override {
+        auto arr = std::make_shared<ArrayValue>();
+        arr->elements.reserve(count);
+        for (size_t i = 0; i < count; i += 32) {
+            const auto& leaf = leafFor(i)->values;
+            arr->elements.append(leaf.begin(), leaf.end());
+        }
+        return arr;
+    }
+    bool equals(const NativeObject& other) const override {
+        auto* o = dynamic_cast<const PersistentVectorValue*>(&other);
+        return o && o->count == count && nodesEqual(root.get(), o->root.get());
+    }
+
+    size_t checkedIndex(const Value& index) const {
+        if (!index.is<int>()) throw std::runtime_error("PersistentVector index must be an integer.");
+        int i = index.as<int>();
+        if (i < 0 || i >= static_cast<int>(count)) throw std::runtime_error("PersistentVector index out of bounds");
+        return static_cast<size_t>(i);
+    }
+    const PVecNode* leafFor(size_t i) const {
+        const PVecNode* n = root.get();
+        for (unsigned level = shift; level > 0; level -= 5) n = n->children[(i >> level) & 31].get();
+        return n;
+    }
+    const Value& at(size_t i) const { return leafFor(i)->values[i & 31]; }
+
+    Value assoc(size_t i, const Value& v) const {
+        return make(assocAt(root, shift, i, v), shift, count);
+    }
+    Value push(const Value& v) const {
+        if (!root) return make(newPath(0, v), 0, 1);
+        if (count == (size_t(1) << (shift + 5))) {
+            // 当前树已满：新根的左子树是原来的整棵树
+            auto new_root = std::make_shared<PVecNode>();
+            new_root->children = { root, newPath(shift, v) };
+            return make(std::move(new_root), shift + 5, count + 1);
+        }
+        return make(pushAt(root, shift, count, v), shift, count + 1);
+    }
+    Value pop() const {
+        if (count == 0) throw std::runtime_error("PersistentVector.pop() on an empty PersistentVector.");
+        if (count == 1) return make(nullptr, 0, 0);
+        PVecNodePtr new_root = popAt(root, shift, count - 1);
+        unsigned new_shift = shift;
+        while (new_shift > 0 && new_root->children.size() == 1) {
+            new_root = new_root->children.front();
+            new_shift -= 5;
+        }
+        return make(std::move(new_root), new_shift, count - 1);
+    }
+
+private:
+    static Value make(PVecNodePtr r, unsigned sh, size_t n) {
+        return Value(std::static_pointer_cast<NativeObject>(std::make_shared<PersistentVectorValue>(std::move(r), sh, n)));
+    }
+    static PVecNodePtr newPath(unsigned level, const Value& v) {
+        auto node = std::make_shared<PVecNode>();
+        if (level == 0) {
+            node->values.push_back(v);
+        } else {
+            node->children.push_back(newPath(level - 5, v));
+        }
+        return node;
+    }
+    static PVecNodePtr assocAt(const PVecNodePtr& node, unsigned level, size_t i, const Value& v) {
+        auto copy = std::make_shared<PVecNode>(*node);
+        if (level == 0) {
+            copy->values[i & 31] = v;
+        } else {
+            auto& child = copy->children[(i >> level) & 31];
+            child = assocAt(child, level - 5, i, v);
+        }
+        return copy;
+    }
+    // i 是新元素的下标（即原来的元素个数）
+    static PVecNodePtr pushAt(const PVecNodePtr& node, unsigned level, size_t i, const Value& v) {
+        auto copy = std::make_shared<PVecNode>(*node);
+        if (level == 0) {
+            copy->values.push_back(v);
+            return copy;
+        }
+        const size_t idx = (i >> level) & 31;
+        if (idx < copy->children.size()) {
+            copy->children[idx] = pushAt(copy->children[idx], level - 5, i, v);
+        } else {
+            copy->children.push_back(newPath(level - 5, v));
+        }
+        return copy;
+    }
+    // i 是被删除元素（最后一个元素）的下标；节点因此变空时返回 nullptr
+    static PVecNodePtr popAt(const PVecNodePtr& node, unsigned level, size_t i) {
+        if (level == 0) {
+            if (node->values.size() == 1) return nullptr;
+            auto copy = std::make_shared<PVecNode>(*node);
+            copy->values.pop_back();
+            return copy;
+        }
+        const size_t idx = (i >> level) & 31;
+        PVecNodePtr child = popAt(node->children[idx], level - 5, i);
+        if (!child && idx == 0) return nullptr;
+        auto copy = std::make_shared<PVecNode>(*node);
+        if (child) {
+            copy->children[idx] = std::move(child);
+        } else {
+            copy->children.pop_back();
+        }
+        return copy;
+    }
+    // 元素个数相同的两棵树形状相同，可以逐节点比较并跳过共享的子树
+    static bool nodesEqual(const PVecNode* a, const PVecNode* b) {
+        if (a == b) return true;
+        if (!a || !b) return false;
+        if (a->values != b->values) return false;
+        for (size_t i = 0; i < a->children.size(); ++i) {
+            if (!nodesEqual(a->children[i].get(), b->children[i].get())) return false;
+        }
+        return true;
+    }
+};
+
+// 每 32 个元素才向下查找一次叶子，其余步骤直接读当前叶子
+class PersistentVectorIterator final : public Iterator {
+    std::shared_ptr<const PersistentVectorValue> vec;
+    const PVecNode* leaf = nullptr;
+    size_t pos = 0;
+public:
+    explicit PersistentVectorIterator(std::shared_ptr<const PersistentVectorValue> v) : vec(std::move(v)) {}
+    bool next(Value& out) override {
+        if (pos >= vec->count) return false;
+        if ((pos & 31) == 0) leaf = vec->leafFor(pos);
+        out = leaf->values[pos & 31];
+        ++pos;
+        return true;
+    }
+};
+
+std::unique_ptr<Iterator> PersistentVectorValue::iter() {
+    return std::make_unique<PersistentVectorIterator>(std::static_pointer_cast<const PersistentVectorValue>(shared_from_this()));
+}
+
+Value PersistentVectorValue::getMember(const std::string& name) {
+    auto self = std::static_pointer_cast<PersistentVectorValue>(shared_from_this());
+    if (name == "get") {
+        return native_method(name, 1, [self](const std::vector<Value>& args) { return self->at(self->checkedIndex(args[0])); });
+    }
+    if (name == "set") {
+        return native_method(name, 2, [self](const std::vector<Value>& args) { return self->assoc(self->checkedIndex(args[0]), args[1]); });
+    }
+    if (name == "push") {
+        return native_method(name, 1, [self](const std::vector<Value>& args) { return self->push(args[0]); });
+    }
+    if (name == "pop") {
+        return native_method(name, 0, [self](const std::vector<Value>&) { return self->pop(); });
+    }
+    if (name == "to_array") {
+        return native_method(name, 0, [self](const std::vector<Value>&) { return Value(self->toArray()); });
+    }
+    return NativeObject::getMember(name);
+}
+
+// ---- 文件读写 (File / lines / MappedFile) ----
+
+// 去掉 "\n" 之前可能残留的 "\r"，使 Windows 换行的文件按行读取时结果一致
+static void trim_cr(std::string& line) {
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+}
+
+// open() 返回的文件句柄。读取经过 64KB 的流缓冲区，read_line/read_chunk 每次只取需要的部分，
+// 处理任意大的文件都只占常数内存
+class FileValue final : public NativeObject {
+    static constexpr size_t BUFFER_SIZE = 64 * 1024;
+    std::string path;
+    std::string mode;
+    std::unique_ptr<char[]> buffer;
+    std::fstream stream;
+    bool closed = false;
+
+public:
+    FileValue(std::string p, std::string m) : path(std::move(p)), mode(std::move(m)), buffer(new char[BUFFER_SIZE]) {
+        std::ios::openmode flags = std::ios::binary;
+        if (mode == "r") flags |= std::ios::in;
+        else if (mode == "w") flags |= std::ios::out | std::ios::trunc;
+        else if (mode == "a") flags |= std::ios::out | std::ios::app;
+        else throw std::runtime_error("Unknown file mode '" + mode + "'. Use \"r\", \"w\" or \"a\".");
+        stream.rdbuf()->pubsetbuf(buffer.get(), BUFFER_SIZE); // 必须在 open 之前设置
+        stream.open(path, flags);
+        if (!stream.is_open()) throw std::runtime_error("Could not open file: " + path);
+    }
+
+    std::string typeName() const override { return "File"; }
+    std::string toString() const override {
+        return "<File " + path + " (" + (closed ? "closed" : mode) + ")>";
+    }
+    std::unique_ptr<Iterator> iter() override;
+    Value getMember(const std::string& name) override;
+
+    void require(bool reading, const char* op) const {
+        if (closed) throw std::runtime_error(std::string("File.") + op + "() on a closed file.");
+        if (reading != (mode == "r")) {
+            throw std::runtime_error(std::string("File.") + op + "() requires a file opened with mode \"" + (reading ? "r" : "w\" or \"a") + "\".");
+        }
+    }
+    // 读取下一行（不含换行符）；到达文件末尾时返回 false
+    bool readLine(std::string& line) {
+        if (!std::getline(stream, line)) return false;
+        trim_cr(line);
+        return true;
+    }
+    Value readChunk(int n) {
+        std::string chunk(static_cast<size_t>(n), '\0');
+        stream.read(chunk.data(), n);
+        chunk.resize(static_cast<size_t>(stream.gcount()));
+        if (chunk.empty()) return Value();
+        return Value(std::move(chunk));
+    }
+    void write(const std::string& text) {
+        stream.write(text.data(), static_cast<std::streamsize>(text.size()));
+        if (!stream) throw std::runtime_error("Failed to write to file: " + path);
+    }
+    void close() {
+        if (closed) return;
+        stream.close();
+        closed = true;
+    }
+};
+
+class FileLineIterator final : public Iterator {
+    std::shared_ptr<FileValue> file;
+    std::string line;
+public:
+    explicit FileLineIterator(std::shared_ptr<FileValue> f) : file(std::move(f)) {}
+    bool next(Value& out) override {
+        file->require(true, "read_line");
+        if (!file->readLine(line)) return false;
+        out = Value(line);
+        return true;
+    }
+};
+
+std::unique_ptr<Iterator> FileValue::iter() {
+    require(true, "read_line");
+    return std::make_unique<FileLineIterator>(std::static_pointer_cast<FileValue>(shared_from_this()));
+}
+
+Value FileValue::getMember(const std::string& name) {
+    auto self = std::static_pointer_cast<FileValue>(shared_from_this());
+    if (name == "read_line") {
+        return native_method(name, 0, [self](const std::vector<Value>&) -> Value {
+            self->require(true, "read_line");
+            std::string line;
+            if (!self->readLine(line)) return Value();
+            return Value(std::move(line));
+        });
+    }
+    if (name == "read_chunk") {
+        return native_method(name, 1, [self](const std::vector<Value>& args) -> Value {
+            self->require(true, "read_chunk");
+            if (!args[0].is<int>() || args[0].as<int>() <= 0) throw std::runtime_error("File.read_chunk() size must be a positive integer.");
+            return self->readChunk(args[0].as<int>());
+        });
+    }
+    if (name == "write") {
+        return native_method(name, 1, [self](const std::vector<Value>& args) -> Value {
+            self->require(false, "write");
+            if (args[0].is<StringData>()) self->write(args[0].as<StringData>().get());
+            else self->write(args[0].toString());
+            return Value();
+        });
+    }
+    if (name == "close") {
+        return native_method(name, 0, [self](const std::vector<Value>&) -> Value {
+            self->close();
+            return Value();
+        });
+    }
+    return NativeObject::getMember(name);
+}
+
+// lines(path)：惰性的行序列。每次 for-each 都重新打开文件，从头逐行读取
+class LinesValue final : public NativeObject {
+    std::string path;
+public:
+    explicit LinesValue(std::string p) : path(std::move(p)) {}
+    std::string typeName() const override { return "lines"; }
+    std::string toString() const override { return "lines(" + path + ")"; }
+    std::unique_ptr<Iterator> iter() override { return std::make_shared<FileValue>(path, "r")->iter(); }
+};
+
+// map_file(path)：把整个文件映射为只读内存，像字符串一样支持 len、下标、slice 和 find，
+// 但内容由操作系统按需分页载入，不会复制到堆上。for-each 逐行产出（每行才分配一个字符串）
+// 与字符串不同，len、下标、slice 和 find 的位置都按字节计算：按码点定位需要从头扫描整个文件，
+// 失去映射的意义。需要按字符处理时先用 to_string() 转成字符串
+class MappedFileValue final : public NativeObject {
+    std::string path;
+    const char* bytes = nullptr;
+    size_t size = 0;
+#ifdef MINILANG_HAS_MMAP
+    void* mapping = nullptr;
+#else
+    std::string fallback; // 没有 mmap 的平台上退化为一次性读入
+#endif
+
+public:
+    explicit MappedFileValue(std::string p) : path(std::move(p)) {
+#ifdef MINILANG_HAS_MMAP
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw std::runtime_error("Could not open file: " + path);
+        struct stat st;
+        if (::fstat(fd, &st) != 0) {
+            ::close(fd);
+            throw std::runtime_error("Could not stat file: " + path);
+        }
+        size = static_cast<size_t>(st.st_size);
+        if (size > 0) {
+            mapping = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping == MAP_FAILED) {
+                mapping = nullptr;
+                ::close(fd);
+                throw std::runtime_error("Could not map file: " + path);
+            }
+            ::madvise(mapping, size, MADV_SEQUENTIAL);
+            bytes = static_cast<const char*>(mapping);
+        }
+        ::close(fd); // 映射建立后不再需要文件描述符
+#else
+        std::ifstream file(path, std::ios::binary);
+        if (!file) throw std::runtime_error("Could not open file: " + path);
+        fallback.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        bytes = fallback.data();
+        size = fallback.size();
+#endif
+    }
+    ~MappedFileValue() override {
+#ifdef MINILANG_HAS_MMAP
+        if (mapping) ::munmap(mapping, size);
+#endif
+    }
+    MappedFileValue(const MappedFileValue&) = delete;
+    MappedFileValue& operator=(const MappedFileValue&) = delete;
+
+    std::string_view view() const { return std::string_view(bytes, size); }
+
+    std::string typeName() const override { return "MappedFile"; }
+    std::string toString() const override { return "<MappedFile " + path + " (" + std::to_string(size) + " bytes)>"; }
+    bool toBool() const override { return size > 0; }
+    int length() const override {
+        if (size > static_cast<size_t>(INT_MAX)) throw std::runtime_error("MappedFile is too large for len(); iterate over its lines instead.");
+        return static_cast<int>(size);
+    }
+    Value getIndex(const Value& index) override {
+        if (!index.is<int>()) throw std::runtime_error("MappedFile index must be an integer.");
+        int i = index.as<int>();
+        if (i < 0 || static_cast<size_t>(i) >= size) throw std::runtime_error("MappedFile index out of bounds");
+        return Value(StringData::of_char(static_cast<unsigned char>(bytes[i])));
+    }
+    Value slice(int b, int e) override { return Value(std::string(bytes + b, bytes + e)); }
+    std::unique_ptr<Iterator> iter() override;
+    Value getMember(const std::string& name) override;
+};
+
+class MappedLineIterator final : public Iterator {
+    std::shared_ptr<MappedFileValue> file; // 保证迭代期间映射有效
+    std::string_view rest;
+public:
+    explicit MappedLineIterator(std::shared_ptr<MappedFileValue> f) : file(std::move(f)), rest(file->view()) {}
+    bool next(Value& out) override {
+        if (rest.empty()) return false;
+        size_t nl = rest.find('\n');
+        std::string line(rest.substr(0, nl));
+        rest = nl == std::string_view::npos ? std::string_view() : rest.substr(nl + 1);
+        trim_cr(line);
+        out = Value(std::move(line));
+        return true;
+    }
+};
+
+std::unique_ptr<Iterator> MappedFileValue::iter() {
+    return std::make_unique<MappedLineIterator>(std::static_pointer_cast<MappedFileValue>(shared_from_this()));
+}
+
+Value MappedFileValue::getMember(const std::string& name) {
+    auto self = std::static_pointer_cast<MappedFileValue>(shared_from_this());
+    if (name == "find") {
+        return native_method(name, -1, [self](const std::vector<Value>& args) -> Value {
+            if (args.empty() || args.size() > 2 || !args[0].is<StringData>()) throw std::runtime_error("MappedFile.find() takes a string and an optional start index.");
+            size_t start = 0;
+            if (args.size() == 2) {
+                if (!args[1].is<int>() || args[1].as<int>() < 0) throw std::runtime_error("MappedFile.find() start must be a non-negative integer.");
+                start = static_cast<size_t>(args[1].as<int>());
+            }
+            size_t pos = self->view().find(args[0].as<StringData>().get(), start);
+            if (pos == std::string_view::npos || pos > static_cast<size_t>(INT_MAX)) return Value(-1);
+            return Value(static_cast<int>(pos));
+        });
+    }
+    if (name == "count") {
+        return native_method(name, 1, [self](const std::vector<Value>& args) -> Value {
+            if (!args[0].is<StringData>() || args[0].as<StringData>().get().empty()) throw std::runtime_error("MappedFile.count() requires a non-empty string.");
+            const std::string& needle = args[0].as<StringData>().get();
+            std::string_view text = self->view();
+            int n = 0;
+            for (size_t pos = text.find(needle); pos != std::string_view::npos; pos = text.find(needle, pos + needle.size())) ++n;
+            return Value(n);
+        });
+    }
+    if (name == "to_string") {
+        return native_method(name, 0, [self](const std::vector<Value>&) { return Value(std::string(self->view())); });
+    }
+    return NativeObject::getMember(name);
+}
+
+// ---- 字节缓冲 (Bytes) ----
+// 可变的字节序列，用于解析和生成二进制格式。切片是共享存储的视图（O(1)，写入视图即写入原缓冲区），
+// 多字节整数与浮点数按指定的字节序整块读写，不再逐字节经过字符串
+struct ByteStorage {
+    std::vector<unsigned char> owned;
+    std::shared_ptr<NativeObject> owner; // 映射文件的视图：持有 MappedFile 以保证映射在视图存活期间有效
+    const unsigned char* mapped = nullptr;
+    size_t mapped_size = 0;
+
+    bool readonly() const { return owner != nullptr; }
+    size_t size() const { return owner ? mapped_size : owned.size(); }
+    const unsigned char* data() const { return owner ? mapped : owned.data(); }
+    unsigned char* mutableData() {
+        if (owner) throw std::runtime_error("Bytes backed by a mapped file are read-only; use copy() first.");
+        return owned.data();
+    }
+};
+
+// 字段类型描述："u8"、"i8"，以及 u16/i16/u32/i32/u64/i64/f32/f64 加字节序后缀 le 或 be（如 "u32le"、"f64be"）
+struct ByteField {
+    int size;
+    bool is_float;
+    bool is_signed;
+    bool big_endian;
+    std::string name;
+};
+
+static ByteField byte_field(const Value& spec) {
+    if (!spec.is<StringData>()) throw std::runtime_error("Bytes field type must be a string such as \"u8\", \"i32le\" or \"f64be\".");
+    const std::string& s = spec.as<StringData>().get();
+    ByteField f{ 0, false, false, false, s };
+    if (s.size() >= 2 && (s[0] == 'u' || s[0] == 'i' || s[0] == 'f')) {
+        f.is_float = s[0] == 'f';
+        f.is_signed = s[0] == 'i';
+        std::string_view rest = std::string_view(s).substr(1);
+        std::string_view bits = rest.substr(0, std::min(rest.find_first_not_of("0123456789"), rest.size()));
+        std::string_view order = rest.substr(bits.size());
+        int n = bits == "8" ? 1 : bits == "16" ? 2 : bits == "32" ? 4 : bits == "64" ? 8 : 0;
+        bool ok = n != 0 && !(f.is_float && n < 4) && (order == "le" || order == "be" || (n == 1 && order.empty()));
+        if (ok) {
+            f.size = n;
+            f.big_endian = order == "be";
+            return f;
+        }
+    }
+    throw std::runtime_error("Unknown Bytes field type '" + s + "'.");
+}
+
+static std::uint64_t load_uint(const unsigned char* p, int size, bool big_endian) {
+    std::uint64_t v = 0;
+    for (int i = 0; i < size; ++i) v |= static_cast<std::uint64_t>(p[big_endian ? size - 1 - i : i]) << (8 * i);
+    return v;
+}
+
+static void store_uint(unsigned char* p, int size, bool big_endian, std::uint64_t v) {
+    for (int i = 0; i < size; ++i) p[big_endian ? size - 1 - i : i] = static_cast<unsigned char>(v >> (8 * i));
+}
+
+// 读出的整数在 int 范围内时为 int，否则（大的 u32、64 位整数）为 float
+static Value load_field(const unsigned char* p, const ByteField& f) {
+    std::uint64_t bits = load_uint(p, f.size, f.big_endian);
+    if (f.is_float) {
+        if (f.size == 4) {
+            std::uint32_t b32 = static_cast<std::uint32_t>(bits);
+            float x;
+            std::memcpy(&x, &b32, sizeof(x));
+            return Value(static_cast<double>(x));
+        }
+        double d;
+        std::memcpy(&d, &bits, sizeof(d));
+        return Value(d);
+    }
+    if (f.is_signed) {
+        int shift = 64 - 8 * f.size;
+        std::int64_t v = static_cast<std::int64_t>(bits << shift) >> shift; // 符号扩展
+        if (v >= INT_MIN && v <= INT_MAX) return Value(static_cast<int>(v));
+        return Value(static_cast<double>(v));
+    }
+    if (bits <= static_cast<std::uint64_t>(INT_MAX)) return Value(static_cast<int>(bits));
+    return Value(static_cast<double>(bits));
+}
+
+static void store_field(unsigned char* p, const ByteField& f, const Value& value) {
+    if (!value.is<int>() && !value.is<double>() && !value.is<bool>()) {
+        throw std::runtime_error("Bytes.write() expects a number for field type '" + f.name + "'.");
+    }
+    double d = value.is<int>() ? value.as<int>() : value.is<bool>() ? value.as<bool>() : value.as<double>();
+    if (f.is_float) {
+        if (f.size == 4) {
+            float x = static_cast<float>(d);
+            std::uint32_t b32;
+            std::memcpy(&b32, &x, sizeof(b32));
+            store_uint(p, 4, f.big_endian, b32);
+        } else {
+            std::uint64_t bits;
+            std::memcpy(&bits, &d, sizeof(bits));
+            store_uint(p, 8, f.big_endian, bits);
+        }
+        return;
+    }
+    // 整数字段只接受能精确表示的整数值
+    double lo = f.is_signed ? -std::ldexp(1.0, 8 * f.size - 1) : 0.0;
+    double hi = f.is_signed ? std::ldexp(1.0, 8 * f.size - 1) : std::ldexp(1.0, 8 * f.size);
+    if (!(d >= lo && d < hi) || d != std::floor(d)) {
+        throw std::runtime_error("Value " + value.toString() + " does not fit in field type '" + f.name + "'.");
+    }
+    std::uint64_t bits = d < 0 ? static_cast<std::uint64_t>(static_cast<std::int64_t>(d)) : static_cast<std::uint64_t>(d);
+    store_uint(p, f.size, f.big_endian, bits);
+}
+
+class BytesValue final : public NativeObject {
+public:
+    std::shared_ptr<ByteStorage> store;
+    size_t off = 0;
+    size_t len = 0;
+
+    explicit BytesValue(std::vector<unsigned char> bytes) : store(std::make_shared<ByteStorage>()) {
+        store->owned = std::move(bytes);
+        len = store->owned.size();
+    }
+    BytesValue(std::shared_ptr<ByteStorage> s, size_t o, size_t n) : store(std::move(s)), off(o), len(n) {}
+
+    const unsigned char* data() const { return store->data() + off; }
+    unsigned char* mutableData() { return store->mutableData() + off; }
+    std::string_view view() const { return std::string_view(reinterpret_cast<const char*>(data()), len); }
+
+    // 检查 [pos, pos + n) 在范围内，返回 pos
+    size_t checkedRange(const Value& pos, size_t n, const char* what) const {
+        if (!pos.is<int>() || pos.as<int>() < 0) throw std::runtime_error(std::string(what) + " offset must be a non-negative integer.");
+        size_t p = static_cast<size_t>(pos.as<int>());
+        if (p > len || n > len - p) throw std::runtime_error(std::string(what) + " reads or writes past the end of the Bytes.");
+        return p;
+    }
+
+    std::string typeName() const override { return "Bytes"; }
+    std::string toString() const override {
+        static const char digits[] = "0123456789abcdef";
+        std::string result = "Bytes(" + std::to_string(len) + (len == 1 ? " byte" : " bytes");
+        const size_t shown = std::min<size_t>(len, 32);
+        if (shown > 0) result += ":";
+        for (size_t i = 0; i < shown; ++i) {
+            result += ' ';
+            result += digits[data()[i] >> 4];
+            result += digits[data()[i] & 0xF];
+        }
+        if (shown < len) result += " ...";
+        return result + ")";
+    }
+    bool toBool() const override { return len > 0; }
+    int length() const override { return static_cast<int>(std::min<size_t>(len, INT_MAX)); }
+    Value getIndex(const Value& index) override {
+        return Value(static_cast<int>(data()[checkedRange(index, 1, "Bytes index")]));
+    }
+    void setIndex(const Value& index, const Value& value) override {
+        size_t i = checkedRange(index, 1, "Bytes index");
+        if (!value.is<int>() || value.as<int>() < 0 || value.as<int>() > 255) throw std::runtime_error("Bytes elements must be integers from 0 to 255.");
+        mutableData()[i] = static_cast<unsigned char>(value.as<int>());
+    }
+    Value slice(int start, int end) override {
+        return Value(std::static_pointer_cast<NativeObject>(std::make_shared<BytesValue>(store, off + start, static_cast<size_t>(end - start))));
+    }
+    std::unique_ptr<Iterator> iter() override;
+    Value getMember(const std::string& name) override;
+    std::shared_ptr<NativeObject> clone() const override {
+        return std::make_shared<BytesValue>(std::vector<unsigned char>(data(), data() + len));
+    }
+    bool equals(const NativeObject& other) const override {
+        auto* o = dynamic_cast<const BytesValue*>(&other);
+        return o && view() == o->view();
+    }
+};
+
+class BytesIterator final : public Iterator {
+    std::shared_ptr<BytesValue> bytes;
+    size_t pos = 0;
+public:
+    explicit BytesIterator(std::shared_ptr<BytesValue> b) : bytes(std::move(b)) {}
+    bool next(Value& out) override {
+        if (pos >= bytes->len) return false;
+        out = Value(static_cast<int>(bytes->data()[pos++]));
+        return true;
+    }
+};
+
+std::unique_ptr<Iterator> BytesValue::iter() {
+    return std::make_unique<BytesIterator>(std::static_pointer_cast<BytesValue>(shared_from_this()));
+}
+
+// 字节内容的来源：Bytes、字符串，或由 0..255 组成的数组/序列
+static std::vector<unsigned char> bytes_from(const Value& source, const char* what) {
+    if (source.is<StringData>()) {
+        const std::string& s = source.as<StringData>().get();
+        return std::vector<unsigned char>(s.begin(), s.end());
+    }
+    if (source.is<Value::NativeType>()) {
+        if (auto* b = dynamic_cast<const BytesValue*>(source.as<Value::NativeType>().get())) {
+            return std::vector<unsigned char>(b->data(), b->data() + b->len);
+        }
+    }
+    std::vector<unsigned char> out;
+    auto it = sequence_iterator(source, what);
+    Value v;
+    while (it->next(v)) {
+        if (!v.is<int>() || v.as<int>() < 0 || v.as<int>() > 255) throw std::runtime_error(std::string(what) + " elements must be integers from 0 to 255.");
+        out.push_back(static_cast<unsigned char>(v.as<int>()));
+    }
+    return out;
+}
+
+Value BytesValue::getMember(const std::string& name) {
+    auto self = std::static_pointer_cast<BytesValue>(shared_from_this());
+    if (name == "read") {
+        return native_method(name, 2, [self](const std::vector<Value>& args) -> Value {
+            ByteField f = byte_field(args[0]);
+            return load_field(self->data() + self->checkedRange(args[1], f.size, "Bytes.read()"), f);
+        });
+    }
+    if (name == "write") {
+        return native_method(name, 3, [self](const std::vector<Value>& args) -> Value {
+            ByteField f = byte_field(args[0]);
+            size_t pos = self->checkedRange(args[1], f.size, "Bytes.write()");
+            store_field(self->mutableData() + pos, f, args[2]);
+            return Value();
+        });
+    }
+    if (name == "read_array") {
+        // 连续 count 个字段一次读出：不超过 32 位的有符号整数与 u8/u16 → Int32Array，其余 → Float64Array
+        return native_method(name, 3, [self](const std::vector<Value>& args) -> Value {
+            ByteField f = byte_field(args[0]);
+            if (!args[2].is<int>() || args[2].as<int>() < 0) throw std::runtime_error("Bytes.read_array() count must be a non-negative integer.");
+            size_t n = static_cast<size_t>(args[2].as<int>());
+            if (n > self->len / static_cast<size_t>(f.size) + 1) throw std::runtime_error("Bytes.read_array() reads or writes past the end of the Bytes.");
+            const unsigned char* p = self->data() + self->checkedRange(args[1], n * f.size, "Bytes.read_array()");
+            if (!f.is_float && (f.size < 4 || (f.size == 4 && f.is_signed))) {
+                std::vector<std::int32_t> out(n);
+                const int shift = 32 - 8 * f.size;
+                for (size_t i = 0; i < n; ++i, p += f.size) {
+                    auto bits = static_cast<std::uint32_t>(load_uint(p, f.size, f.big_endian));
+                    out[i] = f.is_signed ? static_cast<std::int32_t>(bits << shift) >> shift : static_cast<std::int32_t>(bits);
+                }
+                return typed_array_value(std::move(out));
+            }
+            std::vector<double> out(n);
+            for (size_t i = 0; i < n; ++i, p += f.size) {
+                Value v = load_field(p, f);
+                out[i] = v.is<int>() ? v.as<int>() : v.as<double>();
+            }
+            return typed_array_value(std::move(out));
+        });
+    }
+    if (name == "write_array") {
+        return native_method(name, 3, [self](const std::vector<Value>& args) -> Value {
+            ByteField f = byte_field(args[0]);
+            std::vector<Value> values;
+            auto it = sequence_iterator(args[2], "Bytes.write_array()");
+            Value v;
+            while (it->next(v)) values.push_back(v);
+            size_t pos = self->checkedRange(args[1], values.size() * f.size, "Bytes.write_array()");
+            unsigned char* p = self->mutableData() + pos;
+            for (const auto& x : values) {
+                store_field(p, f, x);
+                p += f.size;
+            }
+            return Value();
+        });
+    }
+    if (name == "extend") {
+        // 只有位于缓冲区末尾的 Bytes 才能追加；追加不影响共享同一缓冲区的其他视图
+        return native_method(name, 1, [self](const std::vector<Value>& args) -> Value {
+            std::vector<unsigned char> more = bytes_from(args[0], "Bytes.extend()");
+            if (self->store->readonly()) throw std::runtime_error("Bytes backed by a mapped file are read-only; use copy() first.");
+            if (self->off + self->len != self->store->size()) throw std::runtime_error("Bytes.extend() is only allowed on a Bytes that ends at the end of its buffer; use copy() first.");
+            self->store->owned.insert(self->store->owned.end(), more.begin(), more.end());
+            self->len += more.size();
+            return Value();
+        });
+    }
+    if (name == "find") {
+        return native_method(name, -1, [self](const std::vector<Value>& args) -> Value {
+            if (args.empty() || args.size() > 2) throw std::runtime_error("Bytes.find() takes a needle and an optional start index.");
+            std::vector<unsigned char> needle = bytes_from(args[0], "Bytes.find()");
+            size_t start = 0;
+            if (args.size() == 2) {
+                if (!args[1].is<int>() || args[1].as<int>() < 0) throw std::runtime_error("Bytes.find() start must be a non-negative integer.");
+                start = static_cast<size_t>(args[1].as<int>());
+            }
+            size_t pos = self->view().find(std::string_view(reinterpret_cast<const char*>(needle.data()), needle.size()), start);
+            if (pos == std::string_view::npos || pos > static_cast<size_t>(INT_MAX)) return Value(-1);
+            return Value(static_cast<int>(pos));
+        });
+    }
+    if (name == "to_string") {
+        return native_method(name, 0, [self](const std::vector<Value>&) { return Value(std::string(self->view())); });
+    }
+    if (name == "hex") {
+        return native_method(name, 0, [self](const std::vector<Value>&) -> Value {
+            static const char digits[] = "0123456789abcdef";
+            std::string out;
+            out.reserve(self->len * 2);
+            for (size_t i = 0; i < self->len; ++i) {
+                out += digits[self->data()[i] >> 4];
+                out += digits[self->data()[i] & 0xF];
+            }
+            return Value(std::move(out));
+        });
+    }
+    if (name == "copy") {
+        return native_method(name, 0, [self](const std::vector<Value>&) { return Value(self->clone()); });
+    }
+    if (name == "to_array") {
+        return native_method(name, 0, [self](const std::vector<Value>&) { return Value(self->toArray()); });
+    }
+    return NativeObject::getMember(name);
+}
+
+static Value bytes_value(std::vector<unsigned char> bytes) {
+    return Value(std::static_pointer_cast<NativeObject>(std::make_shared<BytesValue>(std::move(bytes))));
+}
+
+// ---- CSV 读取 (csv / read_csv) ----
+
+// 在 [p, end) 中找到第一个分隔符、引号、'\n' 或 '\r'，找不到时返回 end。
+// 普通字段里这些字符很稀疏，SSE2 一次比较 16 个字节
+static const char* csv_scan_scalar(const char* p, const char* end, char delim) {
+    for (; p < end; ++p) {
+        char c = *p;
+        if (c == delim || c == '"' || c == '\n' || c == '\r') return p;
+    }
+    return end;
+}
+
+#ifdef MINILANG_X86_SIMD
+MINILANG_TARGET("sse2") static const char* csv_scan_sse2(const char* p, const char* end, char delim) {
+    const __m128i d = _mm_set1_epi8(delim);
+    const __m128i q = _mm_set1_epi8('"');
+    const __m128i nl = _mm_set1_epi8('\n');
+    const __m128i cr = _mm_set1_epi8('\r');
+    for (; p + 16 <= end; p += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, d), _mm_cmpeq_epi8(v, q)),
+                                   _mm_or_si128(_mm_cmpeq_epi8(v, nl), _mm_cmpeq_epi8(v, cr)));
+        int mask = _mm_movemask_epi8(hit);
+        if (mask != 0) return p + __builtin_ctz(static_cast<unsigned>(mask));
+    }
+    return csv_scan_scalar(p, end, delim);
+}
+#endif
+
+static const char* csv_scan(const char* p, const char* end, char delim) {
+#ifdef MINILANG_X86_SIMD
+    if (simd_level != SimdLevel::SCALAR) return csv_scan_sse2(p, end, delim);
+#endif
+    return csv_scan_scalar(p, end, delim);
+}
+
+// 单元格类型推断：整列都是整数 → Int32Array，都是数字 → Float64Array，否则为字符串数组。
+// 空单元格不影响推断，在数值列中为 NaN（整数列因此升级为浮点列），在字符串列中为 ""
+enum class CsvKind { EMPTY, INT, FLOAT, STRING };
+
+static CsvKind csv_classify(std::string_view cell) {
+    if (cell.empty()) return CsvKind::EMPTY;
+    const char* first = cell.data();
+    const char* last = first + cell.size();
+    int i;
+    auto ri = std::from_chars(first, last, i);
+    if (ri.ec == std::errc() && ri.ptr == last) return CsvKind::INT;
+    // from_chars 也接受 nan/inf/infinity，这些文字（如人名 "Nan"）应保持为字符串
+    size_t digit = cell[0] == '-' ? 1 : 0;
+    if (digit >= cell.size() || !(std::isdigit(static_cast<unsigned char>(cell[digit])) || cell[digit] == '.')) return CsvKind::STRING;
+    double d = 0.0;
+    auto rd = std::from_chars(first, last, d);
+    if (rd.ec == std::errc() && rd.ptr == last) return CsvKind::FLOAT;
+    return CsvKind::STRING;
+}
+
+static Value csv_cell_value(std::string_view cell, bool convert) {
+    if (convert) {
+        switch (csv_classify(cell)) {
+            case CsvKind::INT: {
+                int i = 0;
+                std::from_chars(cell.data(), cell.data() + cell.size(), i);
+                return Value(i);
+            }
+            case CsvKind::FLOAT: {
+                double d = 0.0;
+                std::from_chars(cell.data(), cell.data() + cell.size(), d);
+                return Value(d);
+            }
+            default: break;
+        }
+    }
+    return Value(std::string(cell));
+}
+
+// 一列的原始文本连续存放在一个字符串里，只记录每个单元格的结束位置；批次结束时按推断出的类型一次性转换
+struct CsvColumnBuilder {
+    std::string text;
+    std::vector<size_t> ends;
+    CsvKind kind = CsvKind::EMPTY;
+
+    std::string_view cell(size_t i) const {
+        size_t b = i == 0 ? 0 : ends[i - 1];
+        return std::string_view(text).substr(b, ends[i] - b);
+    }
+    void add(std::string_view value) {
+        CsvKind k = kind == CsvKind::STRING ? CsvKind::STRING : csv_classify(value);
+        if (k == CsvKind::STRING) kind = CsvKind::STRING;
+        else if (k == CsvKind::FLOAT && kind != CsvKind::STRING) kind = CsvKind::FLOAT;
+        else if (k == CsvKind::INT && kind == CsvKind::EMPTY) kind = CsvKind::INT;
+        text.append(value);
+        ends.push_back(text.size());
+    }
+    // 转换为列值；kind 被更新为实际采用的类型（有空单元格的整数列按浮点列处理）
+    Value finish() {
+        const size_t n = ends.size();
+        if (kind == CsvKind::INT) {
+            for (size_t i = 0; i < n; ++i) {
+                if (cell(i).empty()) {
+                    kind = CsvKind::FLOAT;
+                    break;
+                }
+            }
+        }
+        if (kind == CsvKind::INT) {
+            std::vector<std::int32_t> out(n);
+            for (size_t i = 0; i < n; ++i) {
+                std::string_view c = cell(i);
+                std::from_chars(c.data(), c.data() + c.size(), out[i]);
+            }
+            return typed_array_value(std::move(out));
+        }
+        if (kind == CsvKind::FLOAT) {
+            std::vector<double> out(n, std::numeric_limits<double>::quiet_NaN());
+            for (size_t i = 0; i < n; ++i) {
+                std::string_view c = cell(i);
+                if (!c.empty()) std::from_chars(c.data(), c.data() + c.size(), out[i]);
+            }
+            return typed_array_value(std::move(out));
+        }
+        auto arr = std::make_shared<ArrayValue>();
+        arr->elements.reserve(n);
+        for (size_t i = 0; i < n; ++i) arr->elements.push_back(Value(std::string(cell(i))));
+        return Value(arr);
+    }
+};
+
+// csv(path, [options]) 返回的读取器。文件按 1MB 的块读入，逐条解析记录，任何时候只持有当前块和当前记录。
+// 支持 RFC 4180 的引号规则：引号内可以包含分隔符和换行，"" 表示一个引号字符
+class CsvReaderValue final : public NativeObject {
+    static constexpr size_t CHUNK = 1 << 20;
+    std::string path;
+    std::ifstream stream;
+    std::string buf;
+    size_t pos = 0;
+    bool exhausted = false;
+    std::vector<std::string> record; // 复用的字段缓冲区，避免每条记录重新分配
+    size_t field_count = 0;
+    std::vector<CsvKind> column_kinds; // 之前批次推断出的列类型，保证同一列在各批次中类型一致
+
+    bool refill() {
+        if (exhausted) return false;
+        buf.resize(CHUNK);
+        stream.read(buf.data(), static_cast<std::streamsize>(CHUNK));
+        buf.resize(static_cast<size_t>(stream.gcount()));
+        pos = 0;
+        if (buf.empty()) exhausted = true;
+        return !buf.empty();
+    }
+    // 保证 buf[pos] 可读；文件结束时返回 false
+    bool more() { return pos < buf.size() || refill(); }
+
+    std::string& nextField() {
+        if (field_count == record.size()) record.emplace_back();
+        std::string& f = record[field_count++];
+        f.clear();
+        return f;
+    }
+
+    // 读取一条记录到 record[0, field_count)；没有更多记录时返回 false。空行被跳过
+    bool readRecord() {
+        for (;;) {
+            field_count = 0;
+            if (!more()) return false;
+            char c = buf[pos];
+            if (c == '\n' || c == '\r') { // 空行
+                ++pos;
+                continue;
+            }
+            break;
+        }
+        std::string* field = &nextField();
+        bool at_field_start = true;
+        while (more()) {
+            if (at_field_start && buf[pos] == '"') {
+                ++pos;
+                for (;;) { // 引号内：只有 '"' 是特殊字符
+                    if (!more()) throw std::runtime_error("Unterminated quoted field in CSV file: " + path);
+                    const char* start = buf.data() + pos;
+                    const char* q = static_cast<const char*>(std::memchr(start, '"', buf.size() - pos));
+                    if (!q) {
+                        field->append(start, buf.size() - pos);
+                        pos = buf.size();
+                        continue;
+                    }
+                    field->append(start, static_cast<size_t>(q - start));
+                    pos = static_cast<size_t>(q - buf.data()) + 1;
+                    if (more() && buf[pos] == '"') {
+                        *field += '"';
+                        ++pos;
+                        continue;
+                    }
+                    break;
+                }
+                at_field_start = false;
+                continue;
+            }
+            at_field_start = false;
+            const char* start = buf.data() + pos;
+            const char* end = buf.data() + buf.size();
+            const char* hit = csv_scan(start, end, delimiter);
+            field->append(start, static_cast<size_t>(hit - start));
+            pos = static_cast<size_t>(hit - buf.data());
+            if (hit == end) continue;
+            char c = *hit;
+            ++pos;
+            if (c == delimiter) {
+                field = &nextField();
+                at_field_start = true;
+            } else if (c == '"') {
+                *field += '"'; // 未加引号的字段中间出现的引号按普通字符处理
+            } else {
+                if (c == '\r' && more() && buf[pos] == '\n') ++pos;
+                return true;
+            }
+        }
+        return true; // 文件末尾没有换行的最后一条记录
+    }
+
+public:
+    char delimiter = ',';
+    bool convert = true;   // 行模式下把数字单元格转换为 int/float
+    bool as_dicts = false; // 行模式下每行产出字典而不是数组
+    std::vector<Value> header;
+
+    CsvReaderValue(std::string p, const Value& options) : path(std::move(p)) {
+        stream.open(path, std::ios::binary);
+        if (!stream) throw std::runtime_error("Could not open file: " + path);
+        bool has_header = true;
+        if (!options.is<std::monostate>()) {
+            if (!options.is<Value::DictType>()) throw std::runtime_error("CSV options must be a dict.");
+            const auto& opts = *options.as<Value::DictType>();
+            if (const Value* v = opts.find(Value("delimiter"))) {
+                if (!v->is<StringData>() || v->as<StringData>().get().size() != 1) throw std::runtime_error("CSV delimiter must be a single character.");
+                delimiter = v->as<StringData>().get()[0];
+                if (delimiter == '"' || delimiter == '\n' || delimiter == '\r') throw std::runtime_error("Invalid CSV delimiter.");
+            }
+            if (const Value* v = opts.find(Value("header"))) has_header = v->toBool();
+            if (const Value* v = opts.find(Value("convert"))) convert = v->toBool();
+            if (const Value* v = opts.find(Value("dicts"))) as_dicts = v->toBool();
+        }
+        if (has_header && readRecord()) {
+            for (size_t i = 0; i < field_count; ++i) header.push_back(Value(StringData::from_literal(record[i])));
+        }
+    }
+
+    std::string typeName() const override { return "CsvReader"; }
+    std::string toString() const override { return "<CsvReader " + path + ">"; }
+    std::unique_ptr<Iterator> iter() override;
+    Value getMember(const std::string& name) override;
+
+    // 第 i 列的名字：有表头时取表头，否则（或表头不够长时）为 "c<i>"
+    Value columnName(size_t i) const {
+        if (i < header.size()) return header[i];
+        return Value(StringData::from_literal("c" + std::to_string(i)));
+    }
+
+    // 读取下一行，按当前模式构造数组或字典
+    bool nextRow(Value& out) {
+        if (!readRecord()) return false;
+        if (as_dicts) {
+            auto dict = std::make_shared<DictValue>();
+            dict->reserve(field_count);
+            for (size_t i = 0; i < field_count; ++i) dict->set(columnName(i), csv_cell_value(record[i], convert));
+            out = Value(dict);
+        } else {
+            auto arr = std::make_shared<ArrayValue>();
+            arr->elements.reserve(field_count);
+            for (size_t i = 0; i < field_count; ++i) arr->elements.push_back(csv_cell_value(record[i], convert));
+            out = Value(arr);
+        }
+        return true;
+    }
+
+    // 读取至多 limit 行，按列返回 {列名: 类型化列}；没有剩余行时返回 nil
+    Value readColumns(size_t limit) {
+        std::vector<CsvColumnBuilder> columns(std::max(header.size(), column_kinds.size()));
+        for (size_t c = 0; c < column_kinds.size(); ++c) columns[c].kind = column_kinds[c];
+        size_t rows = 0;
+        while (rows < limit && readRecord()) {
+            if (field_count > columns.size()) {
+                // 比之前的行多出来的列：前面的行在这些列上补空单元格
+                size_t old = columns.size();
+                columns.resize(field_count);
+                for (size_t c = old; c < field_count; ++c) {
+                    for (size_t r = 0; r < rows; ++r) columns[c].add(std::string_view());
+                }
+            }
+            for (size_t c = 0; c < columns.size(); ++c) {
+                columns[c].add(c < field_count ? std::string_view(record[c]) : std::string_view());
+            }
+            ++rows;
+        }
+        if (rows == 0) return Value();
+        auto result = std::make_shared<DictValue>();
+        result->reserve(columns.size());
+        column_kinds.resize(columns.size());
+        for (size_t c = 0; c < columns.size(); ++c) {
+            result->set(columnName(c), columns[c].finish());
+            column_kinds[c] = columns[c].kind;
+        }
+        return Value(result);
+    }
+    // 剩余的全部行；没有数据行时仍然为每个表头返回一个空列
+    Value readAllColumns() {
+        Value cols = readColumns(SIZE_MAX);
+        if (!cols.is<std::monostate>()) return cols;
+        auto empty = std::make_shared<DictValue>();
+        for (const auto& h : header) empty->set(h, Value(std::make_shared<ArrayValue>()));
+        return Value(empty);
+    }
+};
+
+class CsvRowIterator final : public Iterator {
+    std::shared_ptr<CsvReaderValue> reader;
+public:
+    explicit CsvRowIterator(std::shared_ptr<CsvReaderValue> r) : reader(std::move(r)) {}
+    bool next(Value& out) override { return reader->nextRow(out); }
+};
+
+std::unique_ptr<Iterator> CsvReaderValue::iter() {
+    return std::make_unique<CsvRowIterator>(std::static_pointer_cast<CsvReaderValue>(shared_from_this()));
+}
+
+Value CsvReaderValue::getMember(const std::string& name) {
+    auto self = std::static_pointer_cast<CsvReaderValue>(shared_from_this());
+    if (name == "header") {
+        auto arr = std::make_shared<ArrayValue>();
+        arr->elements = CowVector(header);
+        return Value(arr);
+    }
+    if (name == "read_row") {
+        return native_method(name, 0, [self](const std::vector<Value>&) -> Value {
+            Value row;
+            self->nextRow(row);
+            return row;
+        });
+    }
+    if (name == "read_batch") {
+        return native_method(name, 1, [self](const std::vector<Value>& args) -> Value {
+            if (!args[0].is<int>() || args[0].as<int>() <= 0) throw std::runtime_error("CsvReader.read_batch() size must be a positive integer.");
+            return self->readColumns(static_cast<size_t>(args[0].as<int>()));
+        });
+    }
+    if (name == "columns") {
+        return native_method(name, 0, [self](const std::vector<Value>&) { return self->readAllColumns(); });
+    }
+    return NativeObject::getMember(name);
+}
+
+// ---- 列式数据表 (DataFrame) ----
+
+// 一列数据。整数列与浮点列直接存放原始数值；字符串列做字典编码：每个不同的字符串只存一份，
+// 行里只存 int32 编码，分组、过滤、连接时比较的都是整数。缺失值在浮点列中为 NaN
+struct DfColumn {
+    enum class Kind { INT, FLOAT, STRING };
+    Kind kind = Kind::INT;
+    std::vector<std::int32_t> ints;                // INT 的值；STRING 的字典编码
+    std::vector<double> floats;                    // FLOAT 的值
+    std::shared_ptr<std::vector<StringData>> dict; // STRING 的字典，可在多个列之间共享
+
+    size_t size() const { return kind == Kind::FLOAT ? floats.size() : ints.size(); }
+    bool numeric() const { return kind != Kind::STRING; }
+    double number(size_t i) const { return kind == Kind::FLOAT ? floats[i] : static_cast<double>(ints[i]); }
+    Value at(size_t i) const {
+        switch (kind) {
+            case Kind::INT: return Value(ints[i]);
+            case Kind::FLOAT: return Value(floats[i]);
+            default: return Value((*dict)[static_cast<size_t>(ints[i])]);
+        }
+    }
+    const char* kindName() const { return kind == Kind::INT ? "int" : kind == Kind::FLOAT ? "float" : "string"; }
+
+    // 按行号取出新列；行号为 -1 表示缺失（左连接中没有匹配的行）
+    std::shared_ptr<DfColumn> gather(const std::vector<std::int64_t>& rows) const {
+        auto out = std::make_shared<DfColumn>();
+        bool missing = std::any_of(rows.begin(), rows.end(), [](std::int64_t r) { return r < 0; });
+        out->kind = kind == Kind::INT && missing ? Kind::FLOAT : kind;
+        out->dict = dict;
+        if (out->kind == Kind::FLOAT) {
+            out->floats.reserve(rows.size());
+            for (auto r : rows) out->floats.push_back(r < 0 ? std::numeric_limits<double>::quiet_NaN() : number(static_cast<size_t>(r)));
+            return out;
+        }
+        std::int32_t empty_code = 0;
+        if (kind == Kind::STRING && missing) {
+            // 缺失的字符串单元格为 ""：复制一份字典并在末尾加入空串
+            out->dict = std::make_shared<std::vector<StringData>>(*dict);
+            empty_code = static_cast<std::int32_t>(out->dict->size());
+            out->dict->push_back(StringData::from_literal(""));
+        }
+        out->ints.reserve(rows.size());
+        for (auto r : rows) out->ints.push_back(r < 0 ? empty_code : ints[static_cast<size_t>(r)]);
+        return out;
+    }
+
+    // 字典中各字符串按字典序的名次，排序与 min/max 只需比较名次
+    std::vector<std::int32_t> stringRanks() const {
+        std::vector<std::int32_t> order(dict->size());
+        for (size_t i = 0; i < order.size(); ++i) order[i] = static_cast<std::int32_t>(i);
+        std::sort(order.begin(), order.end(), [&](std::int32_t a, std::int32_t b) { return (*dict)[a].get() < (*dict)[b].get(); });
+        std::vector<std::int32_t> rank(order.size());
+        for (size_t i = 0; i < order.size(); ++i) rank[order[i]] = static_cast<std::int32_t>(i);
+        return rank;
+    }
+
+    // 分组用的键原子：同一列内相等的单元格原子相同
+    std::int64_t atom(size_t i) const {
+        if (kind != Kind::FLOAT) return ints[i];
+        double d = floats[i];
+        if (d == 0.0) d = 0.0; // -0.0 与 0.0 归为一组
+        if (std::isnan(d)) d = std::numeric_limits<double>::quiet_NaN();
+        std::int64_t bits;
+        std::memcpy(&bits, &d, sizeof(bits));
+        return bits;
+    }
+};
+using DfColumnPtr = std::shared_ptr<const DfColumn>;
+
+// 从任意值序列构造一列：全是整数（或布尔）→ INT；全是数字或 nil → FLOAT（nil 为 NaN）；否则为字符串列
+static DfColumnPtr df_column_from_values(const std::vector<Value>& values) {
+    auto col = std::make_shared<DfColumn>();
+    bool all_int = true, all_number = true;
+    for (const auto& v : values) {
+        if (v.is<int>() || v.is<bool>()) continue;
+        all_int = false;
+        if (!v.is<double>() && !v.is<std::monostate>()) all_number = false;
+    }
+    if (all_int) {
+        col->kind = DfColumn::Kind::INT;
+        col->ints.reserve(values.size());
+        for (const auto& v : values) col->ints.push_back(v.is<bool>() ? v.as<bool>() : v.as<int>());
+    } else if (all_number) {
+        col->kind = DfColumn::Kind::FLOAT;
+        col->floats.reserve(values.size());
+        for (const auto& v : values) {
+            col->floats.push_back(v.is<int>() ? v.as<int>() : v.is<bool>() ? v.as<bool>()
+                                  : v.is<double>() ? v.as<double>() : std::numeric_limits<double>::quiet_NaN());
+        }
+    } else {
+        col->kind = DfColumn::Kind::STRING;
+        col->dict = std::make_shared<std::vector<StringData>>();
+        std::unordered_map<std::string, std::int32_t> codes;
+        col->ints.reserve(values.size());
+        for (const auto& v : values) {
+            StringData str = v.is<StringData>() ? v.as<StringData>() : StringData(v.is<std::monostate>() ? std::string() : v.toString());
+            auto [it, inserted] = codes.try_emplace(str.get(), static_cast<std::int32_t>(col->dict->size()));
+            if (inserted) col->dict->push_back(str);
+            col->ints.push_back(it->second);
+        }
+    }
+    return col;
+}
+
+static DfColumnPtr df_column_from(const Value& source) {
+    if (source.is<Value::NativeType>()) {
+        const auto& native = source.as<Value::NativeType>();
+        if (auto* ints = dynamic_cast<const Int32ArrayValue*>(native.get())) {
+            auto col = std::make_shared<DfColumn>();
+            col->ints = ints->data;
+            return col;
+        }
+        if (auto* floats = dynamic_cast<const Float64ArrayValue*>(native.get())) {
+            auto col = std::make_shared<DfColumn>();
+            col->kind = DfColumn::Kind::FLOAT;
+            col->floats = floats->data;
+            return col;
+        }
+    }
+    std::vector<Value> values;
+    auto it = make_iterator(source);
+    Value v;
+    while (it->next(v)) values.push_back(v);
+    return df_column_from_values(values);
+}
 
-            auto newArr = std::make_shared<ArrayValue>();
-            Value newArrVal(newArr);
-            memo[ptr] = newArrVal;
+static Value df_column_value(const DfColumn& col) {
+    switch (col.kind) {
+        case DfColumn::Kind::INT: return typed_array_value(col.ints);
+        case DfColumn::Kind::FLOAT: return typed_array_value(col.floats);
+        default: {
+            auto arr = std::make_shared<ArrayValue>();
+            arr->elements.reserve(col.ints.size());
+            for (auto code : col.ints) arr->elements.push_back(Value((*col.dict)[static_cast<size_t>(code)]));
+            return Value(arr);
+        }
+    }
+}
 
-            newArr->elements.reserve(arr->elements.size());
-            for (const auto& elem : arr->elements) {
-                newArr->elements.push_back(deepcopy_recursive(elem, memo));
+// 不可变的表：所有操作都返回新表，未改动的列在新旧表之间共享
+class DataFrameValue final : public NativeObject {
+public:
+    std::vector<std::string> names;
+    std::vector<DfColumnPtr> columns;
+    size_t rows = 0;
+
+    void addColumn(const std::string& name, DfColumnPtr col) {
+        if (indexOf(name) >= 0) throw std::runtime_error("Duplicate DataFrame column '" + name + "'.");
+        if (!columns.empty() && col->size() != rows) {
+            throw std::runtime_error("DataFrame column '" + name + "' has " + std::to_string(col->size()) + " rows, expected " + std::to_string(rows) + ".");
+        }
+        if (columns.empty()) rows = col->size();
+        names.push_back(name);
+        columns.push_back(std::move(col));
+    }
+    int indexOf(const std::string& name) const {
+        for (size_t i = 0; i < names.size(); ++i) if (names[i] == name) return static_cast<int>(i);
+        return -1;
+    }
+    const DfColumn& column(const std::string& name) const {
+        int i = indexOf(name);
+        if (i < 0) throw std::runtime_error("DataFrame has no column '" + name + "'.");
+        return *columns[i];
+    }
+    std::vector<std::string> columnList(const Value& spec, const char* what) const {
+        std::vector<std::string> out;
+        if (spec.is<StringData>()) {
+            out.push_back(spec.as<StringData>().get());
+        } else if (spec.is<Value::ArrayType>()) {
+            for (const auto& v : spec.as<Value::ArrayType>()->elements) {
+                if (!v.is<StringData>()) throw std::runtime_error(std::string(what) + " column names must be strings.");
+                out.push_back(v.as<StringData>().get());
             }
+        } else {
+            throw std::runtime_error(std::string(what) + " expects a column name or an array of column names.");
+        }
+        for (const auto& n : out) column(n); // 校验列存在
+        return out;
+    }
 
-            return newArrVal;
-        },
+    Value rowDict(size_t r) const {
+        auto dict = std::make_shared<DictValue>();
+        dict->reserve(names.size());
+        for (size_t c = 0; c < names.size(); ++c) dict->set(Value(StringData::from_literal(names[c])), columns[c]->at(r));
+        return Value(dict);
+    }
+    std::shared_ptr<DataFrameValue> gather(const std::vector<std::int64_t>& rowIds) const {
+        auto out = std::make_shared<DataFrameValue>();
+        out->rows = rowIds.size();
+        for (size_t c = 0; c < names.size(); ++c) {
+            out->names.push_back(names[c]);
+            out->columns.push_back(columns[c]->gather(rowIds));
+        }
+        return out;
+    }
+
+    std::string typeName() const override { return "DataFrame"; }
+    std::string toString() const override;
+    bool toBool() const override { return rows > 0; }
+    int length() const override { return static_cast<int>(rows); }
+    Value getIndex(const Value& index) override {
+        if (index.is<StringData>()) return df_column_value(column(index.as<StringData>().get()));
+        if (index.is<int>()) {
+            int r = index.as<int>();
+            if (r < 0 || r >= static_cast<int>(rows)) throw std::runtime_error("DataFrame row index out of bounds");
+            return rowDict(static_cast<size_t>(r));
+        }
+        throw std::runtime_error("DataFrame index must be a column name or a row number.");
+    }
+    Value slice(int start, int end) override {
+        std::vector<std::int64_t> ids;
+        for (int r = start; r < end; ++r) ids.push_back(r);
+        return Value(std::static_pointer_cast<NativeObject>(gather(ids)));
+    }
+    std::unique_ptr<Iterator> iter() override;
+    Value getMember(const std::string& name) override;
+
+    std::shared_ptr<DataFrameValue> filterMask(const std::vector<bool>& keep) const {
+        std::vector<std::int64_t> ids;
+        for (size_t r = 0; r < rows; ++r) if (keep[r]) ids.push_back(static_cast<std::int64_t>(r));
+        return gather(ids);
+    }
+    std::shared_ptr<DataFrameValue> filterCompare(const std::string& name, const std::string& op, const Value& rhs) const;
+    std::shared_ptr<DataFrameValue> sortBy(const std::vector<std::string>& keys, bool descending) const;
+    std::shared_ptr<DataFrameValue> join(const DataFrameValue& right, const std::vector<std::string>& on, bool left_join) const;
+};
+
+class DataFrameRowIterator final : public Iterator {
+    std::shared_ptr<DataFrameValue> frame;
+    size_t pos = 0;
+public:
+    explicit DataFrameRowIterator(std::shared_ptr<DataFrameValue> f) : frame(std::move(f)) {}
+    bool next(Value& out) override {
+        if (pos >= frame->rows) return false;
+        out = frame->rowDict(pos++);
+        return true;
+    }
+};
+
+std::unique_ptr<Iterator> DataFrameValue::iter() {
+    return std::make_unique<DataFrameRowIterator>(std::static_pointer_cast<DataFrameValue>(shared_from_this()));
+}
+
+// 表格形式的预览，最多显示前 10 行
+std::string DataFrameValue::toString() const {
+    const size_t shown = std::min<size_t>(rows, 10);
+    std::vector<std::vector<std::string>> cells(names.size());
+    std::vector<size_t> width(names.size());
+    for (size_t c = 0; c < names.size(); ++c) {
+        width[c] = names[c].size();
+        for (size_t r = 0; r < shown; ++r) {
+            cells[c].push_back(columns[c]->at(r).toString());
+            width[c] = std::max(width[c], cells[c].back().size());
+        }
+    }
+    std::string result = "DataFrame(" + std::to_string(rows) + " rows x " + std::to_string(names.size()) + " columns)";
+    auto emit_row = [&](auto&& cell_of) {
+        result += "\n";
+        for (size_t c = 0; c < names.size(); ++c) {
+            const std::string& text = cell_of(c);
+            result += "  " + text + std::string(width[c] - text.size(), ' ');
+        }
+        while (!result.empty() && result.back() == ' ') result.pop_back();
+    };
+    emit_row([&](size_t c) -> const std::string& { return names[c]; });
+    for (size_t r = 0; r < shown; ++r) emit_row([&](size_t c) -> const std::string& { return cells[c][r]; });
+    if (shown < rows) result += "\n  ...";
+    return result;
+}
+
+std::shared_ptr<DataFrameValue> DataFrameValue::filterCompare(const std::string& name, const std::string& op, const Value& rhs) const {
+    const DfColumn& col = column(name);
+    auto test = [&op](int c) {
+        if (op == "==") return c == 0;
+        if (op == "!=") return c != 0;
+        if (op == "<") return c < 0;
+        if (op == "<=") return c <= 0;
+        if (op == ">") return c > 0;
+        return c >= 0;
+    };
+    if (op != "==" && op != "!=" && op != "<" && op != "<=" && op != ">" && op != ">=") {
+        throw std::runtime_error("Unknown DataFrame.filter() operator '" + op + "'.");
+    }
+    std::vector<bool> keep(rows);
+    if (col.numeric()) {
+        if (!rhs.is<int>() && !rhs.is<double>()) throw std::runtime_error("Column '" + name + "' is numeric; compare it with a number.");
+        double v = rhs.is<int>() ? rhs.as<int>() : rhs.as<double>();
+        for (size_t r = 0; r < rows; ++r) {
+            double x = col.number(r);
+            keep[r] = !std::isnan(x) && test((x > v) - (x < v));
+        }
+        return filterMask(keep);
+    }
+    if (!rhs.is<StringData>()) throw std::runtime_error("Column '" + name + "' holds strings; compare it with a string.");
+    // 先对字典里的每个不同字符串求一次结果，再按编码查表
+    const std::string& v = rhs.as<StringData>().get();
+    std::vector<char> code_ok(col.dict->size());
+    for (size_t i = 0; i < code_ok.size(); ++i) code_ok[i] = test((*col.dict)[i].get().compare(v));
+    for (size_t r = 0; r < rows; ++r) keep[r] = code_ok[static_cast<size_t>(col.ints[r])];
+    return filterMask(keep);
+}
+
+std::shared_ptr<DataFrameValue> DataFrameValue::sortBy(const std::vector<std::string>& keys, bool descending) const {
+    struct Key {
+        const DfColumn* col;
+        std::vector<std::int32_t> ranks;
+    };
+    std::vector<Key> spec;
+    for (const auto& k : keys) {
+        const DfColumn& col = column(k);
+        spec.push_back({ &col, col.kind == DfColumn::Kind::STRING ? col.stringRanks() : std::vector<std::int32_t>() });
+    }
+    std::vector<std::int64_t> order(rows);
+    for (size_t r = 0; r < rows; ++r) order[r] = static_cast<std::int64_t>(r);
+    auto cmp_rows = [&](std::int64_t a, std::int64_t b) {
+        for (const auto& key : spec) {
+            const DfColumn& col = *key.col;
+            int c;
+            if (col.kind == DfColumn::Kind::STRING) {
+                std::int32_t ra = key.ranks[col.ints[a]], rb = key.ranks[col.ints[b]];
+                c = (ra > rb) - (ra < rb);
+            } else if (col.kind == DfColumn::Kind::INT) {
+                c = (col.ints[a] > col.ints[b]) - (col.ints[a] < col.ints[b]);
+            } else {
+                double x = col.floats[a], y = col.floats[b];
+                if (std::isnan(x) || std::isnan(y)) {
+                    c = std::isnan(x) - std::isnan(y); // NaN 总是排在最后，不受 descending 影响
+                    if (c != 0) return c < 0;
+                    continue;
+                }
+                c = (x > y) - (x < y);
+            }
+            if (c != 0) return descending ? c > 0 : c < 0;
+        }
+        return false;
+    };
+    std::stable_sort(order.begin(), order.end(), cmp_rows);
+    return gather(order);
+}
+
+std::shared_ptr<DataFrameValue> DataFrameValue::join(const DataFrameValue& right, const std::vector<std::string>& on, bool left_join) const {
+    std::vector<const DfColumn*> lk, rk;
+    for (const auto& k : on) {
+        lk.push_back(&column(k));
+        rk.push_back(&right.column(k));
+    }
+    auto row_hash = [](const std::vector<const DfColumn*>& cols, size_t r) {
+        size_t h = 0;
+        for (const auto* c : cols) h = h * 1000003 ^ hash_key(c->at(r));
+        return h;
+    };
+    // 右表建哈希表：head[槽] 指向链表第一行，next[行] 指向同一槽的下一行（保持右表的行序）
+    size_t cap = 1;
+    while (cap < right.rows * 2) cap <<= 1;
+    std::vector<std::int64_t> head(cap, -1), next(right.rows, -1), tail(cap, -1);
+    std::vector<size_t> hashes(right.rows);
+    for (size_t r = 0; r < right.rows; ++r) {
+        hashes[r] = row_hash(rk, r);
+        size_t slot = hashes[r] & (cap - 1);
+        if (tail[slot] < 0) head[slot] = static_cast<std::int64_t>(r);
+        else next[tail[slot]] = static_cast<std::int64_t>(r);
+        tail[slot] = static_cast<std::int64_t>(r);
+    }
+    std::vector<std::int64_t> left_ids, right_ids;
+    for (size_t l = 0; l < rows; ++l) {
+        size_t h = row_hash(lk, l);
+        bool matched = false;
+        for (std::int64_t r = head[h & (cap - 1)]; r >= 0; r = next[r]) {
+            if (hashes[r] != h) continue;
+            bool equal = true;
+            for (size_t k = 0; k < on.size() && equal; ++k) equal = keys_equal(lk[k]->at(l), rk[k]->at(static_cast<size_t>(r)));
+            if (!equal) continue;
+            left_ids.push_back(static_cast<std::int64_t>(l));
+            right_ids.push_back(r);
+            matched = true;
+        }
+        if (!matched && left_join) {
+            left_ids.push_back(static_cast<std::int64_t>(l));
+            right_ids.push_back(-1);
+        }
+    }
+    auto out = gather(left_ids);
+    for (size_t c = 0; c < right.names.size(); ++c) {
+        if (std::find(on.begin(), on.end(), right.names[c]) != on.end()) continue;
+        std::string name = right.names[c];
+        while (out->indexOf(name) >= 0) name += "_right";
+        out->names.push_back(name);
+        out->columns.push_back(right.columns[c]->gather(right_ids));
+    }
+    return out;
+}
+
+// group_by() 的结果：行已经被分配到各组，agg() 对每个 (列, 聚合) 在一次遍历中累加
+class GroupByValue final : public NativeObject {
+public:
+    std::shared_ptr<DataFrameValue> frame;
+    std::vector<std::string> keys;
+    std::vector<std::int32_t> group_of;   // 每行所属的组号
+    std::vector<std::int64_t> first_row;  // 每组第一次出现的行，组号按出现顺序分配
+
+    GroupByValue(std::shared_ptr<DataFrameValue> f, std::vector<std::string> k) : frame(std::move(f)), keys(std::move(k)) {
+        std::vector<const DfColumn*> cols;
+        for (const auto& name : keys) cols.push_back(&frame->column(name));
+        const size_t n = frame->rows;
+        auto row_hash = [&](size_t r) {
+            std::uint64_t h = 0x9E3779B97F4A7C15ull;
+            for (const auto* c : cols) h = (h ^ static_cast<std::uint64_t>(c->atom(r))) * 0xff51afd7ed558ccdull;
+            return static_cast<size_t>(h ^ (h >> 32));
+        };
+        auto same_key = [&](size_t a, size_t b) {
+            for (const auto* c : cols) if (c->atom(a) != c->atom(b)) return false;
+            return true;
+        };
+        size_t cap = 16;
+        while (cap < n * 2) cap <<= 1;
+        std::vector<std::int32_t> slots(cap, -1);
+        group_of.resize(n);
+        for (size_t r = 0; r < n; ++r) {
+            size_t i = row_hash(r) & (cap - 1);
+            for (;; i = (i + 1) & (cap - 1)) {
+                std::int32_t g = slots[i];
+                if (g < 0) {
+                    g = static_cast<std::int32_t>(first_row.size());
+                    slots[i] = g;
+                    first_row.push_back(static_cast<std::int64_t>(r));
+                    group_of[r] = g;
+                    break;
+                }
+                if (same_key(static_cast<size_t>(first_row[g]), r)) {
+                    group_of[r] = g;
+                    break;
+                }
+            }
+        }
+    }
+
+    std::string typeName() const override { return "GroupBy"; }
+    std::string toString() const override { return "GroupBy(" + std::to_string(first_row.size()) + " groups)"; }
+    int length() const override { return static_cast<int>(first_row.size()); }
+    Value getMember(const std::string& name) override;
+
+    DfColumnPtr aggregate(const DfColumn& col, const std::string& op) const {
+        const size_t groups = first_row.size();
+        const size_t n = group_of.size();
+        auto out = std::make_shared<DfColumn>();
+        const bool is_float = col.kind == DfColumn::Kind::FLOAT;
+        std::vector<std::int64_t> counts(groups, 0);
+        if (op == "count") {
+            for (size_t r = 0; r < n; ++r) if (!is_float || !std::isnan(col.floats[r])) ++counts[group_of[r]];
+            out->ints.assign(counts.begin(), counts.end());
+            return out;
+        }
+        if (op == "sum" || op == "mean") {
+            if (!col.numeric()) throw std::runtime_error("Cannot compute '" + op + "' of a string column.");
+            if (col.kind == DfColumn::Kind::INT && op == "sum") {
+                std::vector<std::int64_t> sums(groups, 0);
+                for (size_t r = 0; r < n; ++r) sums[group_of[r]] += col.ints[r];
+                bool fits = std::all_of(sums.begin(), sums.end(), [](std::int64_t s) { return s >= INT32_MIN && s <= INT32_MAX; });
+                if (fits) {
+                    out->ints.assign(sums.begin(), sums.end());
+                } else {
+                    out->kind = DfColumn::Kind::FLOAT;
+                    out->floats.assign(sums.begin(), sums.end());
+                }
+                return out;
+            }
+            std::vector<double> sums(groups, 0.0);
+            for (size_t r = 0; r < n; ++r) {
+                double x = col.number(r);
+                if (std::isnan(x)) continue;
+                sums[group_of[r]] += x;
+                ++counts[group_of[r]];
+            }
+            out->kind = DfColumn::Kind::FLOAT;
+            out->floats = std::move(sums);
+            if (op == "mean") {
+                for (size_t g = 0; g < groups; ++g) out->floats[g] = counts[g] ? out->floats[g] / counts[g] : std::numeric_limits<double>::quiet_NaN();
+            }
+            return out;
+        }
+        if (op == "min" || op == "max") {
+            const bool want_max = op == "max";
+            if (col.kind == DfColumn::Kind::FLOAT) {
+                out->kind = DfColumn::Kind::FLOAT;
+                out->floats.assign(groups, std::numeric_limits<double>::quiet_NaN());
+                for (size_t r = 0; r < n; ++r) {
+                    double x = col.floats[r];
+                    double& best = out->floats[group_of[r]];
+                    if (!std::isnan(x) && (std::isnan(best) || (want_max ? x > best : x < best))) best = x;
+                }
+                return out;
+            }
+            // 整数列比较值，字符串列比较字典序名次；结果都是该列中的某个原值
+            std::vector<std::int32_t> ranks = col.kind == DfColumn::Kind::STRING ? col.stringRanks() : std::vector<std::int32_t>();
+            auto key = [&](std::int32_t v) { return ranks.empty() ? v : ranks[v]; };
+            out->kind = col.kind;
+            out->dict = col.dict;
+            out->ints.resize(groups);
+            for (size_t g = 0; g < groups; ++g) out->ints[g] = col.ints[first_row[g]];
+            for (size_t r = 0; r < n; ++r) {
+                std::int32_t& best = out->ints[group_of[r]];
+                std::int32_t v = col.ints[r];
+                if (want_max ? key(v) > key(best) : key(v) < key(best)) best = v;
+            }
+            return out;
+        }
+        throw std::runtime_error("Unknown aggregation '" + op + "'. Use sum, count, mean, min or max.");
+    }
+
+    std::shared_ptr<DataFrameValue> keyFrame() const {
+        auto out = std::make_shared<DataFrameValue>();
+        out->rows = first_row.size();
+        for (const auto& k : keys) {
+            out->names.push_back(k);
+            out->columns.push_back(frame->column(k).gather(first_row));
+        }
+        return out;
+    }
+};
+
+Value GroupByValue::getMember(const std::string& name) {
+    auto self = std::static_pointer_cast<GroupByValue>(shared_from_this());
+    if (name == "agg") {
+        return native_method(name, 1, [self](const std::vector<Value>& args) -> Value {
+            if (!args[0].is<Value::DictType>()) throw std::runtime_error("GroupBy.agg() expects a dict of {column: aggregation(s)}.");
+            auto out = self->keyFrame();
+            for (const auto& entry : *args[0].as<Value::DictType>()) {
+                if (!entry.key.is<StringData>()) throw std::runtime_error("GroupBy.agg() column names must be strings.");
+                const std::string& col = entry.key.as<StringData>().get();
+                std::vector<std::string> ops;
+                if (entry.value.is<StringData>()) {
+                    ops.push_back(entry.value.as<StringData>().get());
+                } else if (entry.value.is<Value::ArrayType>()) {
+                    for (const auto& op : entry.value.as<Value::ArrayType>()->elements) {
+                        if (!op.is<StringData>()) throw std::runtime_error("GroupBy.agg() aggregation names must be strings.");
+                        ops.push_back(op.as<StringData>().get());
+                    }
+                } else {
+                    throw std::runtime_error("GroupBy.agg() expects an aggregation name or an array of names for column '" + col + "'.");
+                }
+                for (const auto& op : ops) out->addColumn(col + "_" + op, self->aggregate(self->frame->column(col), op));
+            }
+            return Value(std::static_pointer_cast<NativeObject>(out));
+        });
+    }
+    if (name == "count") {
+        return native_method(name, 0, [self](const std::vector<Value>&) -> Value {
+            auto out = self->keyFrame();
+            auto counts = std::make_shared<DfColumn>();
+            counts->ints.assign(self->first_row.size(), 0);
+            for (auto g : self->group_of) ++counts->ints[g];
+            out->addColumn("count", counts);
+            return Value(std::static_pointer_cast<NativeObject>(out));
+        });
+    }
+    return NativeObject::getMember(name);
+}
+
+Value DataFrameValue::getMember(const std::string& name) {
+    auto self = std::static_pointer_cast<DataFrameValue>(shared_from_this());
+    auto wrap = [](std::shared_ptr<DataFrameValue> df) { return Value(std::static_pointer_cast<NativeObject>(std::move(df))); };
+    if (name == "columns") {
+        auto arr = std::make_shared<ArrayValue>();
+        for (const auto& n : names) arr->elements.push_back(Value(StringData::from_literal(n)));
+        return Value(arr);
+    }
+    if (name == "dtypes") {
+        auto dict = std::make_shared<DictValue>();
+        for (size_t c = 0; c < names.size(); ++c) dict->set(Value(StringData::from_literal(names[c])), Value(StringData::from_literal(columns[c]->kindName())));
+        return Value(dict);
+    }
+    if (name == "column") {
+        return native_method(name, 1, [self](const std::vector<Value>& args) -> Value {
+            if (!args[0].is<StringData>()) throw std::runtime_error("DataFrame.column() expects a column name.");
+            return df_column_value(self->column(args[0].as<StringData>().get()));
+        });
+    }
+    if (name == "row") {
+        return native_method(name, 1, [self](const std::vector<Value>& args) { return self->getIndex(args[0]); });
+    }
+    if (name == "head") {
+        return native_method(name, -1, [self](const std::vector<Value>& args) -> Value {
+            int n = 5;
+            if (!args.empty()) {
+                if (args.size() > 1 || !args[0].is<int>() || args[0].as<int>() < 0) throw std::runtime_error("DataFrame.head() takes an optional non-negative row count.");
+                n = args[0].as<int>();
+            }
+            return self->slice(0, std::min(n, static_cast<int>(self->rows)));
+        });
+    }
+    if (name == "select") {
+        return native_method(name, 1, [self, wrap](const std::vector<Value>& args) -> Value {
+            auto out = std::make_shared<DataFrameValue>();
+            for (const auto& n : self->columnList(args[0], "DataFrame.select()")) out->addColumn(n, self->columns[self->indexOf(n)]);
+            out->rows = self->rows;
+            return wrap(out);
+        });
+    }
+    if (name == "with_column") {
+        return native_method(name, 2, [self, wrap](const std::vector<Value>& args) -> Value {
+            if (!args[0].is<StringData>()) throw std::runtime_error("DataFrame.with_column() expects a column name.");
+            const std::string& col = args[0].as<StringData>().get();
+            auto out = std::make_shared<DataFrameValue>(*self);
+            DfColumnPtr values = df_column_from(args[1]);
+            if (values->size() != self->rows && !self->names.empty()) {
+                throw std::runtime_error("DataFrame.with_column() needs " + std::to_string(self->rows) + " values, got " + std::to_string(values->size()) + ".");
+            }
+            if (int i = out->indexOf(col); i >= 0) out->columns[i] = values;
+            else out->addColumn(col, values);
+            return wrap(out);
+        });
+    }
+    if (name == "filter") {
+        return native_method(name, -1, [self, wrap](const std::vector<Value>& args) -> Value {
+            if (args.size() == 3) {
+                if (!args[0].is<StringData>() || !args[1].is<StringData>()) throw std::runtime_error("DataFrame.filter(column, op, value) expects a column name and an operator string.");
+                return wrap(self->filterCompare(args[0].as<StringData>().get(), args[1].as<StringData>().get(), args[2]));
+            }
+            if (args.size() != 1) throw std::runtime_error("DataFrame.filter() takes a mask, a predicate, or (column, op, value).");
+            std::vector<bool> keep(self->rows);
+            if (args[0].is<Value::FuncType>()) {
+                const auto& fn = args[0].as<Value::FuncType>();
+                if (fn->arity() != 1) throw std::runtime_error("Predicate for DataFrame.filter() must take exactly one argument.");
+                for (size_t r = 0; r < self->rows; ++r) keep[r] = fn->call({ self->rowDict(r) }).toBool();
+                return wrap(self->filterMask(keep));
+            }
+            DfColumnPtr mask = df_column_from(args[0]);
+            if (mask->size() != self->rows) throw std::runtime_error("DataFrame.filter() mask length does not match the number of rows.");
+            if (!mask->numeric()) throw std::runtime_error("DataFrame.filter() mask must be boolean or numeric.");
+            // nil 单元格在浮点列中是 NaN，按 false 处理
+            for (size_t r = 0; r < self->rows; ++r) {
+                double x = mask->number(r);
+                keep[r] = x != 0.0 && !std::isnan(x);
+            }
+            return wrap(self->filterMask(keep));
+        });
+    }
+    if (name == "sort_by") {
+        return native_method(name, -1, [self, wrap](const std::vector<Value>& args) -> Value {
+            if (args.empty() || args.size() > 2) throw std::runtime_error("DataFrame.sort_by() takes column(s) and an optional descending flag.");
+            bool descending = args.size() == 2 && args[1].toBool();
+            return wrap(self->sortBy(self->columnList(args[0], "DataFrame.sort_by()"), descending));
+        });
+    }
+    if (name == "group_by") {
+        return native_method(name, 1, [self](const std::vector<Value>& args) -> Value {
+            return Value(std::static_pointer_cast<NativeObject>(std::make_shared<GroupByValue>(self, self->columnList(args[0], "DataFrame.group_by()"))));
+        });
+    }
+    if (name == "join") {
+        return native_method(name, -1, [self, wrap](const std::vector<Value>& args) -> Value {
+            if (args.size() < 2 || args.size() > 3) throw std::runtime_error("DataFrame.join() takes another DataFrame, key column(s) and an optional \"inner\"/\"left\".");
+            auto other = args[0].is<Value::NativeType>() ? std::dynamic_pointer_cast<DataFrameValue>(args[0].as<Value::NativeType>()) : nullptr;
+            if (!other) throw std::runtime_error("DataFrame.join() expects a DataFrame.");
+            std::string how = "inner";
+            if (args.size() == 3) {
+                if (!args[2].is<StringData>()) throw std::runtime_error("DataFrame.join() mode must be \"inner\" or \"left\".");
+                how = args[2].as<StringData>().get();
+                if (how != "inner" && how != "left") throw std::runtime_error("DataFrame.join() mode must be \"inner\" or \"left\".");
+            }
+            auto on = self->columnList(args[1], "DataFrame.join()");
+            other->columnList(args[1], "DataFrame.join()");
+            return wrap(self->join(*other, on, how == "left"));
+        });
+    }
+    if (name == "to_dict") {
+        return native_method(name, 0, [self](const std::vector<Value>&) -> Value {
+            auto dict = std::make_shared<DictValue>();
+            for (size_t c = 0; c < self->names.size(); ++c) dict->set(Value(StringData::from_literal(self->names[c])), df_column_value(*self->columns[c]));
+            return Value(dict);
+        });
+    }
+    if (name == "to_array") {
+        return native_method(name, 0, [self](const std::vector<Value>&) { return Value(self->toArray()); });
+    }
+    return NativeObject::getMember(name);
+}
+
+// DataFrame(source)：source 可以是 {列名: 列} 字典（如 read_csv() 的结果，列可以是数组或类型化数组），
+// 也可以是由字典组成的行数组，列按各键第一次出现的顺序排列，缺失的单元格为 nil
+static std::shared_ptr<DataFrameValue> make_dataframe(const Value& source) {
+    auto df = std::make_shared<DataFrameValue>();
+    if (source.is<Value::DictType>()) {
+        for (const auto& entry : *source.as<Value::DictType>()) {
+            if (!entry.key.is<StringData>()) throw std::runtime_error("DataFrame column names must be strings.");
+            df->addColumn(entry.key.as<StringData>().get(), df_column_from(entry.value));
+        }
+        return df;
+    }
+    if (!source.is<Value::ArrayType>()) throw std::runtime_error("DataFrame() expects a dict of columns or an array of row dicts.");
+    const auto& rows = source.as<Value::ArrayType>()->elements;
+    DictValue index; // 列名 → 列号
+    std::vector<std::string> names;
+    std::vector<std::vector<Value>> values;
+    for (size_t r = 0; r < rows.size(); ++r) {
+        if (!rows[r].is<Value::DictType>()) throw std::runtime_error("DataFrame() rows must be dicts.");
+        for (const auto& entry : *rows[r].as<Value::DictType>()) {
+            if (!entry.key.is<StringData>()) throw std::runtime_error("DataFrame column names must be strings.");
+            auto [slot, inserted] = index.emplace(entry.key, Value(static_cast<int>(names.size())));
+            if (inserted) {
+                names.push_back(entry.key.as<StringData>().get());
+                values.emplace_back(r); // 之前的行在该列上为 nil
+            }
+            auto& col = values[static_cast<size_t>(slot->value.as<int>())];
+            col.resize(r);
+            col.push_back(entry.value);
+        }
+    }
+    for (size_t c = 0; c < names.size(); ++c) {
+        values[c].resize(rows.size());
+        df->addColumn(names[c], df_column_from_values(values[c]));
+    }
+    df->rows = rows.size();
+    return df;
+}
+
+// ---- JSON (json_parse / json_stringify / ndjson) ----
+
+// 在字符串内容中查找下一个需要特殊处理的字节：引号、反斜杠或控制字符（< 0x20）
+static const char* json_scan_string_scalar(const char* p, const char* end) {
+    while (p < end && *p != '"' && *p != '\\' && static_cast<unsigned char>(*p) >= 0x20) ++p;
+    return p;
+}
+
+#ifdef MINILANG_X86_SIMD
+MINILANG_TARGET("sse2") static const char* json_scan_string_sse2(const char* p, const char* end) {
+    const __m128i q = _mm_set1_epi8('"');
+    const __m128i bs = _mm_set1_epi8('\\');
+    const __m128i ctl = _mm_set1_epi8(0x1F);
+    for (; p + 16 <= end; p += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        // 无符号比较 v <= 0x1F 等价于 max(v, 0x1F) == 0x1F
+        __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, q), _mm_cmpeq_epi8(v, bs)),
+                                   _mm_cmpeq_epi8(_mm_max_epu8(v, ctl), ctl));
+        int mask = _mm_movemask_epi8(hit);
+        if (mask != 0) return p + __builtin_ctz(static_cast<unsigned>(mask));
+    }
+    return json_scan_string_scalar(p, end);
+}
+#endif
+
+static const char* json_scan_string(const char* p, const char* end) {
+#ifdef MINILANG_X86_SIMD
+    if (simd_level != SimdLevel::SCALAR) return json_scan_string_sse2(p, end);
+#endif
+    return json_scan_string_scalar(p, end);
+}
+
+static void append_utf8(std::string& out, std::uint32_t cp) {
+    if (cp < 0x80) {
+        out += static_cast<char>(cp);
+    } else if (cp < 0x800) {
+        out += static_cast<char>(0xC0 | (cp >> 6));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+        out += static_cast<char>(0xE0 | (cp >> 12));
+        out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    } else {
+        out += static_cast<char>(0xF0 | (cp >> 18));
+        out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+        out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    }
+}
+
+// JSON 文本直接解析为 MiniLang 值：对象 → 字典，数组 → 数组，整数（在 int 范围内且没有小数部分和指数）→ int，
+// 其他数字 → float，null → nil。用显式栈代替递归，嵌套再深也不会耗尽调用栈
+class JsonParser {
+    const char* begin;
+    const char* p;
+    const char* end;
+
+    // 对象的键大量重复，用一个小的直接映射缓存让相同的键共享同一个 StringData
+    std::array<std::optional<StringData>, 256> key_cache;
+
+    // 正在解析的容器。成员先按顺序压入共享的 scratch（对象为键、值交替），容器结束时
+    // 再一次性按最终大小构造数组或字典，避免逐个追加时的反复扩容和重新哈希
+    struct Frame {
+        size_t base;
+        bool is_dict;
+    };
+    std::vector<Frame> stack;
+    std::vector<Value> scratch;
+
+    Value close(const Frame& frame) {
+        auto first = scratch.begin() + static_cast<std::ptrdiff_t>(frame.base);
+        Value result;
+        if (frame.is_dict) {
+            auto dict = std::make_shared<DictValue>();
+            dict->reserve((scratch.end() - first) / 2);
+            for (auto it = first; it != scratch.end(); it += 2) dict->set(it[0], std::move(it[1]));
+            result = Value(dict);
+        } else {
+            auto arr = std::make_shared<ArrayValue>();
+            arr->elements.append(std::make_move_iterator(first), std::make_move_iterator(scratch.end()));
+            result = Value(arr);
+        }
+        scratch.erase(first, scratch.end());
+        return result;
+    }
+
+    [[noreturn]] void fail(const std::string& message) const {
+        size_t line = 1, column = 1;
+        for (const char* q = begin; q < p && q < end; ++q) {
+            if (*q == '\n') {
+                ++line;
+                column = 1;
+            } else {
+                ++column;
+            }
+        }
+        throw std::runtime_error("JSON parse error at line " + std::to_string(line) + ", column " + std::to_string(column) + ": " + message);
+    }
+    void skipSpace() {
+        while (p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t')) ++p;
+    }
+    void expect(char c, const char* what) {
+        skipSpace();
+        if (p >= end || *p != c) fail(std::string("expected ") + what);
+        ++p;
+    }
+    bool literal(const char* word) {
+        size_t n = std::strlen(word);
+        if (static_cast<size_t>(end - p) < n || std::memcmp(p, word, n) != 0) return false;
+        p += n;
+        return true;
+    }
+
+    unsigned hex4() {
+        if (end - p < 4) fail("truncated \\u escape");
+        unsigned v = 0;
+        for (int i = 0; i < 4; ++i, ++p) {
+            char c = *p;
+            v <<= 4;
+            if (c >= '0' && c <= '9') v |= c - '0';
+            else if (c >= 'a' && c <= 'f') v |= c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F') v |= c - 'A' + 10;
+            else fail("invalid \\u escape");
+        }
+        return v;
+    }
+
+    // p 指向开头的引号；没有转义的字符串（绝大多数）直接整段复制
+    std::string string() {
+        ++p;
+        std::string out;
+        for (;;) {
+            const char* stop = json_scan_string(p, end);
+            out.append(p, stop);
+            p = stop;
+            if (p >= end) fail("unterminated string");
+            char c = *p++;
+            if (c == '"') return out;
+            if (c != '\\') {
+                --p;
+                fail("control character in string");
+            }
+            if (p >= end) fail("unterminated string");
+            switch (*p++) {
+                case '"': out += '"'; break;
+                case '\\': out += '\\'; break;
+                case '/': out += '/'; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'n': out += '\n'; break;
+                case 'r': out += '\r'; break;
+                case 't': out += '\t'; break;
+                case 'u': {
+                    std::uint32_t cp = hex4();
+                    if (cp >= 0xD800 && cp <= 0xDBFF && end - p >= 6 && p[0] == '\\' && p[1] == 'u') {
+                        const char* save = p;
+                        p += 2;
+                        std::uint32_t low = hex4();
+                        if (low >= 0xDC00 && low <= 0xDFFF) cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                        else p = save;
+                    }
+                    if (cp >= 0xD800 && cp <= 0xDFFF) cp = 0xFFFD; // 不成对的代理项
+                    append_utf8(out, cp);
+                    break;
+                }
+                default: --p; fail("invalid escape");
+            }
+        }
+    }
+
+    Value key() {
+        skipSpace();
+        if (p >= end || *p != '"') fail("expected string key");
+        std::string text = string();
+        size_t h = text.size();
+        for (unsigned char c : text) h = h * 31 + c;
+        auto& slot = key_cache[h & 255];
+        if (!slot || slot->get() != text) slot = StringData(std::move(text));
+        return Value(*slot);
+    }
+
+    Value number() {
+        const char* start = p;
+        bool integral = true;
+        if (p < end && *p == '-') ++p;
+        if (p < end && *p == '0') {
+            ++p;
+        } else if (p < end && *p >= '1' && *p <= '9') {
+            while (p < end && *p >= '0' && *p <= '9') ++p;
+        } else {
+            fail("invalid number");
+        }
+        if (p < end && *p == '.') {
+            integral = false;
+            ++p;
+            if (p >= end || *p < '0' || *p > '9') fail("invalid number");
+            while (p < end && *p >= '0' && *p <= '9') ++p;
+        }
+        if (p < end && (*p == 'e' || *p == 'E')) {
+            integral = false;
+            ++p;
+            if (p < end && (*p == '+' || *p == '-')) ++p;
+            if (p >= end || *p < '0' || *p > '9') fail("invalid number");
+            while (p < end && *p >= '0' && *p <= '9') ++p;
+        }
+        if (integral) {
+            int i;
+            auto r = std::from_chars(start, p, i);
+            if (r.ec == std::errc() && r.ptr == p) return Value(i);
+        }
+        double d = 0.0;
+        auto r = std::from_chars(start, p, d);
+        if (r.ptr != p) fail("invalid number");
+        if (r.ec == std::errc::result_out_of_range) {
+            // 超出 double 范围时 from_chars 不写入结果；与常见 JSON 库一致，上溢为 ±inf，下溢为 ±0.0
+            d = std::strtod(std::string(start, p).c_str(), nullptr);
+        }
+        return Value(d);
+    }
+
+public:
+    explicit JsonParser(std::string_view text) : begin(text.data()), p(text.data()), end(text.data() + text.size()) {}
+
+    Value parse() {
+        Value result = parseValue();
+        skipSpace();
+        if (p < end) fail("unexpected trailing characters");
+        return result;
+    }
+
+    Value parseValue() {
+        stack.clear();
+        scratch.clear();
+        for (;;) {
+            Value v;
+            skipSpace();
+            if (p >= end) fail("unexpected end of input");
+            switch (*p) {
+                case '{': {
+                    ++p;
+                    skipSpace();
+                    if (p < end && *p == '}') {
+                        ++p;
+                        v = Value(std::make_shared<DictValue>());
+                        break;
+                    }
+                    stack.push_back({ scratch.size(), true });
+                    scratch.push_back(key());
+                    expect(':', "':' after key");
+                    continue;
+                }
+                case '[': {
+                    ++p;
+                    skipSpace();
+                    if (p < end && *p == ']') {
+                        ++p;
+                        v = Value(std::make_shared<ArrayValue>());
+                        break;
+                    }
+                    stack.push_back({ scratch.size(), false });
+                    continue;
+                }
+                case '"': v = Value(string()); break;
+                case 't': if (!literal("true")) fail("invalid literal"); v = Value(true); break;
+                case 'f': if (!literal("false")) fail("invalid literal"); v = Value(false); break;
+                case 'n': if (!literal("null")) fail("invalid literal"); break;
+                default:
+                    if (*p != '-' && (*p < '0' || *p > '9')) fail(std::string("unexpected character '") + *p + "'");
+                    v = number();
+            }
+            // 把完成的值交给外层容器；外层也随之结束时继续向上收尾
+            for (;;) {
+                if (stack.empty()) return v;
+                const Frame top = stack.back();
+                scratch.push_back(std::move(v));
+                skipSpace();
+                if (p < end && *p == ',') {
+                    ++p;
+                    if (top.is_dict) {
+                        scratch.push_back(key());
+                        expect(':', "':' after key");
+                    }
+                    break;
+                }
+                if (p < end && *p == (top.is_dict ? '}' : ']')) {
+                    ++p;
+                    v = close(top);
+                    stack.pop_back();
+                    continue;
+                }
+                fail(top.is_dict ? "expected ',' or '}'" : "expected ',' or ']'");
+            }
+        }
+    }
+};
+
+static void json_quote(std::string& out, const std::string& s) {
+    out += '"';
+    const char* p = s.data();
+    const char* end = p + s.size();
+    while (p < end) {
+        const char* stop = json_scan_string(p, end);
+        out.append(p, stop);
+        if (stop >= end) break;
+        char c = *stop;
+        p = stop + 1;
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            case '\b': out += "\\b"; break;
+            case '\f': out += "\\f"; break;
+            default: {
+                static const char digits[] = "0123456789abcdef";
+                out += "\\u00";
+                out += digits[(c >> 4) & 0xF];
+                out += digits[c & 0xF];
+            }
+        }
+    }
+    out += '"';
+}
+
+// json_stringify：同样用显式栈遍历，遇到正在输出的容器（循环引用）时报错。
+// 浮点数总是带小数点或指数，保证往返后仍是 float；nan 和无穷输出为 null
+class JsonWriter {
+    std::string& out;
+    int indent;
+
+    struct Frame {
+        Value container;
+        const void* identity;
+        std::vector<std::pair<std::string, Value>> fields; // 对象的字段（按名称排序）
+        size_t pos = 0;
+        size_t count = 0;
+        bool is_dict = false;
+    };
+    std::vector<Frame> stack;
+    std::unordered_set<const void*> active;
+
+    void newline(size_t depth) {
+        if (indent < 0) return;
+        out += '\n';
+        out.append(depth * static_cast<size_t>(indent), ' ');
+    }
+    void key(const Value& k) {
+        if (k.is<StringData>()) json_quote(out, k.as<StringData>().get());
+        else json_quote(out, k.toString());
+        out += indent < 0 ? ":" : ": ";
+    }
+
+    // 输出标量，或为容器压栈；返回 false 表示压入了新容器
+    bool scalar(const Value& v) {
+        if (v.is<std::monostate>()) {
+            out += "null";
+        } else if (v.is<bool>()) {
+            out += v.as<bool>() ? "true" : "false";
+        } else if (v.is<int>()) {
+            format_int(out, v.as<int>());
+        } else if (v.is<double>()) {
+            double d = v.as<double>();
+            if (!std::isfinite(d)) {
+                out += "null";
+                return true;
+            }
+            size_t start = out.size();
+            format_double(out, d);
+            if (out.find_first_of(".e", start) == std::string::npos) out += ".0";
+        } else if (v.is<StringData>()) {
+            json_quote(out, v.as<StringData>().get());
+        } else if (v.is<Value::ArrayType>()) {
+            const auto& arr = v.as<Value::ArrayType>();
+            push(v, arr.get(), false, arr->elements.size());
+            return false;
+        } else if (v.is<Value::DictType>()) {
+            const auto& dict = v.as<Value::DictType>();
+            push(v, dict.get(), true, dict->size());
+            return false;
+        } else if (v.is<Value::MutableObjectType>()) {
+            // 对象输出为 JSON 对象：只包含自身的数据字段，方法等可调用字段被跳过
+            const auto& obj = v.as<Value::MutableObjectType>();
+            std::vector<std::pair<std::string, Value>> fields;
+            for (const auto& [name, field] : obj->fields) {
+                if (!field.is<Value::FuncType>()) fields.emplace_back(name, field);
+            }
+            std::sort(fields.begin(), fields.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+            size_t n = fields.size();
+            push(v, obj.get(), true, n);
+            stack.back().fields = std::move(fields);
+            return false;
+        } else if (v.is<Value::NativeType>()) {
+            // 原生序列（类型化数组、DataFrame 等）按 to_array() 的结果输出
+            auto arr = v.as<Value::NativeType>()->toArray();
+            if (!arr) throw std::runtime_error("Value of type '" + v.as<Value::NativeType>()->typeName() + "' cannot be converted to JSON.");
+            push(Value(arr), arr.get(), false, arr->elements.size());
+            return false;
+        } else {
+            throw std::runtime_error("Functions cannot be converted to JSON.");
+        }
+        return true;
+    }
+    void push(const Value& v, const void* identity, bool is_dict, size_t count) {
+        if (!active.insert(identity).second) throw std::runtime_error("json_stringify: value contains a reference cycle.");
+        out += is_dict ? '{' : '[';
+        Frame f;
+        f.container = v;
+        f.identity = identity;
+        f.is_dict = is_dict;
+        f.count = count;
+        stack.push_back(std::move(f));
+    }
+
+public:
+    JsonWriter(std::string& o, int ind) : out(o), indent(ind) {}
+
+    void write(const Value& root) {
+        if (scalar(root)) return;
+        while (!stack.empty()) {
+            Frame& top = stack.back();
+            const Value* next = nullptr;
+            const Value* next_key = nullptr;
+            Value field_key;
+            if (top.container.is<Value::ArrayType>()) {
+                const auto& elements = top.container.as<Value::ArrayType>()->elements;
+                if (top.pos < elements.size()) next = &elements[top.pos];
+                ++top.pos;
+            } else if (top.container.is<Value::DictType>()) {
+                if (const auto* entry = top.container.as<Value::DictType>()->next(top.pos)) {
+                    next = &entry->value;
+                    next_key = &entry->key;
+                }
+            } else if (top.pos < top.fields.size()) {
+                field_key = Value(top.fields[top.pos].first);
+                next = &top.fields[top.pos].second;
+                next_key = &field_key;
+                ++top.pos;
+            }
+            if (!next) {
+                size_t depth = stack.size() - 1;
+                bool empty = top.count == 0;
+                char close = top.is_dict ? '}' : ']';
+                active.erase(top.identity);
+                stack.pop_back();
+                if (!empty) newline(depth);
+                out += close;
+                continue;
+            }
+            // 第一个元素之前不输出逗号：此时容器的左括号就是最后一个字符
+            if (out.back() != '[' && out.back() != '{') out += ',';
+            newline(stack.size());
+            if (next_key) key(*next_key);
+            Value item = *next; // 压栈可能使 top 失效，先复制
+            scalar(item);
+        }
+    }
+};
 
-        [&](const Value::DictType& dict) -> Value {
-            const void* ptr = dict.get();
-            if (memo.count(ptr)) {
-                return memo.at(ptr);
+// ndjson(path)：逐行读取 NDJSON 文件，每个非空行解析为一个值，整个文件不会一次读入内存
+class NdjsonIterator final : public Iterator {
+    std::unique_ptr<Iterator> lines;
+    size_t line_no = 0;
+public:
+    explicit NdjsonIterator(std::unique_ptr<Iterator> l) : lines(std::move(l)) {}
+    bool next(Value& out) override {
+        Value line;
+        while (lines->next(line)) {
+            ++line_no;
+            const std::string& text = line.as<StringData>().get();
+            if (text.find_first_not_of(" \t\r") == std::string::npos) continue;
+            try {
+                out = JsonParser(text).parse();
+            } catch (const std::runtime_error& e) {
+                throw std::runtime_error("Line " + std::to_string(line_no) + " of NDJSON input: " + e.what());
             }
+            return true;
+        }
+        return false;
+    }
+};
 
-            auto newDict = std::make_shared<DictValue>();
-            Value newDictVal(newDict);
-            memo[ptr] = newDictVal;
+class NdjsonValue final : public NativeObject {
+    std::string path;
+public:
+    explicit NdjsonValue(std::string p) : path(std::move(p)) {}
+    std::string typeName() const override { return "ndjson"; }
+    std::string toString() const override { return "ndjson(" + path + ")"; }
+    std::unique_ptr<Iterator> iter() override { return std::make_unique<NdjsonIterator>(std::make_shared<FileValue>(path, "r")->iter()); }
+};
 
-            for (const auto& pair : dict->pairs) {
-                newDict->pairs[pair.first] = deepcopy_recursive(pair.second, memo);
-            }
+// ---- 二进制序列化 (serialize / deserialize) ----
+// 格式：魔数 "MLSER" + 版本号字节，随后是一个带类型标签的值。长度与整数用变长编码（整数先做 zigzag），
+// 浮点数为 8 字节小端。被多处引用的字符串和容器（引用计数大于 1）在第一次写出时前缀 SHARED 并按顺序获得编号，
+// 再次出现时只写 REF + 编号，因此共享引用在读回后仍然共享，循环引用也能还原；只被引用一次的值不进编号表。
+// 对象的字段名同样只在第一次出现时写出全文，之后写名称表中的序号
+namespace ser {
+constexpr char MAGIC[] = "MLSER";
+constexpr size_t MAGIC_LEN = 5;
+constexpr unsigned char VERSION = 1;
+enum Tag : unsigned char { NIL, FALSE_, TRUE_, INT, FLOAT, STRING, ARRAY, DICT, OBJECT, REF, SHARED, INT32_ARRAY, FLOAT64_ARRAY, BYTES };
+
+inline void put_varint(std::string& out, std::uint64_t v) {
+    while (v >= 0x80) {
+        out += static_cast<char>((v & 0x7F) | 0x80);
+        v >>= 7;
+    }
+    out += static_cast<char>(v);
+}
+inline void put_u64(std::string& out, std::uint64_t v) {
+    char bytes[8];
+    for (int i = 0; i < 8; ++i) bytes[i] = static_cast<char>((v >> (8 * i)) & 0xFF);
+    out.append(bytes, 8);
+}
+inline void put_string(std::string& out, const std::string& s) {
+    put_varint(out, s.size());
+    out += s;
+}
+} // namespace ser
+
+class Serializer {
+    std::string& out;
+    PointerMemo ids; // 共享的字符串存储 / 容器地址 → 编号
+    int next_id = 0;
+    std::unordered_map<std::string, std::uint64_t> names; // 对象字段名 → 序号
+
+    struct Frame {
+        Value container;
+        size_t pos = 0;
+        bool shared_storage = false; // 数组：元素缓冲区与其他数组共享
+        std::unordered_map<std::string, Value>::const_iterator field; // 对象：下一个字段（pos 0 时先写原型）
+        explicit Frame(Value c) : container(std::move(c)) {}
+    };
+    std::vector<Frame> stack;
+
+    // 只被引用一次的值不可能再次出现，直接写出；否则已写过时输出 REF 并返回 true，首次出现时写 SHARED 并登记编号。
+    // 共享缓冲区里的一个槽位可以从多个数组到达，即使引用计数为 1 也要登记
+    bool ref(const void* identity, long use_count, bool shared_slot) {
+        if (use_count <= 1 && !shared_slot) return false;
+        if (const Value* id = ids.find(identity)) {
+            out += static_cast<char>(ser::REF);
+            ser::put_varint(out, static_cast<std::uint64_t>(id->as<int>()));
+            return true;
+        }
+        ids.insert(identity, Value(next_id++));
+        out += static_cast<char>(ser::SHARED);
+        return false;
+    }
 
-            return newDictVal;
-        },
+    void fieldName(const std::string& name) {
+        auto [it, inserted] = names.try_emplace(name, names.size() + 1);
+        if (inserted) {
+            out += '\0';
+            ser::put_string(out, name);
+        } else {
+            ser::put_varint(out, it->second);
+        }
+    }
 
-        [&](const Value::MutableObjectType& obj) -> Value {
-            const void* ptr = obj.get();
-            if (memo.count(ptr)) {
-                return memo.at(ptr);
+    // 写出标量或容器头部，容器的内容留给 write() 逐项写出。v 必须引用容器中的槽位（而不是副本），
+    // 引用计数才能准确反映它被引用的次数；shared_slot 表示该槽位位于共享的数组缓冲区中
+    void emit(const Value& v, bool shared_slot = false) {
+        if (v.is<std::monostate>()) {
+            out += static_cast<char>(ser::NIL);
+        } else if (v.is<bool>()) {
+            out += static_cast<char>(v.as<bool>() ? ser::TRUE_ : ser::FALSE_);
+        } else if (v.is<int>()) {
+            std::int64_t i = v.as<int>();
+            out += static_cast<char>(ser::INT);
+            ser::put_varint(out, (static_cast<std::uint64_t>(i) << 1) ^ static_cast<std::uint64_t>(i >> 63));
+        } else if (v.is<double>()) {
+            std::uint64_t bits;
+            double d = v.as<double>();
+            std::memcpy(&bits, &d, sizeof(bits));
+            out += static_cast<char>(ser::FLOAT);
+            ser::put_u64(out, bits);
+        } else if (v.is<StringData>()) {
+            const auto& s = v.as<StringData>();
+            if (ref(s.identity(), s.use_count(), shared_slot)) return;
+            out += static_cast<char>(ser::STRING);
+            ser::put_string(out, s.get());
+        } else if (v.is<Value::ArrayType>()) {
+            const auto& arr = v.as<Value::ArrayType>();
+            if (ref(arr.get(), arr.use_count(), shared_slot)) return;
+            out += static_cast<char>(ser::ARRAY);
+            ser::put_varint(out, arr->elements.size());
+            stack.emplace_back(v);
+            stack.back().shared_storage = arr->elements.shared();
+        } else if (v.is<Value::DictType>()) {
+            const auto& dict = v.as<Value::DictType>();
+            if (ref(dict.get(), dict.use_count(), shared_slot)) return;
+            out += static_cast<char>(ser::DICT);
+            ser::put_varint(out, dict->size());
+            stack.emplace_back(v);
+        } else if (v.is<Value::MutableObjectType>()) {
+            // 类的实例记录类名，读回时重新关联到同名的类，原型由类提供；普通对象则把原型对象作为第一项写出
+            const auto& obj = v.as<Value::MutableObjectType>();
+            if (ref(obj.get(), obj.use_count(), shared_slot)) return;
+            out += static_cast<char>(ser::OBJECT);
+            ser::put_string(out, obj->klass ? obj->klass->name : std::string());
+            ser::put_varint(out, obj->fields.size());
+            stack.emplace_back(v);
+            stack.back().field = obj->fields.begin();
+        } else if (v.is<Value::NativeType>()) {
+            const auto& native = v.as<Value::NativeType>();
+            if (auto* range = dynamic_cast<RangeValue*>(native.get())) {
+                // range 先物化再按数组写出，读回后是普通数组。身份取物化出的数组，
+                // 因此同一个 range 或与它共享的数组被多处引用时仍只写一次
+                auto arr = range->toArray();
+                if (ref(arr.get(), arr.use_count(), shared_slot)) return;
+                out += static_cast<char>(ser::ARRAY);
+                ser::put_varint(out, arr->elements.size());
+                stack.emplace_back(Value(arr));
+                stack.back().shared_storage = arr->elements.shared();
+            } else if (auto* ints = dynamic_cast<const Int32ArrayValue*>(native.get())) {
+                if (ref(native.get(), native.use_count(), shared_slot)) return;
+                out += static_cast<char>(ser::INT32_ARRAY);
+                ser::put_varint(out, ints->data.size());
+                for (std::int32_t x : ints->data) {
+                    std::uint32_t u = static_cast<std::uint32_t>(x);
+                    char bytes[4] = { static_cast<char>(u & 0xFF), static_cast<char>((u >> 8) & 0xFF),
+                                      static_cast<char>((u >> 16) & 0xFF), static_cast<char>(u >> 24) };
+                    out.append(bytes, 4);
+                }
+            } else if (auto* floats = dynamic_cast<const Float64ArrayValue*>(native.get())) {
+                if (ref(native.get(), native.use_count(), shared_slot)) return;
+                out += static_cast<char>(ser::FLOAT64_ARRAY);
+                ser::put_varint(out, floats->data.size());
+                for (double d : floats->data) {
+                    std::uint64_t bits;
+                    std::memcpy(&bits, &d, sizeof(bits));
+                    ser::put_u64(out, bits);
+                }
+            } else if (auto* bytes = dynamic_cast<const BytesValue*>(native.get())) {
+                if (ref(native.get(), native.use_count(), shared_slot)) return;
+                out += static_cast<char>(ser::BYTES);
+                ser::put_varint(out, bytes->len);
+                out.append(reinterpret_cast<const char*>(bytes->data()), bytes->len);
+            } else {
+                throw std::runtime_error("Value of type '" + native->typeName() + "' cannot be serialized.");
             }
+        } else {
+            throw std::runtime_error("Functions and classes cannot be serialized.");
+        }
+    }
 
-            Value::MutableObjectType newParent = nullptr;
-            if (obj->parent) {
-                Value parentCopy = deepcopy_recursive(Value(obj->parent), memo);
-                if (parentCopy.is<Value::MutableObjectType>()) {
-                    newParent = parentCopy.as<Value::MutableObjectType>();
+public:
+    explicit Serializer(std::string& o) : out(o) {}
+
+    void write(const Value& root) {
+        out.append(ser::MAGIC, ser::MAGIC_LEN);
+        out += static_cast<char>(ser::VERSION);
+        emit(root);
+        while (!stack.empty()) {
+            Frame& top = stack.back();
+            const Value* item;
+            bool shared_slot = false;
+            if (top.container.is<Value::ArrayType>()) {
+                const auto& elements = top.container.as<Value::ArrayType>()->elements;
+                if (top.pos >= elements.size()) {
+                    stack.pop_back();
+                    continue;
+                }
+                item = &elements[top.pos++];
+                shared_slot = top.shared_storage;
+            } else if (top.container.is<Value::DictType>()) {
+                const DictEntry* entry = top.container.as<Value::DictType>()->next(top.pos);
+                if (!entry) {
+                    stack.pop_back();
+                    continue;
                 }
+                // 键只能是标量或字符串，写出时不会压栈
+                if (entry->key.is<Value::NativeType>()) throw std::runtime_error("Dict keys of type '" + value_type_name(entry->key) + "' cannot be serialized.");
+                emit(entry->key);
+                item = &entry->value;
+            } else {
+                const auto& obj = *top.container.as<Value::MutableObjectType>();
+                if (top.pos++ == 0) {
+                    // 原型：实例由类提供，写 nil；普通对象写出其原型对象
+                    static const Value nil;
+                    Value parent = obj.klass || !obj.parent ? nil : Value(obj.parent);
+                    emit(parent);
+                    continue;
+                }
+                if (top.field == obj.fields.end()) {
+                    stack.pop_back();
+                    continue;
+                }
+                fieldName(top.field->first);
+                item = &(top.field++)->second;
             }
+            // item 指向容器自身的存储，emit() 压栈不会使其失效
+            emit(*item, shared_slot);
+        }
+    }
+};
 
-            auto newObj = std::make_shared<MutableObject>(newParent);
-            newObj->klass = obj->klass;
-            Value newObjVal(newObj);
-            memo[ptr] = newObjVal;
+// 读回 serialize() 的结果。与写出时一样用显式栈，容器在读到头部时就登记编号，
+// 之后指向它的 REF（包括来自其内部的循环引用）直接得到同一个对象
+class Deserializer {
+public:
+    using ClassResolver = std::function<std::shared_ptr<ClassValue>(const std::string&)>;
+
+private:
+    const unsigned char* p;
+    const unsigned char* end;
+    ClassResolver resolve;
+    std::shared_ptr<const void> owner;
+    std::unordered_map<std::string, std::shared_ptr<ClassValue>> classes;
+    std::vector<Value> ids;
+    std::vector<std::string> names; // 对象字段名表
+
+    struct Frame {
+        Value container;
+        std::uint64_t remaining;
+        Value key;          // 字典：当前项的键
+        std::string field;  // 对象：当前字段名
+        bool parent_pending; // 对象：下一项是原型而不是字段
+        Frame(Value c, std::uint64_t n, bool object = false) : container(std::move(c)), remaining(n), parent_pending(object) {}
+    };
+    std::vector<Frame> stack;
+
+    [[noreturn]] static void corrupt(const char* what) {
+        throw std::runtime_error(std::string("deserialize: ") + what + ".");
+    }
+    void need(std::uint64_t n) const {
+        if (static_cast<std::uint64_t>(end - p) < n) corrupt("data is truncated");
+    }
+    std::uint64_t varint() {
+        std::uint64_t v = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            need(1);
+            unsigned char b = *p++;
+            v |= static_cast<std::uint64_t>(b & 0x7F) << shift;
+            if (!(b & 0x80)) return v;
+        }
+        corrupt("malformed length");
+    }
+    std::uint64_t u64() {
+        need(8);
+        std::uint64_t v = 0;
+        for (int i = 0; i < 8; ++i) v |= static_cast<std::uint64_t>(p[i]) << (8 * i);
+        p += 8;
+        return v;
+    }
+    std::string_view bytes() {
+        std::uint64_t n = varint();
+        need(n);
+        std::string_view s(reinterpret_cast<const char*>(p), static_cast<size_t>(n));
+        p += n;
+        return s;
+    }
+    // 元素个数，每个元素至少占 min_size 字节，据此拒绝明显越界的长度而不是先分配巨大的内存
+    size_t count(std::uint64_t min_size) {
+        std::uint64_t n = varint();
+        if (n > static_cast<std::uint64_t>(end - p) / min_size) corrupt("length exceeds the data");
+        return static_cast<size_t>(n);
+    }
+    std::shared_ptr<ClassValue> classNamed(const std::string& name) {
+        auto& cls = classes[name];
+        if (!cls && !(cls = resolve ? resolve(name) : nullptr)) {
+            throw std::runtime_error("deserialize: class '" + name + "' is not defined.");
+        }
+        return cls;
+    }
 
-            for (const auto& pair : obj->fields) {
-                newObj->fields[pair.first] = deepcopy_recursive(pair.second, memo);
+    // 读一个值；标量与空容器直接得到结果并返回 true，非空容器压栈后返回 false
+    bool read(Value& v) {
+        need(1);
+        const bool shared = *p == ser::SHARED;
+        if (shared) {
+            ++p;
+            need(1);
+        }
+        auto share = [&] { if (shared) ids.push_back(v); };
+        switch (*p++) {
+            case ser::NIL: v = Value(); return true;
+            case ser::FALSE_: v = Value(false); return true;
+            case ser::TRUE_: v = Value(true); return true;
+            case ser::INT: {
+                std::uint64_t z = varint();
+                std::int64_t i = static_cast<std::int64_t>(z >> 1) ^ -static_cast<std::int64_t>(z & 1);
+                if (i < INT_MIN || i > INT_MAX) corrupt("integer out of range");
+                v = Value(static_cast<int>(i));
+                return true;
+            }
+            case ser::FLOAT: {
+                std::uint64_t bits = u64();
+                double d;
+                std::memcpy(&d, &bits, sizeof(d));
+                v = Value(d);
+                return true;
+            }
+            case ser::STRING: {
+                std::string_view s = bytes();
+                // 数据来自映射文件时，字符串直接引用映射的内存而不复制
+                v = owner ? Value(StringData::view_of(owner, s.data(), s.size())) : Value(std::string(s));
+                share();
+                return true;
+            }
+            case ser::REF: {
+                std::uint64_t id = varint();
+                if (id >= ids.size()) corrupt("invalid reference");
+                v = ids[static_cast<size_t>(id)];
+                return true;
+            }
+            case ser::ARRAY: {
+                size_t n = count(1);
+                auto arr = std::make_shared<ArrayValue>();
+                arr->elements.reserve(n);
+                v = Value(arr);
+                share();
+                if (n == 0) return true;
+                stack.emplace_back(v, n);
+                return false;
             }
+            case ser::DICT: {
+                size_t n = count(2);
+                auto dict = std::make_shared<DictValue>();
+                dict->reserve(n);
+                v = Value(dict);
+                share();
+                if (n == 0) return true;
+                stack.emplace_back(v, n);
+                return false;
+            }
+            case ser::OBJECT: {
+                std::string name(bytes());
+                auto obj = std::make_shared<MutableObject>();
+                if (!name.empty()) {
+                    obj->klass = classNamed(name);
+                    obj->parent = obj->klass->prototype;
+                }
+                v = Value(obj);
+                share();
+                stack.emplace_back(v, count(2) + 1, true);
+                return false;
+            }
+            case ser::INT32_ARRAY: {
+                size_t n = count(4);
+                std::vector<std::int32_t> data(n);
+                for (auto& x : data) {
+                    std::uint32_t u = static_cast<std::uint32_t>(p[0]) | static_cast<std::uint32_t>(p[1]) << 8 |
+                                      static_cast<std::uint32_t>(p[2]) << 16 | static_cast<std::uint32_t>(p[3]) << 24;
+                    x = static_cast<std::int32_t>(u);
+                    p += 4;
+                }
+                v = typed_array_value(std::move(data));
+                share();
+                return true;
+            }
+            case ser::FLOAT64_ARRAY: {
+                size_t n = count(8);
+                std::vector<double> data(n);
+                for (auto& d : data) {
+                    std::uint64_t bits = u64();
+                    std::memcpy(&d, &bits, sizeof(d));
+                }
+                v = typed_array_value(std::move(data));
+                share();
+                return true;
+            }
+            case ser::BYTES: {
+                std::string_view raw = bytes();
+                v = bytes_value(std::vector<unsigned char>(raw.begin(), raw.end()));
+                share();
+                return true;
+            }
+            default:
+                corrupt("unknown value tag");
+        }
+    }
 
-            return newObjVal;
+    // 为栈顶容器的下一项读入键或字段名
+    void beginItem(Frame& top) {
+        if (top.container.is<Value::DictType>()) {
+            if (!read(top.key)) corrupt("dict key must be a scalar");
+        } else if (top.container.is<Value::MutableObjectType>() && !top.parent_pending) {
+            std::uint64_t k = varint();
+            if (k == 0) {
+                names.emplace_back(bytes());
+                top.field = names.back();
+            } else if (k <= names.size()) {
+                top.field = names[static_cast<size_t>(k - 1)];
+            } else {
+                corrupt("invalid field name");
+            }
+        }
+    }
+    void deliver(Frame& top, Value v) {
+        if (top.container.is<Value::ArrayType>()) {
+            top.container.as<Value::ArrayType>()->elements.push_back(std::move(v));
+        } else if (top.container.is<Value::DictType>()) {
+            top.container.as<Value::DictType>()->set(top.key, std::move(v));
+        } else {
+            auto& obj = *top.container.as<Value::MutableObjectType>();
+            if (top.parent_pending) {
+                top.parent_pending = false;
+                if (v.is<Value::MutableObjectType>() && !obj.klass) obj.parent = v.as<Value::MutableObjectType>();
+                else if (!v.is<std::monostate>()) corrupt("invalid object prototype");
+            } else {
+                obj.fields[top.field] = std::move(v);
+            }
         }
+    }
 
-    }, val.getVariant());
-}
+public:
+    // owner 非空时 data 是它持有的只读内存，长字符串直接引用这块内存
+    Deserializer(std::string_view data, ClassResolver r, std::shared_ptr<const void> o = nullptr)
+        : p(reinterpret_cast<const unsigned char*>(data.data())), end(p + data.size()), resolve(std::move(r)), owner(std::move(o)) {}
 
+    Value read() {
+        if (static_cast<size_t>(end - p) < ser::MAGIC_LEN + 1 || std::memcmp(p, ser::MAGIC, ser::MAGIC_LEN) != 0) {
+            corrupt("not serialized MiniLang data");
+        }
+        p += ser::MAGIC_LEN;
+        if (*p != ser::VERSION) {
+            throw std::runtime_error("deserialize: unsupported format version " + std::to_string(*p) + " (expected " + std::to_string(ser::VERSION) + ").");
+        }
+        ++p;
+        Value v;
+        for (;;) {
+            if (!stack.empty()) beginItem(stack.back());
+            if (!read(v)) continue;
+            // 完成的值交给外层容器；外层随之读满时继续向上收尾
+            for (;;) {
+                if (stack.empty()) {
+                    if (p != end) corrupt("unexpected trailing data");
+                    return v;
+                }
+                Frame& top = stack.back();
+                deliver(top, std::move(v));
+                if (--top.remaining > 0) break;
+                v = std::move(top.container);
+                stack.pop_back();
+            }
+        }
+    }
+};
 
 class Interpreter {
     std::shared_ptr<Environment> globalEnv = std::make_shared<Environment>();
@@ -2183,29 +8482,48 @@ public:
             for (const auto& statement : ast) {
                 if (!statement) continue;
                 if (auto retVal = statement->exec(*globalEnv); retVal.has_value()) {
+                    stdout_buffer.flush();
                     std::cerr << "Runtime Error: Cannot return from top-level code." << std::endl;
                     break;
                 }
             }
         } catch (const ThrowSignal& signal) {
-            std::cerr << "Unhandled Exception: " << signal.thrown_value.toString() << std::endl;
+            std::string message = signal.thrown_value.toString();
+            stdout_buffer.flush();
+            std::cerr << "Unhandled Exception: " << message << std::endl;
         } catch (const RuntimeError& e) {
+            stdout_buffer.flush();
             std::cerr << e.what() << std::endl;
         } catch (const std::runtime_error& e) {
+            stdout_buffer.flush();
             std::cerr << "Runtime Error: " << e.what() << std::endl;
         }
+        stdout_buffer.flush();
     }
 private:
     void defineNativeFunctions() {
         globalEnv->define("print", Value(std::make_shared<NativeFunction>(
             [](const std::vector<Value>& args) -> Value {
-                for (size_t i = 0; i < args.size(); ++i) {
-                    std::cout << args[i].toString();
-                    if (i < args.size() - 1) {
-                        std::cout << " ";
+                // 整行先格式化到复用的 line 中再交给 stdout_buffer：对象的 toString() 方法里可能再次调用 print，
+                // 这样嵌套输出仍然完整地出现在本行之前；嵌套调用使用自己的临时字符串
+                static std::string line;
+                static int depth = 0;
+                std::string nested;
+                std::string& out = depth == 0 ? line : nested;
+                out.clear();
+                ++depth;
+                try {
+                    for (size_t i = 0; i < args.size(); ++i) {
+                        if (i > 0) out += ' ';
+                        args[i].format(out);
                     }
+                } catch (...) {
+                    --depth;
+                    throw;
                 }
-                std::cout << std::endl;
+                --depth;
+                out += '\n';
+                stdout_buffer.write(out);
                 return Value();
             }, -1, "print"
         )), std::nullopt);
@@ -2213,10 +8531,11 @@ private:
             [](const std::vector<Value>& args) -> Value {
                 const auto& val = args[0];
                 return std::visit(overloaded{
-                    [](const StringData& s) { return Value(static_cast<int>(s.get().length())); },
+                    [](const StringData& s) { return Value(static_cast<int>(s.length())); },
                     [](const Value::ArrayType& a) { return Value(static_cast<int>(a->elements.size())); },
-                    [](const Value::DictType& d) { return Value(static_cast<int>(d->pairs.size())); },
+                    [](const Value::DictType& d) { return Value(static_cast<int>(d->size())); },
                     [](const Value::MutableObjectType& o) { return Value(static_cast<int>(o->fields.size())); },
+                    [](const Value::NativeType& n) { return Value(n->length()); },
                     [](const auto&) -> Value { throw std::runtime_error("Value has no length."); }
                 }, val.getVariant());
             }, 1, "len"
@@ -2240,12 +8559,14 @@ private:
                     [](const Value::MutableObjectType& o) {
                         if (o && o->klass) return Value(o->klass->name);
                         return Value("object");
-                    }
+                    },
+                    [](const Value::NativeType& n) { return Value(n->typeName()); }
                 }, val.getVariant());
             }, 1, "type"
         )), std::nullopt);
         globalEnv->define("str", Value(std::make_shared<NativeFunction>(
             [](const std::vector<Value>& args) -> Value {
+                if (args[0].is<int>()) return Value(int_to_string_data(args[0].as<int>()));
                 return Value(args[0].toString());
             }, 1, "str"
         )), std::nullopt);
@@ -2258,8 +8579,9 @@ private:
                     [](bool b) { return Value(static_cast<int>(b)); },
                     [](const StringData& s_data) -> Value {
                         const auto& s = s_data.get();
-                        try { return Value(std::stoi(s)); }
-                        catch (...) { throw std::runtime_error("Cannot convert string '" + s + "' to int."); }
+                        int result;
+                        if (!parse_int(s, result)) throw std::runtime_error("Cannot convert string '" + s + "' to int.");
+                        return Value(result);
                     },
                     [](const auto&) -> Value { throw std::runtime_error("Cannot convert type to int."); }
                 }, val.getVariant());
@@ -2278,8 +8600,9 @@ private:
                     [](double d) { return Value(d); },
                     [](const StringData& s_data) -> Value {
                         const auto& s = s_data.get();
-                        try { return Value(std::stod(s)); }
-                        catch (...) { throw std::runtime_error("Cannot convert string '" + s + "' to float."); }
+                        double result;
+                        if (!parse_double(s, result)) throw std::runtime_error("Cannot convert string '" + s + "' to float.");
+                        return Value(result);
                     },
                     [](const auto&) -> Value { throw std::runtime_error("Cannot convert type to float."); }
                 }, val.getVariant());
@@ -2289,7 +8612,7 @@ private:
             [](const std::vector<Value>& args) -> Value {
                 if (args.size() != 2) throw std::runtime_error("append() takes exactly 2 arguments.");
                 
-                Value container = args[0];
+                Value container = array_operand(args[0]);
                 const Value& element = args[1];
 
                 if (container.is<Value::ArrayType>()) {
@@ -2310,8 +8633,9 @@ private:
         globalEnv->define("pop", Value(std::make_shared<NativeFunction>(
             [](const std::vector<Value>& args) -> Value {
                 if (args.size() != 1 && args.size() != 2) throw std::runtime_error("pop() takes 1 or 2 arguments.");
-                if (!args[0].is<Value::ArrayType>()) throw std::runtime_error("First argument to pop must be an array.");
-                auto& vec = args[0].as<Value::ArrayType>()->elements;
+                Value container = array_operand(args[0]);
+                if (!container.is<Value::ArrayType>()) throw std::runtime_error("First argument to pop must be an array.");
+                auto& vec = container.as<Value::ArrayType>()->elements;
                 if (vec.empty()) throw std::runtime_error("pop from empty array.");
                 if (args.size() == 1) {
                     Value back = vec.back();
@@ -2322,7 +8646,7 @@ private:
                     int idx = args[1].as<int>();
                     if (idx < 0 || idx >= static_cast<int>(vec.size())) throw std::runtime_error("pop index out of range.");
                     Value val = vec[idx];
-                    vec.erase(vec.begin() + idx);
+                    vec.erase(static_cast<size_t>(idx));
                     return val;
                 }
             }, -1, "pop"
@@ -2330,44 +8654,65 @@ private:
         globalEnv->define("slice", Value(std::make_shared<NativeFunction>(
             [](const std::vector<Value>& args) -> Value {
                 if (args.size() != 2 && args.size() != 3) throw std::runtime_error("slice() takes 2 or 3 arguments.");
-                if (!args[0].is<Value::ArrayType>()) throw std::runtime_error("First argument to slice must be an array.");
+                if (!args[0].is<Value::ArrayType>() && !args[0].is<Value::NativeType>() && !args[0].is<StringData>()) {
+                    throw std::runtime_error("First argument to slice must be an array or a string.");
+                }
                 if (!args[1].is<int>()) throw std::runtime_error("Slice start index must be an integer.");
-                const auto& src_vec = args[0].as<Value::ArrayType>()->elements;
+                int length = args[0].is<Value::NativeType>() ? args[0].as<Value::NativeType>()->length()
+                           : args[0].is<StringData>() ? static_cast<int>(args[0].as<StringData>().length())
+                                                      : static_cast<int>(args[0].as<Value::ArrayType>()->elements.size());
                 int start = args[1].as<int>();
-                int end = src_vec.size();
+                int end = length;
                 if (args.size() == 3) {
                     if (!args[2].is<int>()) throw std::runtime_error("Slice end index must be an integer.");
                     end = args[2].as<int>();
                 }
-                if (start < 0 || end > static_cast<int>(src_vec.size()) || start > end) {
+                if (start < 0 || end > length || start > end) {
                     throw std::runtime_error("Slice indices are out of bounds.");
                 }
+                if (args[0].is<Value::NativeType>()) {
+                    return args[0].as<Value::NativeType>()->slice(start, end);
+                }
+                if (args[0].is<StringData>()) {
+                    // 子串共享原字符串的缓冲区，不复制内容
+                    if (start == end) return Value(StringData::from_literal(""));
+                    return Value(args[0].as<StringData>().slice(start, end));
+                }
+                // 切片与原数组共享缓冲区，任何一方修改时才复制
                 auto new_arr_val = std::make_shared<ArrayValue>();
-                new_arr_val->elements.assign(src_vec.begin() + start, src_vec.begin() + end);
+                new_arr_val->elements = args[0].as<Value::ArrayType>()->elements.slice(start, end);
                 return Value(new_arr_val);
             }, -1, "slice"
         )), std::nullopt);
         globalEnv->define("input", Value(std::make_shared<NativeFunction>(
             [](const std::vector<Value>& args) -> Value {
                  if (args.size() > 1) throw std::runtime_error("input() takes 0 or 1 argument.");
-                 if (args.size() == 1) {
-                     std::cout << args[0].toString();
-                     std::cout.flush();
-                 }
+                 if (args.size() == 1) stdout_buffer.write(args[0].toString());
+                 stdout_buffer.flush();
                  std::string line;
                  std::getline(std::cin, line);
                  return Value(line);
             }, -1, "input"
         )), std::nullopt);
+        globalEnv->define("flush", Value(std::make_shared<NativeFunction>(
+            [](const std::vector<Value>&) -> Value {
+                stdout_buffer.flush();
+                return Value();
+            }, 0, "flush"
+        )), std::nullopt);
+        globalEnv->define("line_buffered", Value(std::make_shared<NativeFunction>(
+            [](const std::vector<Value>& args) -> Value {
+                if (!args[0].is<bool>()) throw std::runtime_error("Argument to line_buffered must be a boolean.");
+                stdout_buffer.line_buffered = args[0].as<bool>();
+                if (stdout_buffer.line_buffered) stdout_buffer.flush();
+                return Value();
+            }, 1, "line_buffered"
+        )), std::nullopt);
         globalEnv->define("read_file", Value(std::make_shared<NativeFunction>(
             [](const std::vector<Value>& args) -> Value {
                 if (!args[0].is<StringData>()) throw std::runtime_error("Argument to read_file must be a string path.");
-                const auto& path = args[0].as<StringData>().get();
-                std::ifstream file(path);
-                if (!file) throw std::runtime_error("Could not open file: " + path);
-                std::stringstream buffer;
-                buffer << file.rdbuf();
-                return Value(buffer.str());
+                // 按文件大小一次分配、一次读入，不经过 stringstream 的中间副本
+                return Value(read_whole_file<std::string>(args[0].as<StringData>().get()));
             }, 1, "read_file"
         )), std::nullopt);
         globalEnv->define("write_file", Value(std::make_shared<NativeFunction>(
@@ -2382,6 +8727,175 @@ private:
                 return Value();
             }, 2, "write_file"
         )), std::nullopt);
+        globalEnv->define("Bytes", Value(std::make_shared<NativeFunction>(
+            [](const std::vector<Value>& args) -> Value {
+                const Value& source = args[0];
+                if (source.is<int>()) {
+                    if (source.as<int>() < 0) throw std::runtime_error("Bytes() size must be non-negative.");
+                    return bytes_value(std::vector<unsigned char>(static_cast<size_t>(source.as<int>())));
+                }
+                // 映射文件：只读视图，不复制内容
+                if (source.is<Value::NativeType>()) {
+                    if (auto mapped = std::dynamic_pointer_cast<MappedFileValue>(source.as<Value::NativeType>())) {
+                        auto store = std::make_shared<ByteStorage>();
+                        std::string_view view = mapped->view();
+                        store->owner = mapped;
+                        store->mapped = reinterpret_cast<const unsigned char*>(view.data());
+                        store->mapped_size = view.size();
+                        return Value(std::static_pointer_cast<NativeObject>(std::make_shared<BytesValue>(store, 0, view.size())));
+                    }
+                }
+                return bytes_value(bytes_from(source, "Bytes()"));
+            }, 1, "Bytes"
+        )), std::nullopt);
+        globalEnv->define("read_file_bytes", Value(std::make_shared<NativeFunction>(
+            [](const std::vector<Value>& args) -> Value {
+                if (!args[0].is<StringData>()) throw std::runtime_error("Argument to read_file_bytes must be a string path.");
+                return bytes_value(read_whole_file<std::vector<unsigned char>>(args[0].as<StringData>().get()));
+            }, 1, "read_file_bytes"
+        )), std::nullopt);
+        globalEnv->define("write_file_bytes", Value(std::make_shared<NativeFunction>(
+            [](const std::vector<Value>& args) -> Value {
+                if (!args[0].is<StringData>()) throw std::runtime_error("Path for write_file_bytes must be a string.");
+                const auto& path = args[0].as<StringData>().get();
+                std::ofstream file(path, std::ios::binary);
+                if (!file) throw std::runtime_error("Could not open file for writing: " + path);
+                auto* bytes = args[1].is<Value::NativeType>() ? dynamic_cast<const BytesValue*>(args[1].as<Value::NativeType>().get()) : nullptr;
+                if (bytes) {
+                    file.write(reinterpret_cast<const char*>(bytes->data()), static_cast<std::streamsize>(bytes->len));
+                } else if (args[1].is<StringData>()) {
+                    file << args[1].as<StringData>().get();
+                } else {
+                    throw std::runtime_error("Content for write_file_bytes must be Bytes or a string.");
+                }
+                return Value();
+            }, 2, "write_file_bytes"
+        )), std::nullopt);
+        globalEnv->define("open", Value(std::make_shared<NativeFunction>(
+            [](const std::vector<Value>& args) -> Value {
+                if (args.empty() || args.size() > 2) throw std::runtime_error("open() takes a path and an optional mode.");
+                if (!args[0].is<StringData>()) throw std::runtime_error("Path for open must be a string.");
+                std::string mode = "r";
+                if (args.size() == 2) {
+                    if (!args[1].is<StringData>()) throw std::runtime_error("Mode for open must be a string.");
+                    mode = args[1].as<StringData>().get();
+                }
+                return Value(std::static_pointer_cast<NativeObject>(std::make_shared<FileValue>(args[0].as<StringData>().get(), mode)));
+            }, -1, "open"
+        )), std::nullopt);
+        globalEnv->define("lines", Value(std::make_shared<NativeFunction>(
+            [](const std::vector<Value>& args) -> Value {
+                if (!args[0].is<StringData>()) throw std::runtime_error("Argument to lines must be a string path.");
+                return Value(std::static_pointer_cast<NativeObject>(std::make_shared<LinesValue>(args[0].as<StringData>().get())));
+            }, 1, "lines"
+        )), std::nullopt);
+        globalEnv->define("csv", Value(std::make_shared<NativeFunction>(
+            [](const std::vector<Value>& args) -> Value {
+                if (args.empty() || args.size() > 2) throw std::runtime_error("csv() takes a path and an optional options dict.");
+                if (!args[0].is<StringData>()) throw std::runtime_error("Path for csv must be a string.");
+                return Value(std::static_pointer_cast<NativeObject>(
+                    std::make_shared<CsvReaderValue>(args[0].as<StringData>().get(), args.size() == 2 ? args[1] : Value())));
+            }, -1, "csv"
+        )), std::nullopt);
+        globalEnv->define("read_csv", Value(std::make_shared<NativeFunction>(
+            [](const std::vector<Value>& args) -> Value {
+                if (args.empty() || args.size() > 2) throw std::runtime_error("read_csv() takes a path and an optional options dict.");
+                if (!args[0].is<StringData>()) throw std::runtime_error("Path for read_csv must be a string.");
+                CsvReaderValue reader(args[0].as<StringData>().get(), args.size() == 2 ? args[1] : Value());
+                return reader.readAllColumns();
+            }, -1, "read_csv"
+        )), std::nullopt);
+        globalEnv->define("json_parse", Value(std::make_shared<NativeFunction>(
+            [](const std::vector<Value>& args) -> Value {
+                // 也接受 map_file() 的结果，大文件无需先读成字符串
+                if (args[0].is<Value::NativeType>()) {
+                    if (auto* mapped = dynamic_cast<MappedFileValue*>(args[0].as<Value::NativeType>().get())) return JsonParser(mapped->view()).parse();
+                }
+                if (!args[0].is<StringData>()) throw std::runtime_error("json_parse() expects a string or a MappedFile.");
+                return JsonParser(args[0].as<StringData>().get()).parse();
+            }, 1, "json_parse"
+        )), std::nullopt);
+
+        globalEnv->define("json_stringify", Value(std::make_shared<NativeFunction>(
+            [](const std::vector<Value>& args) -> Value {
+                if (args.empty() || args.size() > 2) throw std::runtime_error("json_stringify() takes a value and an optional indent.");
+                int indent = -1;
+                if (args.size() == 2) {
+                    if (!args[1].is<int>() || args[1].as<int>() < 0) throw std::runtime_error("json_stringify() indent must be a non-negative integer.");
+                    indent = args[1].as<int>();
+                }
+                std::string out;
+                JsonWriter(out, indent).write(args[0]);
+                return Value(std::move(out));
+            }, -1, "json_stringify"
+        )), std::nullopt);
+
+        globalEnv->define("ndjson", Value(std::make_shared<NativeFunction>(
+            [](const std::vector<Value>& args) -> Value {
+                if (!args[0].is<StringData>()) throw std::runtime_error("ndjson() expects a file path.");
+                return Value(std::static_pointer_cast<NativeObject>(std::make_shared<NdjsonValue>(args[0].as<StringData>().get())));
+            }, 1, "ndjson"
+        )), std::nullopt);
+
+        globalEnv->define("serialize", Value(std::make_shared<NativeFunction>(
+            [](const std::vector<Value>& args) -> Value {
+                std::string out;
+                Serializer(out).write(args[0]);
+                return Value(std::move(out));
+            }, 1, "serialize"
+        )), std::nullopt);
+
+        // deserialize(data, [classes])：对象按类名重新关联到 classes 数组中或全局作用域里的同名类
+        globalEnv->define("deserialize", Value(std::make_shared<NativeFunction>(
+            [env = globalEnv.get()](const std::vector<Value>& args) -> Value {
+                if (args.empty() || args.size() > 2) throw std::runtime_error("deserialize() takes the data and an optional array of classes.");
+                std::string_view data;
+                if (args[0].is<StringData>()) {
+                    data = args[0].as<StringData>().get();
+                } else if (auto* mapped = args[0].is<Value::NativeType>() ? dynamic_cast<MappedFileValue*>(args[0].as<Value::NativeType>().get()) : nullptr) {
+                    data = mapped->view();
+                } else if (auto* bytes = args[0].is<Value::NativeType>() ? dynamic_cast<BytesValue*>(args[0].as<Value::NativeType>().get()) : nullptr) {
+                    data = bytes->view();
+                } else {
+                    throw std::runtime_error("deserialize() expects a string, Bytes or a MappedFile.");
+                }
+                std::vector<std::shared_ptr<ClassValue>> listed;
+                if (args.size() == 2) {
+                    if (!args[1].is<Value::ArrayType>()) throw std::runtime_error("deserialize() classes must be an array of classes.");
+                    for (const auto& c : args[1].as<Value::ArrayType>()->elements) {
+                        auto cls = c.is<Value::FuncType>() ? std::dynamic_pointer_cast<ClassValue>(c.as<Value::FuncType>()) : nullptr;
+                        if (!cls) throw std::runtime_error("deserialize() classes must be an array of classes.");
+                        listed.push_back(cls);
+                    }
+                }
+                auto resolve = [env, &listed](const std::string& name) -> std::shared_ptr<ClassValue> {
+                    for (const auto& cls : listed) if (cls->name == name) return cls;
+                    try {
+                        const Value& v = env->get(name);
+                        return v.is<Value::FuncType>() ? std::dynamic_pointer_cast<ClassValue>(v.as<Value::FuncType>()) : nullptr;
+                    } catch (const std::runtime_error&) {
+                        return nullptr;
+                    }
+                };
+                std::shared_ptr<const void> owner;
+                if (dynamic_cast<MappedFileValue*>(args[0].is<Value::NativeType>() ? args[0].as<Value::NativeType>().get() : nullptr)) {
+                    owner = args[0].as<Value::NativeType>();
+                }
+                return Deserializer(data, resolve, std::move(owner)).read();
+            }, -1, "deserialize"
+        )), std::nullopt);
+
+        globalEnv->define("DataFrame", Value(std::make_shared<NativeFunction>(
+            [](const std::vector<Value>& args) -> Value {
+                return Value(std::static_pointer_cast<NativeObject>(make_dataframe(args[0])));
+            }, 1, "DataFrame"
+        )), std::nullopt);
+        globalEnv->define("map_file", Value(std::make_shared<NativeFunction>(
+            [](const std::vector<Value>& args) -> Value {
+                if (!args[0].is<StringData>()) throw std::runtime_error("Argument to map_file must be a string path.");
+                return Value(std::static_pointer_cast<NativeObject>(std::make_shared<MappedFileValue>(args[0].as<StringData>().get())));
+            }, 1, "map_file"
+        )), std::nullopt);
         static const auto start_time = std::chrono::high_resolution_clock::now();
         globalEnv->define("clock", Value(std::make_shared<NativeFunction>(
             [](const std::vector<Value>&) -> Value {
@@ -2420,15 +8934,124 @@ private:
                         if (step == 0) throw std::runtime_error("range() step cannot be zero.");
                     }
                 }
-                auto arr = std::make_shared<ArrayValue>();
-                if (step > 0) {
-                    for (int i = start; i < end; i += step) arr->elements.push_back(Value(i));
-                } else {
-                    for (int i = start; i > end; i += step) arr->elements.push_back(Value(i));
-                }
-                return Value(arr);
+                return Value(std::static_pointer_cast<NativeObject>(std::make_shared<RangeValue>(start, end, step)));
             }, -1, "range"
         )), std::nullopt);
+        globalEnv->define("to_array", Value(std::make_shared<NativeFunction>(
+            [](const std::vector<Value>& args) -> Value {
+                if (args[0].is<Value::ArrayType>()) return args[0];
+                if (args[0].is<Value::NativeType>()) {
+                    if (auto arr = args[0].as<Value::NativeType>()->toArray()) return Value(arr);
+                }
+                throw std::runtime_error("Argument to to_array() must be an array or an iterable sequence.");
+            }, 1, "to_array"
+        )), std::nullopt);
+        globalEnv->define("stream", Value(std::make_shared<NativeFunction>(
+            [](const std::vector<Value>& args) -> Value {
+                const Value& src = args[0];
+                if (src.is<Value::FuncType>() && src.as<Value::FuncType>()->arity() > 0) {
+                    throw std::runtime_error("A generator function passed to stream() must take no arguments.");
+                }
+                if (src.is<std::monostate>() || src.is<int>() || src.is<double>() || src.is<bool>()) {
+                    throw std::runtime_error("Argument to stream() must be an iterable sequence or a generator function.");
+                }
+                return Value(std::static_pointer_cast<NativeObject>(std::make_shared<StreamValue>(src)));
+            }, 1, "stream"
+        )), std::nullopt);
+        globalEnv->define("Int32Array", Value(std::make_shared<NativeFunction>(
+            [](const std::vector<Value>& args) -> Value {
+                return Value(std::static_pointer_cast<NativeObject>(make_typed_array<std::int32_t>(args[0])));
+            }, 1, "Int32Array"
+        )), std::nullopt);
+        globalEnv->define("Float64Array", Value(std::make_shared<NativeFunction>(
+            [](const std::vector<Value>& args) -> Value {
+                return Value(std::static_pointer_cast<NativeObject>(make_typed_array<double>(args[0])));
+            }, 1, "Float64Array"
+        )), std::nullopt);
+        globalEnv->define("Matrix", Value(std::make_shared<NativeFunction>(
+            [](const std::vector<Value>& args) -> Value {
+                return Value(std::static_pointer_cast<NativeObject>(make_matrix(args)));
+            }, -1, "Matrix"
+        )), std::nullopt);
+        globalEnv->define("matmul", Value(std::make_shared<NativeFunction>(
+            [](const std::vector<Value>& args) -> Value {
+                auto a = as_matrix(args[0], "First argument to matmul");
+                auto b = as_matrix(args[1], "Second argument to matmul");
+                return Value(std::static_pointer_cast<NativeObject>(matrix_multiply(*a, *b)));
+            }, 2, "matmul"
+        )), std::nullopt);
+        globalEnv->define("Set", Value(std::make_shared<NativeFunction>(
+            [](const std::vector<Value>& args) -> Value {
+                if (args.size() > 1) throw std::runtime_error("Set() takes 0 or 1 argument.");
+                auto set = args.empty() ? std::make_shared<SetValue>() : make_set(args[0]);
+                return Value(std::static_pointer_cast<NativeObject>(set));
+            }, -1, "Set"
+        )), std::nullopt);
+        globalEnv->define("Deque", Value(std::make_shared<NativeFunction>(
+            [](const std::vector<Value>& args) -> Value {
+                if (args.size() > 1) throw std::runtime_error("Deque() takes 0 or 1 argument.");
+                auto deque = std::make_shared<DequeValue>();
+                if (!args.empty()) {
+                    auto it = make_iterator(args[0]);
+                    Value element;
+                    while (it->next(element)) deque->pushBack(element);
+                }
+                return Value(std::static_pointer_cast<NativeObject>(deque));
+            }, -1, "Deque"
+        )), std::nullopt);
+        globalEnv->define("PriorityQueue", Value(std::make_shared<NativeFunction>(
+            [](const std::vector<Value>& args) -> Value {
+                if (args.size() > 1) throw std::runtime_error("PriorityQueue() takes 0 or 1 argument.");
+                Value::FuncType key_fn;
+                if (!args.empty()) {
+                    if (!args[0].is<Value::FuncType>()) throw std::runtime_error("Argument to PriorityQueue() must be a key function.");
+                    key_fn = args[0].as<Value::FuncType>();
+                    if (key_fn->arity() != 1) throw std::runtime_error("Key function for PriorityQueue must take exactly one argument.");
+                }
+                return Value(std::static_pointer_cast<NativeObject>(std::make_shared<PriorityQueueValue>(key_fn)));
+            }, -1, "PriorityQueue"
+        )), std::nullopt);
+        globalEnv->define("SortedMap", Value(std::make_shared<NativeFunction>(
+            [](const std::vector<Value>& args) -> Value {
+                if (args.size() > 1) throw std::runtime_error("SortedMap() takes 0 or 1 argument.");
+                auto map = std::make_shared<SortedMapValue>();
+                if (!args.empty()) {
+                    if (!args[0].is<Value::DictType>()) throw std::runtime_error("Argument to SortedMap() must be a dict.");
+                    for (const auto& entry : *args[0].as<Value::DictType>()) map->put(entry.key, entry.value);
+                }
+                return Value(std::static_pointer_cast<NativeObject>(map));
+            }, -1, "SortedMap"
+        )), std::nullopt);
+        globalEnv->define("PersistentMap", Value(std::make_shared<NativeFunction>(
+            [](const std::vector<Value>& args) -> Value {
+                if (args.size() > 1) throw std::runtime_error("PersistentMap() takes 0 or 1 argument.");
+                HamtNodePtr root;
+                size_t count = 0;
+                if (!args.empty()) {
+                    if (!args[0].is<Value::DictType>()) throw std::runtime_error("Argument to PersistentMap() must be a dict.");
+                    for (const auto& entry : *args[0].as<Value::DictType>()) {
+                        bool added = false;
+                        root = hamt_assoc(root, entry.key, entry.value, entry.hash, 0, added);
+                        count += added ? 1 : 0;
+                    }
+                }
+                return Value(std::static_pointer_cast<NativeObject>(std::make_shared<PersistentMapValue>(std::move(root), count)));
+            }, -1, "PersistentMap"
+        )), std::nullopt);
+        globalEnv->define("PersistentVector", Value(std::make_shared<NativeFunction>(
+            [](const std::vector<Value>& args) -> Value {
+                if (args.size() > 1) throw std::runtime_error("PersistentVector() takes 0 or 1 argument.");
+                Value vec(std::static_pointer_cast<NativeObject>(std::make_shared<PersistentVectorValue>()));
+                if (!args.empty()) {
+                    auto it = make_iterator(args[0]);
+                    Value element;
+                    while (it->next(element)) {
+                        vec = std::static_pointer_cast<PersistentVectorValue>(vec.as<Value::NativeType>())->push(element);
+                    }
+                }
+                return vec;
+            }, -1, "PersistentVector"
+        )), std::nullopt);
         globalEnv->define("dict", Value(std::make_shared<NativeFunction>(
             [](const std::vector<Value>& args) -> Value {
                 if (!args.empty()) throw std::runtime_error("dict() takes no arguments.");
@@ -2438,13 +9061,13 @@ private:
         globalEnv->define("map", Value(std::make_shared<NativeFunction>(
             [](const std::vector<Value>& args) -> Value {
                 if (!args[0].is<Value::FuncType>()) throw std::runtime_error("First argument to map must be a function.");
-                if (!args[1].is<Value::ArrayType>()) throw std::runtime_error("Second argument to map must be an array.");
                 auto func = args[0].as<Value::FuncType>();
                 if (func->arity() != 1) throw std::runtime_error("Function for map must take exactly one argument.");
-                const auto& src_vec = args[1].as<Value::ArrayType>()->elements;
+                auto it = sequence_iterator(args[1], "Second argument to map");
                 auto res_arr = std::make_shared<ArrayValue>();
-                res_arr->elements.reserve(src_vec.size());
-                for (const auto& elem : src_vec) {
+                if (args[1].is<Value::ArrayType>()) res_arr->elements.reserve(args[1].as<Value::ArrayType>()->elements.size());
+                Value elem;
+                while (it->next(elem)) {
                     res_arr->elements.push_back(func->call({elem}));
                 }
                 return Value(res_arr);
@@ -2453,12 +9076,12 @@ private:
         globalEnv->define("filter", Value(std::make_shared<NativeFunction>(
             [](const std::vector<Value>& args) -> Value {
                 if (!args[0].is<Value::FuncType>()) throw std::runtime_error("First argument to filter must be a function.");
-                if (!args[1].is<Value::ArrayType>()) throw std::runtime_error("Second argument to filter must be an array.");
                 auto func = args[0].as<Value::FuncType>();
                 if (func->arity() != 1) throw std::runtime_error("Function for filter must take exactly one argument.");
-                const auto& src_vec = args[1].as<Value::ArrayType>()->elements;
+                auto it = sequence_iterator(args[1], "Second argument to filter");
                 auto res_arr = std::make_shared<ArrayValue>();
-                for (const auto& elem : src_vec) {
+                Value elem;
+                while (it->next(elem)) {
                     if (func->call({elem}).toBool()) {
                         res_arr->elements.push_back(elem);
                     }
@@ -2466,57 +9089,207 @@ private:
                 return Value(res_arr);
             }, 2, "filter"
         )), std::nullopt);
+        globalEnv->define("sort", Value(std::make_shared<NativeFunction>(
+            [](const std::vector<Value>& args) -> Value {
+                if (args.size() != 1 && args.size() != 2) throw std::runtime_error("sort() takes 1 or 2 arguments.");
+                Value target = array_operand(args[0]);
+                if (!target.is<Value::ArrayType>()) throw std::runtime_error("First argument to sort must be an array.");
+                auto& arr = *target.as<Value::ArrayType>();
+                if (args.size() == 1) {
+                    sort_values(arr.elements.mut());
+                } else {
+                    if (!args[1].is<Value::FuncType>()) throw std::runtime_error("Comparator for sort must be a function.");
+                    sort_values_with(arr, args[1].as<Value::FuncType>());
+                }
+                return target;
+            }, -1, "sort"
+        )), std::nullopt);
+        globalEnv->define("sort_by", Value(std::make_shared<NativeFunction>(
+            [](const std::vector<Value>& args) -> Value {
+                Value target = array_operand(args[0]);
+                if (!target.is<Value::ArrayType>()) throw std::runtime_error("First argument to sort_by must be an array.");
+                if (!args[1].is<Value::FuncType>()) throw std::runtime_error("Second argument to sort_by must be a function.");
+                sort_values_by(*target.as<Value::ArrayType>(), args[1].as<Value::FuncType>());
+                return target;
+            }, 2, "sort_by"
+        )), std::nullopt);
+        globalEnv->define("reverse", Value(std::make_shared<NativeFunction>(
+            [](const std::vector<Value>& args) -> Value {
+                if (Value target = array_operand(args[0]); target.is<Value::ArrayType>()) {
+                    auto& vec = target.as<Value::ArrayType>()->elements.mut();
+                    std::reverse(vec.begin(), vec.end());
+                    return target;
+                }
+                if (args[0].is<StringData>()) {
+                    const StringData& s = args[0].as<StringData>();
+                    std::string_view str = s.view();
+                    if (s.is_ascii()) return Value(std::string(str.rbegin(), str.rend()));
+                    // 按字符反转，保持每个 UTF-8 字符内部的字节顺序
+                    std::string out(str.size(), '\0');
+                    for (size_t pos = 0; pos < str.size();) {
+                        size_t n = StringData::char_length(str, pos);
+                        std::memcpy(&out[str.size() - pos - n], str.data() + pos, n);
+                        pos += n;
+                    }
+                    return Value(std::move(out));
+                }
+                throw std::runtime_error("Argument to reverse must be an array or a string.");
+            }, 1, "reverse"
+        )), std::nullopt);
+        globalEnv->define("sum", Value(std::make_shared<NativeFunction>(
+            [](const std::vector<Value>& args) -> Value {
+                if (args[0].is<Value::NativeType>()) {
+                    // range 的和可以直接用等差数列公式算出
+                    auto* range = dynamic_cast<RangeValue*>(args[0].as<Value::NativeType>().get());
+                    if (range && range->lazy()) {
+                        long long n = range->length();
+                        // n 不超过 2^31，各项在 long double 中都能精确表示
+                        long double total = static_cast<long double>(n) * range->start + static_cast<long double>(range->step) * (n * (n - 1) / 2);
+                        if (total >= INT_MIN && total <= INT_MAX) return Value(static_cast<int>(total));
+                        return Value(static_cast<double>(total));
+                    }
+                    if (dynamic_cast<Float64ArrayValue*>(args[0].as<Value::NativeType>().get()) ||
+                        dynamic_cast<Int32ArrayValue*>(args[0].as<Value::NativeType>().get())) {
+                        return vec_sum(args[0]);
+                    }
+                }
+                return sum_sequence(*sequence_iterator(args[0], "Argument to sum"));
+            }, 1, "sum"
+        )), std::nullopt);
+        globalEnv->define("min", Value(std::make_shared<NativeFunction>(
+            [](const std::vector<Value>& args) -> Value {
+                if (args.empty()) throw std::runtime_error("min() takes at least 1 argument.");
+                return extreme_of(args, -1, "min");
+            }, -1, "min"
+        )), std::nullopt);
+        globalEnv->define("max", Value(std::make_shared<NativeFunction>(
+            [](const std::vector<Value>& args) -> Value {
+                if (args.empty()) throw std::runtime_error("max() takes at least 1 argument.");
+                return extreme_of(args, 1, "max");
+            }, -1, "max"
+        )), std::nullopt);
+        globalEnv->define("join", Value(std::make_shared<NativeFunction>(
+            [](const std::vector<Value>& args) -> Value {
+                if (args.size() != 1 && args.size() != 2) throw std::runtime_error("join() takes 1 or 2 arguments.");
+                Value source = array_operand(args[0]);
+                if (!source.is<Value::ArrayType>()) throw std::runtime_error("First argument to join must be an array.");
+                std::string sep;
+                if (args.size() == 2) {
+                    if (!args[1].is<StringData>()) throw std::runtime_error("Separator for join must be a string.");
+                    sep = args[1].as<StringData>().get();
+                }
+                const auto& vec = source.as<Value::ArrayType>()->elements;
+                size_t total = vec.empty() ? 0 : sep.size() * (vec.size() - 1);
+                for (const auto& v : vec) {
+                    if (v.is<StringData>()) total += v.as<StringData>().get().size();
+                }
+                std::string result;
+                result.reserve(total);
+                for (size_t i = 0; i < vec.size(); ++i) {
+                    if (i > 0) result += sep;
+                    vec[i].format(result);
+                }
+                return Value(result);
+            }, -1, "join"
+        )), std::nullopt);
+        globalEnv->define("index_of", Value(std::make_shared<NativeFunction>(
+            [](const std::vector<Value>& args) -> Value {
+                if (args[0].is<StringData>()) {
+                    if (!args[1].is<StringData>()) throw std::runtime_error("Can only search a string for a substring.");
+                    const StringData& s = args[0].as<StringData>();
+                    size_t pos = s.view().find(args[1].as<StringData>().view());
+                    return Value(pos == std::string::npos ? -1 : static_cast<int>(s.code_point_offset(pos)));
+                }
+                Value source = array_operand(args[0]);
+                if (!source.is<Value::ArrayType>()) throw std::runtime_error("First argument to index_of must be an array or a string.");
+                const auto& vec = source.as<Value::ArrayType>()->elements;
+                for (size_t i = 0; i < vec.size(); ++i) {
+                    if (values_equal(vec[i], args[1])) return Value(static_cast<int>(i));
+                }
+                return Value(-1);
+            }, 2, "index_of"
+        )), std::nullopt);
+        globalEnv->define("contains", Value(std::make_shared<NativeFunction>(
+            [](const std::vector<Value>& args) -> Value {
+                if (args[0].is<StringData>()) {
+                    if (!args[1].is<StringData>()) throw std::runtime_error("Can only search a string for a substring.");
+                    // 直接在视图上查找，子串视图不会因此被复制出来
+                    return Value(args[0].as<StringData>().view().find(args[1].as<StringData>().view()) != std::string_view::npos);
+                }
+                if (args[0].is<Value::DictType>()) {
+                    return Value(args[0].as<Value::DictType>()->contains(args[1]));
+                }
+                if (args[0].is<Value::NativeType>()) {
+                    if (auto* set = dynamic_cast<SetValue*>(args[0].as<Value::NativeType>().get())) {
+                        return Value(set->table.contains(args[1]));
+                    }
+                }
+                auto it = sequence_iterator(args[0], "First argument to contains");
+                Value element;
+                while (it->next(element)) {
+                    if (values_equal(element, args[1])) return Value(true);
+                }
+                return Value(false);
+            }, 2, "contains"
+        )), std::nullopt);
         globalEnv->define("keys", Value(std::make_shared<NativeFunction>(
             [](const std::vector<Value>& args) -> Value {
                 if (!args[0].is<Value::DictType>()) throw std::runtime_error("Argument to keys() must be a dict.");
-                const auto& dict_pairs = args[0].as<Value::DictType>()->pairs;
+                const auto& dict = *args[0].as<Value::DictType>();
                 auto arr = std::make_shared<ArrayValue>();
-                arr->elements.reserve(dict_pairs.size());
-                for (const auto& pair : dict_pairs) {
-                    arr->elements.push_back(Value(pair.first));
+                arr->elements.reserve(dict.size());
+                for (const auto& entry : dict) {
+                    arr->elements.push_back(Value(entry.key));
                 }
                 return Value(arr);
             }, 1, "keys"
         )), std::nullopt);
+        globalEnv->define("entries", Value(std::make_shared<NativeFunction>(
+            [](const std::vector<Value>& args) -> Value {
+                if (!args[0].is<Value::DictType>() && !args[0].is<Value::MutableObjectType>()) {
+                    throw std::runtime_error("Argument to entries() must be a dict or object.");
+                }
+                return Value(std::static_pointer_cast<NativeObject>(std::make_shared<EntriesView>(args[0])));
+            }, 1, "entries"
+        )), std::nullopt);
         globalEnv->define("has", Value(std::make_shared<NativeFunction>(
             [](const std::vector<Value>& args) -> Value {
-                if (!args[1].is<StringData>()) throw std::runtime_error("Second argument to has() must be a string key.");
-                const auto& key = args[1].as<StringData>().get();
-
                 if (args[0].is<Value::DictType>()) {
-                    const auto& dict = args[0].as<Value::DictType>()->pairs;
-                    return Value(dict.count(key) > 0);
+                    return Value(args[0].as<Value::DictType>()->contains(args[1]));
                 }
                 if (args[0].is<Value::MutableObjectType>()) {
+                    if (!args[1].is<StringData>()) throw std::runtime_error("Second argument to has() must be a string key for objects.");
                     const auto& obj = args[0].as<Value::MutableObjectType>();
-                    return Value(obj->has(key));
+                    return Value(obj->has(args[1].as<StringData>().get()));
                 }
                 throw std::runtime_error("First argument to has() must be a dict or object.");
             }, 2, "has"
         )), std::nullopt);
         globalEnv->define("del", Value(std::make_shared<NativeFunction>(
             [](const std::vector<Value>& args) -> Value {
-                if (!args[1].is<StringData>()) throw std::runtime_error("Second argument to del() must be a string key.");
-                const auto& key = args[1].as<StringData>().get();
-
                 if (args[0].is<Value::DictType>()) {
-                    auto& dict = args[0].as<Value::DictType>()->pairs;
-                    dict.erase(key);
+                    args[0].as<Value::DictType>()->erase(args[1]);
                     return Value();
                 }
                 if (args[0].is<Value::MutableObjectType>()) {
+                    if (!args[1].is<StringData>()) throw std::runtime_error("Second argument to del() must be a string key for objects.");
                     auto& obj = args[0].as<Value::MutableObjectType>();
-                    obj->fields.erase(key);
+                    obj->fields.erase(args[1].as<StringData>().get());
                     return Value();
                 }
                 throw std::runtime_error("First argument to del() must be a dict or object.");
             }, 2, "del"
         )), std::nullopt);
 
+        globalEnv->define("freeze", Value(std::make_shared<NativeFunction>(
+            [](const std::vector<Value>& args) -> Value {
+                return freeze_value(args[0]);
+            }, 1, "freeze"
+        )), std::nullopt);
+
         globalEnv->define("deepcopy", Value(std::make_shared<NativeFunction>(
             [](const std::vector<Value>& args) -> Value {
-                std::unordered_map<const void*, Value> memo;
-                return deepcopy_recursive(args[0], memo);
+                return DeepCopier().copy(args[0]);
             }, 1, "deepcopy"
         )), std::nullopt);
 
@@ -2541,20 +9314,24 @@ private:
             [](const std::vector<Value>& args) -> Value {
                  if (args.size() != 1) throw std::runtime_error("dir() takes exactly one argument.");
                  const auto& val = args[0];
-                 std::set<std::string> keys;
 
+                 // 字典按插入顺序列出键；对象沿原型链收集字段名并排序
                  if (val.is<Value::DictType>()) {
-                     const auto& dict = val.as<Value::DictType>()->pairs;
-                     for(const auto& pair : dict) keys.insert(pair.first);
-                 } else if (val.is<Value::MutableObjectType>()) {
-                     auto current = val.as<Value::MutableObjectType>();
-                     while(current) {
-                         for(const auto& pair : current->fields) keys.insert(pair.first);
-                         current = current->parent;
-                     }
-                 } else {
+                     const auto& dict = *val.as<Value::DictType>();
+                     auto result_arr = std::make_shared<ArrayValue>();
+                     result_arr->elements.reserve(dict.size());
+                     for (const auto& entry : dict) result_arr->elements.push_back(Value(entry.key));
+                     return Value(result_arr);
+                 }
+                 if (!val.is<Value::MutableObjectType>()) {
                      throw std::runtime_error("Argument to dir() must be a dict, class instance, or object.");
                  }
+                 std::set<std::string> keys;
+                 auto current = val.as<Value::MutableObjectType>();
+                 while(current) {
+                     for(const auto& pair : current->fields) keys.insert(pair.first);
+                     current = current->parent;
+                 }
 
                  auto result_arr = std::make_shared<ArrayValue>();
                  for(const auto& key : keys) result_arr->elements.push_back(Value(key));
@@ -2562,6 +9339,80 @@ private:
 
             }, 1, "dir"
         )), std::nullopt);
+
+        // vec：面向数值数组的原生向量运算模块，一次调用处理整个数组
+        auto vec_module = std::make_shared<MutableObject>();
+        auto define_vec = [&](const std::string& name, int arity, NativeFunction::NativeFn fn) {
+            vec_module->set(name, Value(std::static_pointer_cast<Callable>(std::make_shared<NativeFunction>(std::move(fn), arity, "vec." + name))));
+        };
+        define_vec("add", 2, [](const std::vector<Value>& args) { return vec_binary<VecOp::ADD>(args, "add"); });
+        define_vec("sub", 2, [](const std::vector<Value>& args) { return vec_binary<VecOp::SUB>(args, "sub"); });
+        define_vec("mul", 2, [](const std::vector<Value>& args) { return vec_binary<VecOp::MUL>(args, "mul"); });
+        define_vec("div", 2, [](const std::vector<Value>& args) { return vec_binary<VecOp::DIV>(args, "div"); });
+        define_vec("lt", 2, [](const std::vector<Value>& args) { return vec_comparison<VecCmp::LT>(args, "lt"); });
+        define_vec("le", 2, [](const std::vector<Value>& args) { return vec_comparison<VecCmp::LE>(args, "le"); });
+        define_vec("gt", 2, [](const std::vector<Value>& args) { return vec_comparison<VecCmp::GT>(args, "gt"); });
+        define_vec("ge", 2, [](const std::vector<Value>& args) { return vec_comparison<VecCmp::GE>(args, "ge"); });
+        define_vec("eq", 2, [](const std::vector<Value>& args) { return vec_comparison<VecCmp::EQ>(args, "eq"); });
+        define_vec("ne", 2, [](const std::vector<Value>& args) { return vec_comparison<VecCmp::NE>(args, "ne"); });
+        define_vec("dot", 2, [](const std::vector<Value>& args) -> Value {
+            NumericOperand a = vec_array_operand(args[0], "dot"), b = vec_array_operand(args[1], "dot");
+            if (a.size != b.size) throw std::runtime_error("vec.dot() arrays must have the same length.");
+            if (a.is_int && b.is_int) {
+                long long s = 0;
+                for (size_t i = 0; i < a.size; ++i) {
+                    long long p = static_cast<long long>(a.i32()[i]) * b.i32()[i];
+                    // 乘积之和超出 64 位时改用浮点计算
+                    if ((p > 0 && s > LLONG_MAX - p) || (p < 0 && s < LLONG_MIN - p)) return Value(f64_dot(a.asF64(), b.asF64(), a.size));
+                    s += p;
+                }
+                return integral_result(s);
+            }
+            return Value(f64_dot(a.asF64(), b.asF64(), a.size));
+        });
+        define_vec("sum", 1, [](const std::vector<Value>& args) { return vec_sum(args[0]); });
+        define_vec("mean", 1, [](const std::vector<Value>& args) -> Value {
+            NumericOperand a = vec_array_operand(args[0], "mean");
+            if (a.size == 0) throw std::runtime_error("vec.mean() of an empty array.");
+            Value total = vec_sum(args[0]);
+            double s = total.is<int>() ? total.as<int>() : total.as<double>();
+            return Value(s / static_cast<double>(a.size));
+        });
+        for (const std::string name : {"min", "max"}) {
+            bool want_max = name == "max";
+            define_vec(name, 1, [name, want_max](const std::vector<Value>& args) -> Value {
+                NumericOperand a = vec_array_operand(args[0], name);
+                if (a.size == 0) throw std::runtime_error("vec." + name + "() of an empty array.");
+                if (a.is_int) {
+                    return Value(want_max ? *std::max_element(a.i32(), a.i32() + a.size) : *std::min_element(a.i32(), a.i32() + a.size));
+                }
+                return Value(f64_extreme(a.f64(), a.size, want_max));
+            });
+        }
+        define_vec("abs", 1, [](const std::vector<Value>& args) -> Value {
+            NumericOperand a = vec_array_operand(args[0], "abs");
+            if (a.is_int) {
+                // |INT32_MIN| 不能用 int32 表示，此时结果改为 Float64Array
+                if (std::find(a.i32(), a.i32() + a.size, INT32_MIN) != a.i32() + a.size) {
+                    std::vector<double> out(a.size);
+                    for (size_t i = 0; i < a.size; ++i) out[i] = std::fabs(static_cast<double>(a.i32()[i]));
+                    return typed_array_value(std::move(out));
+                }
+                std::vector<std::int32_t> out(a.size);
+                for (size_t i = 0; i < a.size; ++i) out[i] = a.i32()[i] < 0 ? -a.i32()[i] : a.i32()[i];
+                return typed_array_value(std::move(out));
+            }
+            std::vector<double> out(a.size);
+            f64_abs(a.f64(), out.data(), a.size);
+            return typed_array_value(std::move(out));
+        });
+        define_vec("sqrt", 1, [](const std::vector<Value>& args) -> Value {
+            NumericOperand a = vec_array_operand(args[0], "sqrt");
+            std::vector<double> out(a.size);
+            f64_sqrt(a.asF64(), out.data(), a.size);
+            return typed_array_value(std::move(out));
+        });
+        globalEnv->define("vec", Value(vec_module), std::nullopt);
     }
 };
 
@@ -2598,6 +9449,7 @@ int main(int argc, char* argv[]) {
         Interpreter interpreter(std::move(ast));
         interpreter.interpret();
     } catch (const std::exception& e) {
+        stdout_buffer.flush();
         std::cerr << "Fatal Error (unhandled C++ exception): " << e.what() << std::endl;
         return 1;
     }